@@ -103,7 +103,9 @@ reg_test_bgpfilter() {
 	$PROG bgpfilter bgp1 "as_path~.*(33299).*&prefix}10.100.0.1" > res/bgpfilter13
 	$PROG bgpfilter bgp1 "as_path~100.*a" > res/bgpfilter14
 	$PROG bgpfilter bgp1 "(as_path~.*(33299).*)&(prefix}10.100.0.1|prefix}10.101.0.1)" > res/bgpfilter15
-	n=15
+	$PROG bgpfilter bgp_longpath "as_path>60" > res/bgpfilter16
+	$PROG bgpfilter bgp_longpath "as_path=1" > res/bgpfilter17
+	n=17
 
 	for i in `seq 1 $n`; do
 		output_file=bgpfilter$i
@@ -218,6 +220,42 @@ reg_test_ipamfilter() {
 	done
 }
 
+# feed a file to a pipe in small chunks, so lines are split across reads
+trickle() {
+	local size=`wc -c < $1`
+	local off=0
+
+	while [ $off -lt $size ]; do
+		tail -c +$((off + 1)) $1 | head -c 13
+		sleep 0.02
+		off=$((off + 13))
+	done
+}
+
+reg_test_pipe() {
+	local output_file
+
+	trickle simplify_mixed | $PROG sort /dev/stdin > res/pipe_sort
+	trickle simplify_mixed | $PROG grep /dev/stdin 10.0.0.0/8 > res/pipe_grep
+	trickle simplify_mixed | $PROG print /dev/stdin > res/pipe_print
+	for output_file in pipe_sort pipe_grep pipe_print; do
+		if [ ! -f ref/$output_file ]; then
+			echo "No ref file found for this test, creating it 'ref/$output_file'"
+			cp res/$output_file ref/$output_file
+		else
+			echo -n "reg test [$output_file] :"
+			diff res/$output_file ref/$output_file > /dev/null
+			if [ $? -eq 0 ]; then
+				echo -e "\033[32mOK\033[0m"
+				n_ok=$((n_ok + 1))
+			else
+				n_ko=$((n_ko + 1))
+				echo -e "\033[31mKO\033[0m"
+			fi
+		fi
+	done
+}
+
 result() {
 	echo "Summary : "
 	echo -e "\033[32m$n_ok OK\033[0m"
@@ -234,17 +272,27 @@ reg_test -c st-bizarr2.conf sort bizar2.csv
 #a CSV with Extended Attributes
 reg_test sort sort_long_EA
 reg_test print sort_long_EA
+#last line without a newline
+reg_test print no_newline
 #basic print to test fmt
 reg_test -c st-fmt.conf print route_aggipv6-2
 reg_test -c st-fmt.conf print route_aggipv4
 reg_test subnetcmp uniq1 uniq2
 reg_test subnetcmp uniq2 uniq1
+reg_test subnetcmp subnetcmp_before subnetcmp_after
 reg_test compare uniq1 uniq2
 reg_test compare uniq2 uniq1
+reg_test compare BURP BURP
+reg_test compare sort1-ipv6 aggipv6
+reg_test paip ipam-test paip_routes
 reg_test missing  BURP2 BURP
 reg_test uniq  BURP2 BURP
 reg_test uniq  uniq1 uniq2
+reg_test bgpcmp bgp1 bgp2
+reg_test -new bgpcmp bgp2 bgp1
 reg_test common  BURP2 BURP
+reg_test common aggipv6 sort1-ipv6
+reg_test uniq aggipv6 sort1-ipv6
 reg_test subnetagg aggipv4
 # this one should test enough IPv6 functionnality
 reg_test subnetagg aggipv6
@@ -256,15 +304,26 @@ reg_test routesimplify1 BURP
 reg_test routesimplify2 BURP
 reg_test routesimplify1 simple
 reg_test routesimplify2 simple
+reg_test routesimplify1 simplify_mixed
+reg_test routesimplify2 simplify_mixed
 reg_test sort aggipv4
+reg_test -mem 64K sort simplify_mixed
 reg_test sortby prefix	sortme
 reg_test sortby mask	sortme
 reg_test sortby gw	sortme
+reg_test sortby gw	sortgw_mixed
+reg_test sortby mask,gw	sortgw_mixed
 reg_test routesimplify1 simplify1
 reg_test routesimplify2 simplify1
+reg_test addfiles simplify_mixed sortme
 reg_test sort aggipv6
 reg_test sort sort1
 reg_test sort sort1-ipv6
+reg_test sort print_edge
+# sorted runs followed by a shuffled tail: run detection, merges & gallop
+reg_test sort sort_runs
+reg_test sortby mask sort_runs
+reg_test -mem 64K sort sort_runs
 # removal
 reg_test removesubnet subnet 10.1.1.2/16  10.1.2.0/24
 reg_test removesubnet subnet 10.1.0.0/16  10.1.0.0/28
@@ -274,6 +333,8 @@ reg_test removesubnet subnet 2001:db8::/32 2001:db8:a::/64
 reg_test removesubnet subnet 2001:db8::/32 2001:db8:ffff:ffff::/64
 reg_test removesubnet file route_aggipv6-2 2001:dbb::/64
 reg_test removesubnet file route_aggipv4 10.1.4.0/32
+reg_test removesubnet file remove_many 10.1.2.3/32
+reg_test removefile simplify_mixed remove_exclusions
 
 reg_test split 2001:db8:1::/48 16,16,16
 reg_test split 2001:db8:1::/48 16
@@ -289,6 +350,7 @@ reg_test_logic
 reg_test_filter
 reg_test_bgpfilter
 reg_test_ipamfilter
+reg_test_pipe
 # converter
 reg_test convert CiscoRouterconf	ciscorouteconf_v4
 reg_test convert CiscoRouterconf	ciscorouteconf_v6
@@ -321,8 +383,15 @@ reg_test bgpsortby med bgp1
 reg_test bgpsortby prefix bgp1
 reg_test bgpsortby localpref bgp1
 reg_test bgpsortby gw bgp1
+reg_test bgpsortby aspath bgp1
+reg_test bgpsortby localpref,aspath,med bgp1
+reg_test bgpsortby med bgp_runs
+reg_test bgpsortby localpref,med bgp_runs
 
 reg_test grep mergeipv6 2001:db8::
+reg_test grep -f grep_patterns simplify_mixed
+reg_test grep no_newline 10.2.0.0/16
+reg_test lookup simplify_mixed lookup_ips
 #ipinfo
 
 reg_test ipinfo 2001:0000:4136:e378:8000:63bf:3fff:fdd2
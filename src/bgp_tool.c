@@ -13,22 +13,26 @@
 #include "string2ip.h"
 #include "utils.h"
 #include "generic_csv.h"
-#include "heap.h"
 #include "st_printf.h"
 #include "st_scanf.h"
 #include "generic_expr.h"
+#include "st_prefix_hash.h"
+#include "st_radix.h"
+#include "st_sort.h"
 #include "bgp_tool.h"
 
 int fprint_bgp_route(FILE *output, struct bgp_route *route)
 {
-	return st_fprintf(output, "%d;%s;%s;%16P;%16a;%10d;%10d;%10d;     %c;%s\n",
+	st_fprintf(output, "%d;%s;%s;%16P;%16a;%10d;%10d;%10d;     %c;",
 			route->valid,
 			(route->type == 'i' ? " iBGP" : " eBGP"),
 			(route->best == 1 ? "Best" : "  No"),
 			route->subnet, route->gw, route->MED,
 			route->LOCAL_PREF, route->weight,
-			route->origin,
-			route->AS_PATH);
+			route->origin);
+	/* %s would truncate long AS_PATHs */
+	fputs(aspath_str(route->aspath), output);
+	return fputc('\n', output);
 }
 
 void fprint_bgp_file(FILE *output, struct bgp_file *bf)
@@ -55,57 +59,80 @@ void zero_bgproute(struct bgp_route *a)
 	memset(a, 0, sizeof(struct bgp_route));
 }
 
+static int bgp_route_changed(const struct bgp_route *r1, const struct bgp_route *r2)
+{
+	int changed = 0;
+
+	if (is_equal_ip(&r1->gw, &r2->gw) == 0)
+		changed++;
+	if (r1->MED != r2->MED)
+		changed++;
+	if (r1->LOCAL_PREF != r2->LOCAL_PREF)
+		changed++;
+	if (r1->weight != r2->weight)
+		changed++;
+	if (r1->type != r2->type)
+		changed++;
+	if (r1->origin != r2->origin)
+		changed++;
+	if (r1->aspath != r2->aspath)
+		changed++;
+	return changed;
+}
+
+#define is_best_bgp_route(__r) ((__r)->best != 0 && (__r)->valid == 1)
+
+/*
+ * sf2 best routes are indexed by prefix, so all paths of a prefix (multipath)
+ * are found with one lookup; linear in sf1->nr + sf2->nr
+ */
 int compare_bgp_file(const struct bgp_file *sf1, const struct bgp_file *sf2, struct st_options *o)
 {
 	unsigned long i, j;
-	int found, changed, changed_j;
+	long first, k, changed_j;
+	struct prefix_hash ph;
+	unsigned char *seen;
+	int res;
 
 	debug(BGPCMP, 6, "file1 : %ld routes, file2 : %ld routes\n", sf1->nr, sf2->nr);
+	res = alloc_prefix_hash(&ph, sf2->nr);
+	if (res < 0)
+		return res;
+	/* seen[first] : group of paths starting at 'first' matched a sf1 best route */
+	seen = st_malloc(sf2->nr + 1, "bgpcmp seen");
+	if (seen == NULL) {
+		free_prefix_hash(&ph);
+		return -1;
+	}
+	memset(seen, 0, sf2->nr + 1);
+	for (j = 0; j < sf2->nr; j++)
+		if (is_best_bgp_route(&sf2->routes[j]))
+			prefix_hash_insert(&ph, &sf2->routes[j].subnet, j);
+
 	for (i = 0; i < sf1->nr; i++) {
 		st_debug(BGPCMP, 9, "testing %P via %I\n", sf1->routes[i].subnet,
 					sf1->routes[i].gw);
-		if (sf1->routes[i].best == 0 || sf1->routes[i].valid != 1) {
+		if (!is_best_bgp_route(&sf1->routes[i])) {
 			st_debug(BGPCMP, 5, "%P via %I is not a best route, skipping\n",
 					sf1->routes[i].subnet, sf1->routes[i].gw);
 			continue;
 		}
-		found   = 0;
+		first = prefix_hash_find(&ph, &sf1->routes[i].subnet);
+		if (first == -1) {
+			st_fprintf(o->output_file, "WITHDRAWN;");
+			fprint_bgp_route(o->output_file, &sf1->routes[i]);
+			continue;
+		}
+		seen[first] = 1;
 		changed_j = -1;
-		for (j = 0; j < sf2->nr; j++) {
-			changed = 0;
-			if (sf2->routes[j].best == 0 || sf2->routes[j].valid != 1)
-				continue;
-			if (subnet_compare(&sf1->routes[i].subnet,
-						&sf2->routes[j].subnet) != EQUALS)
-				continue;
-			found = 1;
-			if (is_equal_ip(&sf1->routes[i].gw, &sf2->routes[j].gw) == 0)
-				changed++;
-			if (sf1->routes[i].MED != sf2->routes[j].MED)
-				changed++;
-			if (sf1->routes[i].LOCAL_PREF != sf2->routes[j].LOCAL_PREF)
-				changed++;
-			if (sf1->routes[i].weight != sf2->routes[j].weight)
-				changed++;
-			if (sf1->routes[i].type != sf2->routes[j].type)
-				changed++;
-			if (sf1->routes[i].origin != sf2->routes[j].origin)
-				changed++;
-			if (strcmp(sf1->routes[i].AS_PATH, sf2->routes[j].AS_PATH))
-				changed++;
-
-			if (changed)
-				changed_j = j;
+		for (k = first; k != -1; k = prefix_hash_next(&ph, k)) {
+			if (bgp_route_changed(&sf1->routes[i], &sf2->routes[k]))
+				changed_j = k;
 			else {
 				changed_j = -1;
 				break;
 			}
 		}
-		if (found == 0) {
-			st_fprintf(o->output_file, "WITHDRAWN;");
-			fprint_bgp_route(o->output_file, &sf1->routes[i]);
-			continue;
-		}
 		if (changed_j == -1) {
 			fprintf(o->output_file, "UNCHANGED;");
 			fprint_bgp_route(o->output_file, &sf1->routes[i]);
@@ -116,164 +143,140 @@ int compare_bgp_file(const struct bgp_file *sf1, const struct bgp_file *sf2, str
 		fprintf(o->output_file, "WAS      ;");
 		fprint_bgp_route(o->output_file, &sf1->routes[i]);
 	}
+	/* best routes from sf2 whose prefix is not in sf1 */
+	for (j = 0; o->bgpcmp_new && j < sf2->nr; j++) {
+		if (!is_best_bgp_route(&sf2->routes[j]))
+			continue;
+		first = prefix_hash_find(&ph, &sf2->routes[j].subnet);
+		if (seen[first])
+			continue;
+		fprintf(o->output_file, "NEW      ;");
+		fprint_bgp_route(o->output_file, &sf2->routes[j]);
+	}
+	st_free(seen, sf2->nr + 1);
+	free_prefix_hash(&ph);
 	return 1;
 }
 
-static int as_path_length(const char *s)
-{
-	int i = 0;
-	int num = 0;
-	int in_confed = 0;
-	int in_asset = 0;
-	char c;
+/* a route decorated with the sort keys that are costly to compute */
+struct bgp_sort_rec {
+	struct bgp_route *r;
+	int aspath_len;
+};
 
-	while (isspace(s[i]))
-		i++;
-	if (s[i] == '\0')
-		return 0;
-	for ( ; i < strlen(s); i++) {
-		c = s[i];
-		if (in_confed && (c == '{' || c == '}' || c == '(')) {
-			st_debug(BGPCMP, 2, "BAD AS_PATH '%s'\n", s);
-			return -1;
-		}
-		if (in_asset && (c == '(' || c == ')' || c == '{')) {
-			st_debug(BGPCMP, 2, "BAD AS_PATH '%s'\n", s);
-			return -1;
-		}
-		if (c == '(')
-			in_confed = 1;
-		else if (c == '{')
-			in_asset = 1;
-		else if (c == ')' && in_confed) {
-			in_confed = 0;
-			continue;
-		} else if (c == '}' && in_asset) {
-			in_asset = 0;
-			continue;
-		}
-		/* AS in AS_CONFED or AS_SET doesnt count int the AS_PATH length */
-		if (in_asset || in_confed)
-			continue;
-		if  (isdigit(s[i]) && (isspace(s[i + 1]) || s[i + 1] == '\0'))
-			num++;
-	}
-	if (in_asset || in_confed) {
-		st_debug(BGPCMP, 2, "BAD AS_PATH '%s'\n", s);
+/* bgpsortby keys; three-way compare, negative if 'a' must be placed first */
+static inline int bgp_prefix_cmp(const struct bgp_sort_rec *a, const struct bgp_sort_rec *b)
+{
+	if (subnet_is_before(&a->r->subnet, &b->r->subnet))
 		return -1;
-	}
-	return num;
+	return subnet_is_before(&b->r->subnet, &a->r->subnet);
 }
 
-static int __heap_subnet_is_superior(void *v1, void *v2)
+static inline int bgp_gw_cmp(const struct bgp_sort_rec *a, const struct bgp_sort_rec *b)
 {
-	struct subnet *s1 = &((struct bgp_route *)v1)->subnet;
-	struct subnet *s2 = &((struct bgp_route *)v2)->subnet;
+	const struct ip_addr *gw1 = &a->r->gw;
+	const struct ip_addr *gw2 = &b->r->gw;
 
-	return subnet_is_superior(s1, s2);
+	/* routes without a gateway (ip_ver 0) have the same gateway */
+	if (is_equal_ip(gw1, gw2) || (gw1->ip_ver == 0 && gw2->ip_ver == 0))
+		return 0;
+	return (addr_is_before(gw1, gw2) ? -1 : 1);
 }
 
-static int __heap_gw_is_superior(void *v1, void *v2)
+static inline int bgp_med_cmp(const struct bgp_sort_rec *a, const struct bgp_sort_rec *b)
 {
-	struct subnet *s1 = &((struct bgp_route *)v1)->subnet;
-	struct subnet *s2 = &((struct bgp_route *)v2)->subnet;
-	struct ip_addr *gw1 = &((struct bgp_route *)v1)->gw;
-	struct ip_addr *gw2 = &((struct bgp_route *)v2)->gw;
-
-	if (is_equal_ip(gw1, gw2))
-		return subnet_is_superior(s1, s2);
-	else
-		return addr_is_superior(gw1, gw2);
+	return (a->r->MED > b->r->MED) - (a->r->MED < b->r->MED);
 }
 
-static int __heap_med_is_superior(void *v1, void *v2)
+static inline int bgp_mask_cmp(const struct bgp_sort_rec *a, const struct bgp_sort_rec *b)
 {
-	struct subnet *s1 = &((struct bgp_route *)v1)->subnet;
-	struct subnet *s2 = &((struct bgp_route *)v2)->subnet;
-	int MED1 = ((struct bgp_route *)v1)->MED;
-	int MED2 = ((struct bgp_route *)v2)->MED;
-
-	if (MED1 == MED2)
-		return subnet_is_superior(s1, s2);
-	else
-		return (MED1 < MED2);
+	return (a->r->subnet.mask > b->r->subnet.mask) - (a->r->subnet.mask < b->r->subnet.mask);
 }
 
-static int __heap_mask_is_superior(void *v1, void *v2)
+/* higher LOCAL_PREF first */
+static inline int bgp_localpref_cmp(const struct bgp_sort_rec *a, const struct bgp_sort_rec *b)
 {
-	struct subnet *s1 = &((struct bgp_route *)v1)->subnet;
-	struct subnet *s2 = &((struct bgp_route *)v2)->subnet;
-
-	if (s1->mask == s2->mask)
-		return subnet_is_superior(s1, s2);
-	else
-		return (s1->mask < s2->mask);
+	return (a->r->LOCAL_PREF < b->r->LOCAL_PREF) - (a->r->LOCAL_PREF > b->r->LOCAL_PREF);
 }
 
-static int __heap_localpref_is_superior(void *v1, void *v2)
+/* shorter AS_PATH first, then char by char; lengths are computed once per AS_PATH */
+static inline int bgp_aspath_cmp(const struct bgp_sort_rec *a, const struct bgp_sort_rec *b)
 {
-	struct subnet *s1 = &((struct bgp_route *)v1)->subnet;
-	struct subnet *s2 = &((struct bgp_route *)v2)->subnet;
-	int LOCAL_PREF1 = ((struct bgp_route *)v1)->LOCAL_PREF;
-	int LOCAL_PREF2 = ((struct bgp_route *)v2)->LOCAL_PREF;
-
-	if (LOCAL_PREF1 == LOCAL_PREF2)
-		return subnet_is_superior(s1, s2);
-	else
-		return (LOCAL_PREF1 > LOCAL_PREF2);
+	if (a->aspath_len != b->aspath_len)
+		return (a->aspath_len < b->aspath_len ? -1 : 1);
+	if (a->r->aspath == b->r->aspath)
+		return 0;
+	return strcmp(aspath_str(a->r->aspath), aspath_str(b->r->aspath));
 }
 
-static int __heap_aspath_is_superior(void *v1, void *v2)
+/* sort on one key; routes with the same key are sorted by prefix */
+#define BGP_SORT_DEFINE(key)							\
+static inline int bgp_##key##_is_before(struct bgp_sort_rec a,			\
+		struct bgp_sort_rec b)						\
+{										\
+	int res = bgp_##key##_cmp(&a, &b);					\
+										\
+	if (res)								\
+		return res < 0;							\
+	return subnet_is_before(&a.r->subnet, &b.r->subnet);			\
+}										\
+ST_SORT_DEFINE(sort_bgp_by_##key, struct bgp_sort_rec, bgp_##key##_is_before)
+
+BGP_SORT_DEFINE(gw)
+BGP_SORT_DEFINE(med)
+BGP_SORT_DEFINE(mask)
+BGP_SORT_DEFINE(localpref)
+BGP_SORT_DEFINE(aspath)
+
+#define BGP_SORT_MAX_KEYS 8
+
+/* sort on several keys, in order; then by prefix */
+struct bgp_sort_keys {
+	int nr;
+	int (*cmp[BGP_SORT_MAX_KEYS])(const struct bgp_sort_rec *a,
+			const struct bgp_sort_rec *b);
+};
+
+static int bgp_keys_less(const void *v1, const void *v2, void *arg)
 {
-	char *s1 = ((struct bgp_route *)v1)->AS_PATH;
-	char *s2 = ((struct bgp_route *)v2)->AS_PATH;
-	int l1, l2;
-
-	/* if AS_PATH length is the same
-	 * we compare char by char the strings
-	 * if AS_PATh is the same, we sort by prefix
-	 */
-	l1 = as_path_length(s1);
-	l2 = as_path_length(s2);
-	if (l1 == l2) {
-		if (!strcmp(s1, s2)) {
-			struct subnet *sub1 = &((struct bgp_route *)v1)->subnet;
-			struct subnet *sub2 = &((struct bgp_route *)v2)->subnet;
-
-			return subnet_is_superior(sub1, sub2);
-		}
-		return strcmp(s1, s2);
+	const struct bgp_sort_keys *k = arg;
+	const struct bgp_sort_rec *a = v1;
+	const struct bgp_sort_rec *b = v2;
+	int i, res;
+
+	for (i = 0; i < k->nr; i++) {
+		res = k->cmp[i](a, b);
+		if (res)
+			return res < 0;
 	}
-	return (l1 < l2);
+	return subnet_is_before(&a->r->subnet, &b->r->subnet);
 }
 
-
-static int __bgp_sort_by(struct bgp_file *sf, int cmpfunc(void *v1, void *v2))
+/* stable radix sort by prefix, IPv4 first */
+static int __bgp_sort_by_prefix(struct bgp_file *sf)
 {
-	unsigned long i;
-	TAS tas;
-	struct bgp_route *new_r, *r;
+	unsigned long i, *order;
+	struct bgp_route *new_r;
 	int res;
 
-	if (sf->nr == 0)
-		return 0;
-	res = alloc_tas(&tas, sf->nr, cmpfunc);
-	if (res < 0)
+	order = st_malloc(sf->nr * sizeof(unsigned long), "sort order");
+	if (order == NULL)
+		return -1;
+	res = radix_prefix_order(sf->routes, sf->nr, sizeof(struct bgp_route),
+			offsetof(struct bgp_route, subnet), order);
+	/* already sorted, nothing to move */
+	if (res <= 0) {
+		st_free(order, sf->nr * sizeof(unsigned long));
 		return res;
-
+	}
 	new_r = st_malloc(sf->max_nr * sizeof(struct bgp_route), "new bgp_route");
 	if (new_r == NULL) {
-		free_tas(&tas);
+		st_free(order, sf->nr * sizeof(unsigned long));
 		return -1;
 	}
-	/* basic heapsort */
-	for (i = 0 ; i < sf->nr; i++)
-		addTAS(&tas, &(sf->routes[i]));
-	for (i = 0 ; i < sf->nr; i++) {
-		r = popTAS(&tas);
-		copy_bgproute(&new_r[i], r);
-	}
-	free_tas(&tas);
+	for (i = 0; i < sf->nr; i++)
+		copy_bgproute(&new_r[i], &sf->routes[order[i]]);
+	st_free(order, sf->nr * sizeof(unsigned long));
 	st_free(sf->routes, sf->max_nr * sizeof(struct bgp_route));
 	sf->routes = new_r;
 	return 0;
@@ -281,19 +284,70 @@ static int __bgp_sort_by(struct bgp_file *sf, int cmpfunc(void *v1, void *v2))
 
 struct bgpsort {
 	char *name;
-	int (*cmpfunc)(void *v1, void *v2);
+	/* sorts on this key only; NULL means the prefix radix sort */
+	int (*sort)(struct bgp_sort_rec *recs, unsigned long n);
+	int (*cmp)(const struct bgp_sort_rec *a, const struct bgp_sort_rec *b);
+	int need_aspath_len;
 };
 
 static const struct bgpsort bgpsort[] = {
-	{ "prefix",	&__heap_subnet_is_superior },
-	{ "gw",		&__heap_gw_is_superior },
-	{ "med",	&__heap_med_is_superior },
-	{ "mask",	&__heap_mask_is_superior },
-	{ "localpref",	&__heap_localpref_is_superior },
-	{ "aspath",	&__heap_aspath_is_superior },
-	{NULL,		NULL}
+	{ "prefix",	NULL,			&bgp_prefix_cmp,	0 },
+	{ "gw",		&sort_bgp_by_gw,	&bgp_gw_cmp,		0 },
+	{ "med",	&sort_bgp_by_med,	&bgp_med_cmp,		0 },
+	{ "mask",	&sort_bgp_by_mask,	&bgp_mask_cmp,		0 },
+	{ "localpref",	&sort_bgp_by_localpref,	&bgp_localpref_cmp,	0 },
+	{ "aspath",	&sort_bgp_by_aspath,	&bgp_aspath_cmp,	1 },
+	{NULL,		NULL,			NULL,			0 }
 };
 
+/* sort a BGP file 'sf' on 'nr' keys
+ * routes are decorated with their costly keys once, sorted, then copied
+ * in order
+ */
+static int __bgp_sort_by(struct bgp_file *sf, const struct bgpsort **keys, int nr)
+{
+	unsigned long i;
+	struct bgp_route *new_r;
+	struct bgp_sort_rec *recs;
+	struct bgp_sort_keys k;
+	int res, need_aspath_len = 0;
+
+	if (sf->nr == 0)
+		return 0;
+	if (nr == 1 && keys[0]->sort == NULL)
+		return __bgp_sort_by_prefix(sf);
+	for (k.nr = 0; k.nr < nr; k.nr++) {
+		k.cmp[k.nr] = keys[k.nr]->cmp;
+		need_aspath_len |= keys[k.nr]->need_aspath_len;
+	}
+	recs = st_malloc(sf->nr * sizeof(struct bgp_sort_rec), "sort keys");
+	if (recs == NULL)
+		return -1;
+	for (i = 0 ; i < sf->nr; i++) {
+		recs[i].r = &sf->routes[i];
+		recs[i].aspath_len = (need_aspath_len ? aspath_len(sf->routes[i].aspath) : 0);
+	}
+	if (nr == 1)
+		res = keys[0]->sort(recs, sf->nr);
+	else
+		res = st_sort(recs, sf->nr, sizeof(struct bgp_sort_rec), &bgp_keys_less, &k);
+	if (res < 0) {
+		st_free(recs, sf->nr * sizeof(struct bgp_sort_rec));
+		return res;
+	}
+	new_r = st_malloc(sf->max_nr * sizeof(struct bgp_route), "new bgp_route");
+	if (new_r == NULL) {
+		st_free(recs, sf->nr * sizeof(struct bgp_sort_rec));
+		return -1;
+	}
+	for (i = 0 ; i < sf->nr; i++)
+		copy_bgproute(&new_r[i], recs[i].r);
+	st_free(recs, sf->nr * sizeof(struct bgp_sort_rec));
+	st_free(sf->routes, sf->max_nr * sizeof(struct bgp_route));
+	sf->routes = new_r;
+	return 0;
+}
+
 void bgp_available_cmpfunc(FILE *out)
 {
 	int i = 0;
@@ -304,24 +358,35 @@ void bgp_available_cmpfunc(FILE *out)
 		fprintf(out, " %s\n", bgpsort[i].name);
 		i++;
 	}
+	fprintf(out, "keys can be combined, like 'localpref,aspath,med'\n");
 }
 
 int bgp_sort_by(struct bgp_file *sf, const char *name)
 {
-	int i = 0, res;
+	const struct bgpsort *keys[BGP_SORT_MAX_KEYS];
+	const char *s = name, *comma;
+	int i, len, nr = 0, res;
 
+	/* name is a comma-separated list of keys */
 	while (1) {
+		comma = strchr(s, ',');
+		len = (comma ? comma - s : strlen(s));
+		if (len == 0 || nr == BGP_SORT_MAX_KEYS)
+			return -1664;
+		for (i = 0; bgpsort[i].name != NULL; i++)
+			if (!strncasecmp(s, bgpsort[i].name, len))
+				break;
 		if (bgpsort[i].name == NULL)
+			return -1664;
+		keys[nr++] = &bgpsort[i];
+		if (comma == NULL)
 			break;
-		if (!strncasecmp(name, bgpsort[i].name, strlen(name))) {
-			debug_timing_start(2);
-			res = __bgp_sort_by(sf, bgpsort[i].cmpfunc);
-			debug_timing_end(2);
-			return res;
-		}
-		i++;
+		s = comma + 1;
 	}
-	return -1664;
+	debug_timing_start(2);
+	res = __bgp_sort_by(sf, keys, nr);
+	debug_timing_end(2);
+	return res;
 }
 
 #define BLOCK_INT(__VAR) \
@@ -433,7 +498,7 @@ static int bgp_route_filter(const char *s, const char *value, char op, void *obj
 		 * that comparator uses pattern matching
 		 */
 		if (op == '~') {
-			res = st_sscanf(route->AS_PATH, value);
+			res = st_sscanf(aspath_str(route->aspath), value);
 			return (res < 0 ? 0 : 1);
 		}
 		res =  string2int(value, &err);
@@ -445,13 +510,13 @@ static int bgp_route_filter(const char *s, const char *value, char op, void *obj
 		}
 		switch (op) {
 		case '=':
-			return (as_path_length(route->AS_PATH) == res);
+			return (aspath_len(route->aspath) == res);
 		case '#':
-			return (as_path_length(route->AS_PATH) != res);
+			return (aspath_len(route->aspath) != res);
 		case '<':
-			return (as_path_length(route->AS_PATH) < res);
+			return (aspath_len(route->aspath) < res);
 		case '>':
-			return (as_path_length(route->AS_PATH) > res);
+			return (aspath_len(route->aspath) > res);
 		default:
 			debug(FILTER, 1, "Unsupported op '%c' for AS_PATH\n", op);
 			return -1;
@@ -3,6 +3,7 @@
 
 #include "st_options.h"
 #include "st_routes_csv.h"
+#include "st_aspath.h"
 
 #define SF_BGP_MAX_ROUTES_NUMBER (((unsigned long)0 - 1) / (2 * sizeof(struct bgp_route)))
 
@@ -11,7 +12,7 @@ struct bgp_route {
 	struct ip_addr gw;
 	int MED;
 	int LOCAL_PREF;
-	char AS_PATH[256];
+	unsigned int aspath; /* id in the AS_PATH pool */
 	int type; /* eBGP, iBGP, local, confed, aggregate */
 	int weight;
 	int best;
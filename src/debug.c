@@ -22,6 +22,9 @@ const struct debug debugs[] = {
 	{ "memory",	__D_MEMORY,	"trace memory allocations" },
 	{ "list",	__D_LIST,	"debug linked-list operations" },
 	{ "hash",	__D_HASHT,	"debug Hash Table" },
+	{ "trie",	__D_TRIE,	"debug prefix trie" },
+	{ "lookup",	__D_LOOKUP,	"debug route lookup tables" },
+	{ "sort",	__D_SORT,	"debug external sort" },
 	{ "debug",	__D_DEBUG,	"debug DEBUG, yes we can! :)" },
 	{ "parseipv6",	__D_PARSEIPV6,	"debug IPv6 parsing functions" },
 	{ "parseip",	__D_PARSEIP,	"debug IPv4 parsing functions" },
@@ -27,6 +27,9 @@
 #define __D_FILTER	51
 #define __D_LIST	55
 #define __D_HASHT	56
+#define __D_TRIE	57
+#define __D_LOOKUP	58
+#define __D_SORT	59
 #define __D_MAX		100
 
 #define debug(__EVENT, __DEBUG_LEVEL, __FMT...) \
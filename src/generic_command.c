@@ -14,6 +14,8 @@
 #include "debug.h"
 #include "utils.h"
 #include "st_memory.h"
+#include "st_strpool.h"
+#include "st_aspath.h"
 
 #define MAX_AMBIGUOUS 39
 
@@ -72,6 +74,9 @@ int generic_command_run(int argc, char **argv, const char *progname, void *opt)
 		debug_timing_start(1);
 		res = commands[found_i].run_cmd(argc, argv, opt);
 		debug_timing_end(1);
+		/* objects of the command are gone, so are the users of pooled strings */
+		st_strpool_free();
+		aspath_pool_free();
 		debug(MEMORY, 4, "Total amount of memory still allocated %lu; %s\n",
 				total_memory, argv[1]);
 		if (total_memory != 0) {
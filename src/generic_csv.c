@@ -344,7 +344,7 @@ int generic_load_csv(const char *filename, struct csv_file *cf,
 		fprintf(stderr, "coding error:  no strtok function provided\n");
 		return -2;
 	}
-	f = st_open(filename, 128000);
+	f = st_open_mmap(filename, 128000);
 	if (f == NULL) {
 		fprintf(stderr, "cannot open %s for reading\n", filename);
 		return CSV_CANNOT_OPEN_FILE;
@@ -16,9 +16,6 @@
 #include "debug.h"
 #include "st_memory.h"
 
-#define swap(a, b) \
-	do { typeof(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
-
 int alloc_tas(TAS *tas, unsigned long n, int (*compare)(void *v1, void *v2))
 {
 	if (n > HEAP_MAX_NR) {
@@ -48,25 +45,12 @@ void free_tas(TAS *tas)
 	tas->nr = tas->max_nr = 0;
 }
 
+/* the generic heap compares through tas->compare */
+TAS_DEFINE(generic_tas, tas->compare)
+
 void addTAS(TAS *tas, void *el)
 {
-	unsigned long n, father;
-    int (*func)(void *, void *) = tas->compare;
-	n = tas->nr++;
-	tas->tab[n] = el; /*insert element at the end */
-	father = n;
-
-	while (n) { /* move it up */
-		father--;
-		father >>= 1; /* father of current n */
-		/* if son is better than father then swap */
-		if (func(tas->tab[n], tas->tab[father])) {
-			swap(tas->tab[father], tas->tab[n]);
-			n = father; /* move current to father */
-			continue;
-		}
-		break;
-	}
+	generic_tas_add(tas, el);
 }
 
 int addTAS_may_fail(TAS *tas, void *el)
@@ -92,46 +76,7 @@ int addTAS_may_fail(TAS *tas, void *el)
 
 void *popTAS(TAS *tas)
 {
-	unsigned long n, i = 0, left_son, right_son;
-	void *res = tas->tab[0];
-    int (*func)(void *, void *) = tas->compare;
-
-	if (tas->nr == 0)
-		return NULL;
-	tas->nr--;
-	n = tas->nr;
-	/* first replace head with last element, then lets get it down */
-	tas->tab[0] = tas->tab[n];
-
-	while (1) { /* move down */
-		left_son = i << 1;
-		left_son++; /* left son of i */
-		if (left_son > n) /* no more sons */
-			break;
-		if (left_son == n) { /* no right son */
-			/* if father is better, stop */
-			if (func(tas->tab[i], tas->tab[left_son]))
-				break;
-			swap(tas->tab[left_son], tas->tab[i]); /* swap father & left son */
-			break;
-		}
-		/* heap[2i+1] = left son, heap[2i+2] = right son */
-        right_son = left_son + 1;
-		if (func(tas->tab[left_son], tas->tab[right_son])) {
-			/* if father is better, stop */
-			if (func(tas->tab[i], tas->tab[left_son]))
-				break;
-			swap(tas->tab[left_son], tas->tab[i]); /* swap father & left son */
-			i = left_son;
-		} else {
-			/* if father is better, stop */
-			if (func(tas->tab[i], tas->tab[right_son]))
-				break;
-			swap(tas->tab[right_son], tas->tab[i]); /* swap father & right son */
-			i = right_son;
-		}
-	}
-	return res;
+	return generic_tas_pop(tas);
 }
 
 void print_tas(TAS tas)
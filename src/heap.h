@@ -56,5 +56,60 @@ int addTAS_may_fail(TAS *tas, void *elem) __attribute__ ((warn_unused_result));
 void *popTAS(TAS *tas);
 void print_tas(TAS tas);
 
+/* TAS_DEFINE: define 'static void name##_add(TAS *tas, void *elem)' and
+ * 'static void *name##_pop(TAS *tas)', same as addTAS & popTAS but
+ * 'is_superior(v1, v2)' is expanded in the loops instead of being called
+ * through tas->compare, so it can be inlined
+ * is_superior(v1, v2) returns non-zero if v1 is better than v2
+ */
+#define TAS_DEFINE(name, is_superior)						\
+static inline void name##_add(TAS *tas, void *el)				\
+{										\
+	unsigned long n, father;						\
+	void *__tmp;								\
+										\
+	n = tas->nr++;								\
+	tas->tab[n] = el; /* insert element at the end */			\
+	while (n) { /* move it up */						\
+		father = (n - 1) >> 1;						\
+		/* if son is better than father then swap */			\
+		if (!is_superior(tas->tab[n], tas->tab[father]))		\
+			break;							\
+		__tmp = tas->tab[father];					\
+		tas->tab[father] = tas->tab[n];					\
+		tas->tab[n] = __tmp;						\
+		n = father;							\
+	}									\
+}										\
+										\
+static inline void *name##_pop(TAS *tas)					\
+{										\
+	unsigned long n, i = 0, son;						\
+	void *res, *__tmp;							\
+										\
+	if (tas->nr == 0)							\
+		return NULL;							\
+	res = tas->tab[0];							\
+	n = --tas->nr;								\
+	/* replace head with last element, then get it down */			\
+	tas->tab[0] = tas->tab[n];						\
+	while (1) {								\
+		son = 2 * i + 1;						\
+		if (son >= n) /* no more sons */				\
+			break;							\
+		/* take the best son */					\
+		if (son + 1 < n && !is_superior(tas->tab[son], tas->tab[son + 1]))\
+			son++;							\
+		/* if father is better, stop */					\
+		if (is_superior(tas->tab[i], tas->tab[son]))			\
+			break;							\
+		__tmp = tas->tab[son];						\
+		tas->tab[son] = tas->tab[i];					\
+		tas->tab[i] = __tmp;						\
+		i = son;							\
+	}									\
+	return res;								\
+}
+
 #else
 #endif
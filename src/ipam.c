@@ -20,9 +20,12 @@
 #include "generic_expr.h"
 #include "st_routes.h"
 #include "ipam.h"
+#include "st_trie.h"
+#include "st_mtrie.h"
 #include "string2ip.h"
 
 #define IPAM_STATIC_REGISTERED_FIELDS 2
+#define IPAM_ARENA_CHUNK_SIZE (256 * 1024)
 
 int alloc_ipam_file(struct ipam_file *sf, unsigned long n, int ea_nr)
 {
@@ -37,6 +40,7 @@ int alloc_ipam_file(struct ipam_file *sf, unsigned long n, int ea_nr)
 	}
 	sf->nr     = 0;
 	sf->max_nr = n;
+	st_arena_init(&sf->arena, IPAM_ARENA_CHUNK_SIZE);
 	sf->ea_nr  = ea_nr;
 	sf->ea     = st_malloc(ea_nr * sizeof(char *), "ipam_ea");
 	if (sf->ea == NULL) {
@@ -54,7 +58,7 @@ static int alloc_ipam_ea(struct ipam_file *sf, unsigned long i)
 	struct st_ea *ea;
 	int j;
 
-	ea = alloc_ea_array(sf->ea_nr);
+	ea = arena_alloc_ea_array(&sf->arena, sf->ea_nr);
 	if (ea == NULL) {
 		sf->lines[i].ea    = NULL;
 		sf->lines[i].ea_nr = 0;
@@ -67,9 +71,10 @@ static int alloc_ipam_ea(struct ipam_file *sf, unsigned long i)
 	return 0;
 }
 
+/* the EA array itself belongs to the file arena */
 static void free_ipam_ea(struct ipam_line *ipam)
 {
-	free_ea_array(ipam->ea, ipam->ea_nr);
+	free_ea_values(ipam->ea, ipam->ea_nr);
 	ipam->ea    = NULL;
 	ipam->ea_nr = 0;
 }
@@ -78,8 +83,11 @@ void free_ipam_file(struct ipam_file *sf)
 {
 	unsigned long i;
 
+	if (st_skip_teardown)
+		return;
 	for (i = 0; i < sf->nr; i++)
 		free_ipam_ea(&sf->lines[i]);
+	st_arena_free(&sf->arena);
 	for (i = 0; i < sf->ea_nr; i++)
 		st_free_string(sf->ea[i]);
 	st_free(sf->ea, sizeof(char *) * sf->ea_nr);
@@ -127,8 +135,8 @@ static int ipam_ea_handle(char *s, void *data, struct csv_state *state)
 	*/
 	ea_nr = state->csv_id - IPAM_STATIC_REGISTERED_FIELDS;
 	debug(IPAM, 6, "Found ea#%d %s = %s\n",  ea_nr, sf->ea[ea_nr], s);
-	/* we dont care if memory failed on strdup; we continue */
-	ea_strdup(&sf->lines[sf->nr].ea[ea_nr], s);
+	/* we dont care if memory failed; we continue */
+	ea_intern(&sf->lines[sf->nr].ea[ea_nr], s);
 	return CSV_VALID_FIELD;
 }
 
@@ -385,11 +393,16 @@ int ipam_file_filter(struct ipam_file *sf, char *expr)
 
 int populate_sf_from_ipam(struct subnet_file *sf, struct ipam_file *ipam)
 {
-	unsigned long i, j, found_j;
+	unsigned long i, j;
+	long found_j;
 	int k, res, sf_ea_nr;
-	int found_mask, mask;
 	int has_comment = 0, comment_index = -1;
 	char **new_ea;
+	struct st_trie trie;
+	struct st_trie_match m;
+	struct st_mtrie mtrie;
+	struct st_mtrie_prefix *p;
+	const struct st_mtrie_result *r;
 
 	/*
 	 * subnet file sf may already have Extended Attributes
@@ -419,34 +432,68 @@ int populate_sf_from_ipam(struct subnet_file *sf, struct ipam_file *ipam)
 		}
 	}
 
+	/* index IPAM prefixes once; IPv4 in a binary trie, IPv6 in a multibit trie */
+	res = alloc_st_trie(&trie, ipam->nr);
+	if (res < 0)
+		return res;
+	for (j = 0; j < ipam->nr; j++)
+		if (ipam->lines[j].subnet.ip_ver == IPV4_A)
+			st_trie_insert(&trie, &ipam->lines[j].subnet, j);
+	p = st_malloc((ipam->nr + 1) * sizeof(struct st_mtrie_prefix), "mtrie prefixes");
+	if (p == NULL) {
+		free_st_trie(&trie);
+		return -1;
+	}
+	for (j = 0; j < ipam->nr; j++) {
+		copy_subnet(&p[j].prefix, &ipam->lines[j].subnet);
+		p[j].index = j;
+	}
+	res = st_mtrie_build(&mtrie, p, ipam->nr);
+	st_free(p, (ipam->nr + 1) * sizeof(struct st_mtrie_prefix));
+	if (res < 0) {
+		free_st_trie(&trie);
+		return res;
+	}
+
 	for (i = 0; i < sf->nr; i++) {
 		/* allocating new EA and setting value to NULL */
 		res = realloc_route_ea(&sf->routes[i],
 				sf->routes[i].ea_nr + ipam->ea_nr - has_comment);
 
-		if (res < 0)
+		if (res < 0) {
+			free_st_trie(&trie);
+			free_st_mtrie(&mtrie);
 			return res;
-		found_mask = -1;
-		found_j    = 0;
-		for (j = 0; j < ipam->nr; j++) {
-			res = subnet_compare(&sf->routes[i].subnet, &ipam->lines[j].subnet);
-			if (res == EQUALS) {
-				found_mask = ipam->lines[j].subnet.mask;
-				st_debug(IPAM, 5, "found exact match %P\n", ipam->lines[j].subnet);
-				found_j = j;
-				break; /* we break on exact match */
-			} else if (res == INCLUDED) {
+		}
+		/* exact match first (first one in IPAM order),
+		 * then longest included match (last one in IPAM order)
+		 */
+		found_j = -1;
+		if (sf->routes[i].subnet.ip_ver == IPV6_A) {
+			r = st_mtrie_lookup(&mtrie, &sf->routes[i].subnet);
+			if (r && r->mask == sf->routes[i].subnet.mask) {
+				found_j = r->first;
+				st_debug(IPAM, 5, "found exact match %P\n",
+						ipam->lines[found_j].subnet);
+			} else if (r) {
+				found_j = r->last;
+				st_debug(IPAM, 5, "found included match %P\n",
+						ipam->lines[found_j].subnet);
+			}
+		} else {
+			st_trie_lookup(&trie, &sf->routes[i].subnet, &m);
+			if (m.equals) {
+				found_j = m.equals->first;
+				st_debug(IPAM, 5, "found exact match %P\n",
+						ipam->lines[found_j].subnet);
+			} else if (m.included) {
+				found_j = m.included->last;
 				st_debug(IPAM, 5, "found included match %P\n",
-						ipam->lines[j].subnet);
-				mask = ipam->lines[j].subnet.mask;
-				if (mask < found_mask)
-					continue; /* we have a better mask */
-				found_mask = mask;
-				found_j    = j;
+						ipam->lines[found_j].subnet);
 			}
 		}
 		k = sf_ea_nr;
-		if (found_mask == -1) {
+		if (found_j == -1) {
 			for (j = 0; j < ipam->ea_nr; j++) {
 				/* we didnt find a match in the IPAM for this subnet
 				 * set route EA name, except  for comment that we dont overwrite
@@ -466,17 +513,19 @@ int populate_sf_from_ipam(struct subnet_file *sf, struct ipam_file *ipam)
 				if (j == comment_index) {
 					sf->routes[i].ea[0].name  = ipam->ea[j];
 					free_ea(&sf->routes[i].ea[0]);
-					ea_strdup(&sf->routes[i].ea[0],
-							ipam->lines[found_j].ea[j].value);
+					ea_clone(&sf->routes[i].ea[0],
+							&ipam->lines[found_j].ea[j]);
 				} else {
 					sf->routes[i].ea[k].name  = ipam->ea[j];
 					free_ea(&sf->routes[i].ea[k]);
-					ea_strdup(&sf->routes[i].ea[k],
-							ipam->lines[found_j].ea[j].value);
+					ea_clone(&sf->routes[i].ea[k],
+							&ipam->lines[found_j].ea[j]);
 					k++;
 				}
 			}
 		}
 	}
+	free_st_trie(&trie);
+	free_st_mtrie(&mtrie);
 	return 1;
 }
@@ -21,6 +21,7 @@ struct ipam_file {
 	unsigned long max_nr; /* the number of routes that has been malloc'ed */
 	int ea_nr; /* number of Extensible Attributes */
 	char **ea; /* Extensible attributes names */
+	struct st_arena arena; /* EA arrays of the lines */
 };
 
 int alloc_ipam_file(struct ipam_file *sf, unsigned long n, int ea_nr);
@@ -45,7 +45,7 @@ const struct subnet ipv4_mcast_glop	= S_IPV4_CONST(233, 0, 8);
 const struct subnet ipv4_mcast_site	= S_IPV4_CONST(239, 0, 8);
 
 #define S_IPV6_CONST(DIGIT1, DIGIT2, __MASK) \
-{ .ip_ver = 6, block(.ip6, 0) = DIGIT1, block(.ip6, 1) = DIGIT2, .mask = __MASK }
+{ .ip_ver = 6, .ip6 = IPV6_CONST(DIGIT1, DIGIT2, 0, 0, 0, 0, 0, 0), .mask = __MASK }
 
 const struct subnet ipv6_default	= S_IPV6_CONST(0x0000, 0, 0);
 const struct subnet ipv6_unspecified	= S_IPV6_CONST(0x0000, 0, 128);
@@ -58,16 +58,17 @@ const struct subnet ipv6_6to4		= S_IPV6_CONST(0x2002, 0, 16);
 const struct subnet ipv6_rfc4380_teredo = S_IPV6_CONST(0x2001, 0, 32);
 const struct subnet ipv6_rfc3849_doc	= S_IPV6_CONST(0x2001, 0x0DB8, 32);
 const struct subnet ipv6_rfc6052_pat	= S_IPV6_CONST(0x0064, 0xff9b, 96);
-const struct subnet ipv6_isatap_priv_ll	= {.ip_ver = 6, block(.ip6, 0) = 0xFE80,
-	block(.ip6, 5) = 0x5EFE, .mask = 96};
-const struct subnet ipv6_isatap_pub_ll	= {.ip_ver = 6, block(.ip6, 0) = 0xFE80,
-	block(.ip6, 4) = 0x0200, block(.ip6, 5) = 0x5EFE, .mask = 96};
-const struct subnet ipv6_mapped_ipv4	= {.ip_ver = 6, block(.ip6, 5) = 0xFFFF,
-	.mask = 96}; /* ::FFFF:/96 */
-const struct subnet ipv6_mcast_sn	= {.ip_ver = 6, block(.ip6, 0) = 0xFF02,
-	block(.ip6, 5) = 0x1, block(.ip6, 6) = 0xFF00, .mask = 104};
+const struct subnet ipv6_isatap_priv_ll	= {.ip_ver = 6,
+	.ip6 = IPV6_CONST(0xFE80, 0, 0, 0, 0, 0x5EFE, 0, 0), .mask = 96};
+const struct subnet ipv6_isatap_pub_ll	= {.ip_ver = 6,
+	.ip6 = IPV6_CONST(0xFE80, 0, 0, 0, 0x0200, 0x5EFE, 0, 0), .mask = 96};
+const struct subnet ipv6_mapped_ipv4	= {.ip_ver = 6,
+	.ip6 = IPV6_CONST(0, 0, 0, 0, 0, 0xFFFF, 0, 0), .mask = 96}; /* ::FFFF:/96 */
+const struct subnet ipv6_mcast_sn	= {.ip_ver = 6,
+	.ip6 = IPV6_CONST(0xFF02, 0, 0, 0, 0, 0x1, 0xFF00, 0), .mask = 104};
 const struct subnet ipv6_compat_ipv4	= {.ip_ver = 6, .mask = 96}; /* ::/96 */
-const struct subnet ipv6_loopback	= {.ip_ver = 6, block(.ip6, 7) = 1, .mask = 128};
+const struct subnet ipv6_loopback	= {.ip_ver = 6,
+	.ip6 = IPV6_CONST(0, 0, 0, 0, 0, 0, 0, 1), .mask = 128};
 
 static void decode_6to4(FILE *out, const struct subnet *s)
 {
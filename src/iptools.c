@@ -23,17 +23,6 @@ sprint_hex(short)
 sprint_unsigned(int)
 
 
-int is_equal_ip(struct ip_addr *ip1, struct ip_addr *ip2)
-{
-	if (ip1->ip_ver != ip2->ip_ver)
-		return 0;
-	if (ip1->ip_ver == IPV4_A && ip1->ip == ip2->ip)
-		return 1;
-	if (ip1->ip_ver == IPV6_A && is_equal_ipv6(ip1->ip6, ip2->ip6))
-		return 1;
-	return 0;
-}
-
 int ipv6_is_link_local(ipv6 a)
 {
 	unsigned short x = block(a, 0);
@@ -63,28 +52,16 @@ int ipv6_is_multicast(ipv6 a)
 
 static inline int subnet_compare_ipv6(ipv6 ip1, int mask1, ipv6 ip2, int mask2)
 {
-	if (mask1 > mask2) {
-		shift_ipv6_right(ip1, (128 - mask2));
-		shift_ipv6_right(ip2, (128 - mask2));
-		if (is_equal_ipv6(ip1, ip2))
-			return INCLUDED;
-		else
-			return NOMATCH;
-	} else if (mask1 < mask2) {
-		shift_ipv6_right(ip1, (128 - mask1));
-		shift_ipv6_right(ip2, (128 - mask1));
-		if (is_equal_ipv6(ip1, ip2))
-			return INCLUDES;
-		else
-			return NOMATCH;
-	} else {
-		shift_ipv6_right(ip1, (128 - mask1));
-		shift_ipv6_right(ip2, (128 - mask1));
-		if (is_equal_ipv6(ip1, ip2))
-			return EQUALS;
-		else
-			return NOMATCH;
-	}
+	int mask = (mask1 < mask2 ? mask1 : mask2);
+
+	/* compare the common part, then the masks tell the relation */
+	shift_ipv6_right(ip1, 128 - mask);
+	shift_ipv6_right(ip2, 128 - mask);
+	if (!is_equal_ipv6(ip1, ip2))
+		return NOMATCH;
+	if (mask1 > mask2)
+		return INCLUDED;
+	return (mask1 < mask2 ? INCLUDES : EQUALS);
 }
 
 static inline int subnet_compare_ipv4(ipv4 prefix1, int mask1, ipv4 prefix2, int mask2)
@@ -392,7 +369,7 @@ int addr_is_superior(const struct ip_addr *ip1, const struct ip_addr *ip2)
 
 int subnet_is_superior(const struct subnet *s1, const struct subnet *s2)
 {
-	int i, res;
+	int res;
 
 	if (s1->ip_ver != s2->ip_ver) {
 		debug(ADDRCOMP, 3, "cannot compare, different IP version\n");
@@ -419,17 +396,8 @@ int subnet_is_superior(const struct subnet *s1, const struct subnet *s2)
 				res = 1;
 			else
 				res = 0;
-		} else {
-			for (i = 0; i < 8; i++) {
-				if (block(s1->ip6, i) < block(s2->ip6, i)) {
-					res = 1;
-					break;
-				} else if (block(s1->ip6, i) > block(s2->ip6, i)) {
-					res = 0;
-					break;
-				}
-			}
-		}
+		} else
+			res = ipv6_is_superior(s1->ip6, s2->ip6);
 		st_debug(ADDRCOMP, 7, "%P %c %P\n", *s1, (res ? '>' : '<'), *s2);
 		return res;
 	}
@@ -638,13 +606,8 @@ int can_decrease_mask(const struct subnet *s)
 	if (s->ip_ver == IPV6_A) {
 		memcpy(&b, &s->ip6, sizeof(ipv6));
 		shift_ipv6_right(b, 128 - s->mask);
-		while (i < s->mask) {
-			if (block(b, 7) & 1)
-				break;
-			i++;
-			shift_ipv6_right(b, 1);
-		}
-		return i;
+		i = ipv6_trailing_zeros(b);
+		return (i < s->mask ? i : s->mask);
 	}
 	return 0;
 }
@@ -757,3 +720,77 @@ struct subnet *subnet_remove(const struct subnet *s1, const struct subnet *s2, i
 	*n = i;
 	return news;
 }
+
+#ifdef BENCH_IPV6
+#include <time.h>
+
+/* microbenchmark of the IPv6 math; build it with and without
+ * -DIPV6_USHORT_ARRAY to compare the two representations
+ */
+#define BENCH_NR	(1 << 18)
+#define BENCH_LOOP	40
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define BENCH(__name, __stmt) do { \
+	double __t = bench_now(); \
+	\
+	for (l = 0; l < BENCH_LOOP; l++) \
+		for (i = 0; i < BENCH_NR; i++) { \
+			__stmt; \
+		} \
+	printf("%-20s: %6.2f ns/op\n", __name, \
+			(bench_now() - __t) / ((double)BENCH_LOOP * BENCH_NR)); \
+} while (0)
+
+int main(int argc, char **argv)
+{
+	struct subnet *s, r;
+	unsigned long sum = 0;
+	int i, j, l, b;
+
+	s = malloc(BENCH_NR * sizeof(struct subnet));
+	if (s == NULL)
+		return 1;
+	srand(1664);
+	/* pairs (2i, 2i + 1) are either siblings, that aggregate, or a subnet
+	 * and one of its subnets
+	 */
+	for (i = 0; i < BENCH_NR; i += 2) {
+		memset(&s[i], 0, sizeof(struct subnet));
+		s[i].ip_ver = IPV6_A;
+		for (j = 0; j < 8; j++)
+			set_block(s[i].ip6, j, rand());
+		s[i].mask = 16 + rand() % 112;
+		first_ip(&s[i]);
+		copy_subnet(&s[i + 1], &s[i]);
+		b = 128 - s[i].mask;
+		if (i & 2)
+			set_block(s[i + 1].ip6, 7 - b / 16,
+					block(s[i + 1].ip6, 7 - b / 16) ^ (1 << (b % 16)));
+		else
+			s[i + 1].mask += 1 + rand() % (128 - s[i].mask);
+	}
+	printf("%s backend, %d prefixes\n",
+#ifdef IPV6_USHORT_ARRAY
+			"n16",
+#else
+			"word",
+#endif
+			BENCH_NR);
+	BENCH("subnet_compare", sum += subnet_compare(&s[i], &s[i ^ 1]));
+	BENCH("subnet_is_superior", sum += subnet_is_superior(&s[i], &s[i ^ 1]));
+	BENCH("aggregate_subnet", sum += aggregate_subnet(&s[i], &s[i ^ 1], &r));
+	BENCH("next_subnet", copy_subnet(&r, &s[i]); next_subnet(&r); sum += block(r.ip6, 7));
+	BENCH("can_decrease_mask", sum += can_decrease_mask(&s[i]));
+	printf("checksum %lu\n", sum);
+	free(s);
+	return 0;
+}
+#endif
@@ -18,6 +18,7 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <string.h>
+#include "bitmap.h"
 
 typedef unsigned int ipv4;
 
@@ -34,16 +35,24 @@ struct ipv6_a {
 typedef struct ipv6_a ipv6;
 
 /* due to endianness issues, ipv6 address should not be manipulated directly
- * works today, but will break the day we use something like a u128 to do the math...
  * if you change the representation of IPv6, you must redefine these macro,
  * (and only these) all code in .c file is safe
+ *
+ * two representations, selected at build time:
+ * - default: n64[0] holds the 64 high bits, n64[1] the 64 low bits, as native
+ *   integers; math is done on words (unsigned __int128 if the compiler has it)
+ * - IPV6_USHORT_ARRAY (-DIPV6_USHORT_ARRAY): n16[0] is the high block; math is
+ *   done block by block by bitmap.c
+ * both must be built with the same flag, all objects share struct ipv6_a
  */
-#define IPV6_USHORT_ARRAY
 #ifdef IPV6_USHORT_ARRAY
 
 #define block(__ip6, __n) __ip6.n16[__n]
 #define set_block(__ip6, __n, __value) (__ip6.n16[__n] = __value)
 #define block_OR(__ip6, __n, __value) (__ip6.n16[__n] |= __value)
+/* static initializer of an ipv6 from its 8 blocks */
+#define IPV6_CONST(__b0, __b1, __b2, __b3, __b4, __b5, __b6, __b7) \
+	{ .n16 = { __b0, __b1, __b2, __b3, __b4, __b5, __b6, __b7 } }
 
 #define shift_ipv6_left(__z, __len) shift_left(__z.n16, 8, __len)
 #define shift_ipv6_right(__z, __len) shift_right(__z.n16, 8, __len)
@@ -51,19 +60,130 @@ typedef struct ipv6_a ipv6;
 #define decrease_ipv6(__z) decrease_bitmap(__z.n16, 8)
 #define ipv6_is_superior(__ip1, __ip2) bitmap_is_inferior(__ip1.n16, __ip2.n16, 8)
 
+static inline int ipv6_trailing_zeros(ipv6 z)
+{
+	int i, j;
+
+	for (i = 7; i >= 0; i--)
+		if (z.n16[i])
+			break;
+	if (i < 0)
+		return 128;
+	for (j = 0; !(z.n16[i] & (1 << j)); j++)
+		;
+	return (7 - i) * 16 + j;
+}
+
+#else
+
+#define block(__ip6, __n) \
+	((unsigned short)((__ip6).n64[(__n) >> 2] >> ((3 - ((__n) & 3)) * 16)))
+#define set_block(__ip6, __n, __value) ipv6_set_block(&(__ip6), __n, __value)
+#define block_OR(__ip6, __n, __value) \
+	((__ip6).n64[(__n) >> 2] |= (uint64_t)(unsigned short)(__value) << ((3 - ((__n) & 3)) * 16))
+#define __IPV6_WORD(__b0, __b1, __b2, __b3) \
+	(((uint64_t)(__b0) << 48) | ((uint64_t)(__b1) << 32) | ((uint64_t)(__b2) << 16) | (__b3))
+#define IPV6_CONST(__b0, __b1, __b2, __b3, __b4, __b5, __b6, __b7) \
+	{ .n64 = { __IPV6_WORD(__b0, __b1, __b2, __b3), __IPV6_WORD(__b4, __b5, __b6, __b7) } }
+
+#define shift_ipv6_left(__z, __len) ipv6_shift_left(&(__z), __len)
+#define shift_ipv6_right(__z, __len) ipv6_shift_right(&(__z), __len)
+#define increase_ipv6(__z) ipv6_add(&(__z), 1)
+#define decrease_ipv6(__z) ipv6_add(&(__z), -1)
+#define ipv6_is_superior(__ip1, __ip2) ipv6_is_before(&(__ip1), &(__ip2))
+
+static inline void ipv6_set_block(ipv6 *z, int n, unsigned short value)
+{
+	int shift = (3 - (n & 3)) * 16;
+
+	z->n64[n >> 2] &= ~((uint64_t)0xFFFF << shift);
+	z->n64[n >> 2] |= (uint64_t)value << shift;
+}
+
+#ifdef __SIZEOF_INT128__
+static inline unsigned __int128 ipv6_to_u128(const ipv6 *z)
+{
+	return ((unsigned __int128)z->n64[0] << 64) | z->n64[1];
+}
+
+static inline void u128_to_ipv6(ipv6 *z, unsigned __int128 v)
+{
+	z->n64[0] = (uint64_t)(v >> 64);
+	z->n64[1] = (uint64_t)v;
+}
+
+/* shifting by 128 bits or more gives 0, like the bitmap.c shifts */
+static inline void ipv6_shift_left(ipv6 *z, int len)
+{
+	u128_to_ipv6(z, (len < 128 ? ipv6_to_u128(z) << len : 0));
+}
+
+static inline void ipv6_shift_right(ipv6 *z, int len)
+{
+	u128_to_ipv6(z, (len < 128 ? ipv6_to_u128(z) >> len : 0));
+}
+
+static inline void ipv6_add(ipv6 *z, int n)
+{
+	u128_to_ipv6(z, ipv6_to_u128(z) + (unsigned __int128)(__int128)n);
+}
 #else
-/* this so you get the idea ....*/
-#define block(__ip6, __n) (u16)((__ip6 >> ((7 - __n) * 16)) & 0xFF)
-#define set_block(__ip6, __n, __value) do { \
-	u16 cur = (__ip6 >> ((7 - __n) * 16)) & 0xFF; \
-	cur ^= __value; \
-	__ip6 ^= (cur << ((7 - __n) * 16)); \
-} while (0) /* not sure about this one :) */
-#define shift_ipv6_left(__z, __len) (__z <<= __n)
-#define shift_ipv6_right(__z, __len) (__z >>= __n)
-#define increase_ipv6(__z) (__z++)
-#define decrease_ipv6(__z) (__z--)
-#define ipv6_is_superior(__ip1, __ip2) (__ip1) < (__ip2)
+static inline void ipv6_shift_left(ipv6 *z, int len)
+{
+	if (len >= 128) {
+		z->n64[0] = 0;
+		z->n64[1] = 0;
+	} else if (len >= 64) {
+		z->n64[0] = z->n64[1] << (len - 64);
+		z->n64[1] = 0;
+	} else if (len) {
+		z->n64[0] = (z->n64[0] << len) | (z->n64[1] >> (64 - len));
+		z->n64[1] <<= len;
+	}
+}
+
+static inline void ipv6_shift_right(ipv6 *z, int len)
+{
+	if (len >= 128) {
+		z->n64[0] = 0;
+		z->n64[1] = 0;
+	} else if (len >= 64) {
+		z->n64[1] = z->n64[0] >> (len - 64);
+		z->n64[0] = 0;
+	} else if (len) {
+		z->n64[1] = (z->n64[1] >> len) | (z->n64[0] << (64 - len));
+		z->n64[0] >>= len;
+	}
+}
+
+/* n is 1 or -1 */
+static inline void ipv6_add(ipv6 *z, int n)
+{
+	uint64_t lo = z->n64[1];
+
+	z->n64[1] += (uint64_t)(int64_t)n;
+	if (n > 0)
+		z->n64[0] += (z->n64[1] < lo);
+	else
+		z->n64[0] -= (z->n64[1] > lo);
+}
+#endif
+
+/* 1 if ip1 < ip2 */
+static inline int ipv6_is_before(const ipv6 *ip1, const ipv6 *ip2)
+{
+	return (ip1->n64[0] < ip2->n64[0]) |
+		((ip1->n64[0] == ip2->n64[0]) & (ip1->n64[1] < ip2->n64[1]));
+}
+
+static inline int ipv6_trailing_zeros(ipv6 z)
+{
+	if (z.n64[1])
+		return __builtin_ctzll(z.n64[1]);
+	if (z.n64[0])
+		return 64 + __builtin_ctzll(z.n64[0]);
+	return 128;
+}
 
 #endif
 
@@ -114,7 +234,16 @@ static inline int is_equal_ipv6(ipv6 ip1, ipv6 ip2)
 	return ip1.n64[0] == ip2.n64[0] && ip1.n64[1] == ip2.n64[1];
 }
 
-int is_equal_ip(struct ip_addr *ip1, struct ip_addr *p2);
+static inline int is_equal_ip(const struct ip_addr *ip1, const struct ip_addr *ip2)
+{
+	if (ip1->ip_ver != ip2->ip_ver)
+		return 0;
+	if (ip1->ip_ver == IPV4_A && ip1->ip == ip2->ip)
+		return 1;
+	if (ip1->ip_ver == IPV6_A && is_equal_ipv6(ip1->ip6, ip2->ip6))
+		return 1;
+	return 0;
+}
 
 int ipv6_is_link_local(ipv6 a);
 int ipv6_is_global(ipv6 a);
@@ -146,6 +275,38 @@ int addr_compare(const struct ip_addr *sub1, const struct subnet *sub2);
 int subnet_is_superior(const struct subnet *s1, const struct subnet *s2);
 int addr_is_superior(const struct ip_addr *s1, const struct ip_addr *s2);
 
+/*
+ * inline versions of subnet_is_superior & addr_is_superior for sort
+ * comparators; IPv4 comes before IPv6, so they also order mixed files
+ * @s1 : first address to test
+ * @s2 : 2nd   address to test
+ * returns:
+ *	1 if s1 must be placed strictly before s2
+ *	0 otherwise
+ */
+static inline int addr_is_before(const struct ip_addr *s1, const struct ip_addr *s2)
+{
+	if (s1->ip_ver != s2->ip_ver)
+		return s1->ip_ver < s2->ip_ver;
+	if (s1->ip_ver == IPV4_A)
+		return s1->ip < s2->ip;
+	return ipv6_is_superior(s1->ip6, s2->ip6);
+}
+
+static inline int subnet_is_before(const struct subnet *s1, const struct subnet *s2)
+{
+	if (s1->ip_ver != s2->ip_ver)
+		return s1->ip_ver < s2->ip_ver;
+	if (s1->ip_ver == IPV4_A) {
+		if (s1->ip != s2->ip)
+			return s1->ip < s2->ip;
+		return s1->mask < s2->mask;
+	}
+	if (is_equal_ipv6(s1->ip6, s2->ip6))
+		return s1->mask < s2->mask;
+	return ipv6_is_superior(s1->ip6, s2->ip6);
+}
+
 /*
  * filter 'test' against 'against' using operator 'op' (=, #, <, >, {, })
  * @test    : the subnet to test
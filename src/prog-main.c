@@ -11,6 +11,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include "debug.h"
 #include <sys/types.h>
 #include <sys/resource.h>
@@ -35,6 +37,8 @@
 #include "prog-main.h"
 #include "st_limits.h"
 #include "st_stats.h"
+#include "st_sort.h"
+#include "st_extsort.h"
 
 /* max number of objects collectable inf fscanf, and scanf */
 #define SCANF_MAX_OBJECTS 40
@@ -105,6 +109,7 @@ static int run_uniq(int argc, char **argv, void *st_options);
 static int run_paip(int argc, char **argv, void *st_options);
 static int run_ipam_getea(int argc, char **argv, void *st_options);
 static int run_grep(int argc, char **argv, void *st_options);
+static int run_lookup(int argc, char **argv, void *st_options);
 static int run_convert(int argc, char **argv, void *st_options);
 static int run_routesimplify1(int argc, char **argv, void *st_options);
 static int run_routesimplify2(int argc, char **argv, void *st_options);
@@ -145,6 +150,7 @@ static int option_verbose2(int argc, char **argv, void *st_options);
 static int option_delim(int argc, char **argv, void *st_options);
 static int option_ipam_ea(int argc, char **argv, void *st_options);
 static int option_grepfield(int argc, char **argv, void *st_options);
+static int option_greptag(int argc, char **argv, void *st_options);
 static int option_output(int argc, char **argv, void *st_options);
 static int option_debug(int argc, char **argv, void *st_options);
 static int option_config(int argc, char **argv, void *st_options);
@@ -153,6 +159,9 @@ static int option_fmt(int argc, char **argv, void *st_options);
 static int option_rt(int argc, char **argv, void *st_options);
 static int option_ecmp(int argc, char **argv, void *st_options);
 static int option_noheader(int argc, char **argv, void *st_options);
+static int option_bgpcmp_new(int argc, char **argv, void *st_options);
+static int option_threads(int argc, char **argv, void *st_options);
+static int option_sort_mem(int argc, char **argv, void *st_options);
 
 struct st_command commands[] = {
     /*command_name",    function_pointer,   num_args, hidden */
@@ -172,6 +181,7 @@ struct st_command commands[] = {
 	{ "ipam",		    &run_paip,      	1},
 	{ "getea",		    &run_ipam_getea,    1},
 	{ "grep",		    &run_grep,      	2},
+	{ "lookup",		    &run_lookup,    	1},
 	{ "convert",		&run_convert,   	1},
 	{ "routesimplify1",	&run_routesimplify1,1},
 	{ "routesimplify2",	&run_routesimplify2,1},
@@ -207,6 +217,7 @@ struct st_command options[] = {
 	{"-VV",		&option_verbose2,   	0},
 	{"-d",		&option_delim,	    	1},
 	{"-grep_field",	&option_grepfield,	1},
+	{"-grep_tag",	&option_greptag,	0},
 	{"-o",		&option_output,	    	1},
 	{"-D",		&option_debug,		    1},
 	{"-c",		&option_config,	    	1},
@@ -219,6 +230,9 @@ struct st_command options[] = {
 	{"-EA",		&option_ipam_ea,	    1},
 	{"-noheader",	&option_noheader,	0},
 	{"-nh",		&option_noheader,	    0},
+	{"-new",	&option_bgpcmp_new,	    0},
+	{"-j",		&option_threads,	    1},
+	{"-mem",	&option_sort_mem,	    1},
 	{NULL, NULL, 0}
 };
 
@@ -397,10 +411,10 @@ static int run_compare(int argc, char **argv, void *st_options)
 		BAD_FILE(argv[3]);
 		return res;
 	}
-	compare_files(&sf1, &sf2, nof);
+	res = compare_files(&sf1, &sf2, nof);
 	free_subnet_file(&sf1);
 	free_subnet_file(&sf2);
-	return 0;
+	return (res < 0 ? res : 0);
 }
 
 static int run_subnetcmp(int argc, char **argv, void *st_options)
@@ -501,10 +515,10 @@ static int run_paip(int argc, char **argv, void *st_options)
 		BAD_FILE(argv[3]);
 		return res;
 	}
-	print_file_against_paip(&sf, &paip, nof);
+	res = print_file_against_paip(&sf, &paip, nof);
 	free_subnet_file(&sf);
 	free_subnet_file(&paip);
-	return 0;
+	return (res < 0 ? res : 0);
 }
 
 static int run_ipam_getea(int argc, char **argv, void *st_options)
@@ -548,7 +562,30 @@ static int run_grep(int argc, char **argv, void *st_options)
 	struct st_options *nof = st_options;
 	int res;
 
-	res = network_grep_file(argv[2], nof, argv[3]);
+	if (!strcmp(argv[2], "-f")) {
+		if (argc < 5) {
+			fprintf(stderr, "Not enough args for command 'grep -f'\n");
+			return -1;
+		}
+		res = network_grep_file_patterns(argv[4], nof, argv[3]);
+	} else
+		res = network_grep_file(argv[2], nof, argv[3]);
+	if (res < 0)
+		return res;
+	return 0;
+}
+
+static int run_lookup(int argc, char **argv, void *st_options)
+{
+	struct subnet_file sf;
+	struct st_options *nof = st_options;
+	int res;
+
+	res = load_netcsv_file(argv[2], &sf, nof);
+	DIE_ON_BAD_FILE(argv[2]);
+	/* read IPs from stdin if no IPFILE */
+	res = lookup_ip_file(&sf, argv[3], nof);
+	free_subnet_file(&sf);
 	if (res < 0)
 		return res;
 	return 0;
@@ -746,9 +783,12 @@ static int run_addfiles(int argc, char **argv, void *st_options)
 	for (j = 0; j < sf2.nr; j++)
 		copy_route(&sf3.routes[i + j], &sf2.routes[j]);
 	sf3.nr = i + j;
+	/* routes belong to sf3 now; sf1 & sf2 keep EA names and arenas until sf3 is freed */
+	sf1.nr = sf2.nr = 0;
 	/* since the routes comes from different files, we wont compare the GW */
 	res = subnet_file_simplify(&sf3);
 	if (res < 0) {
+		free_subnet_file(&sf3);
 		free_subnet_file(&sf2);
 		free_subnet_file(&sf1);
 		return res;
@@ -767,6 +807,11 @@ static int run_sort(int argc, char **argv, void *st_options)
 	struct subnet_file sf;
 	struct st_options *nof = st_options;
 
+	if (nof->sort_mem) {
+		res = subnet_file_external_sort(argv[2], nof);
+		DIE_ON_BAD_FILE(argv[2]);
+		return 0;
+	}
 	res = load_netcsv_file(argv[2], &sf, nof);
 	DIE_ON_BAD_FILE(argv[2]);
 
@@ -877,10 +922,9 @@ static int run_remove_file(int argc, char **argv, void *st_options)
 		free_subnet_file(&sf1);
 		return res;
 	}
-	subnet_file_remove_file(&sf1, &sf2, &sf3);
+	res = subnet_file_remove_file(&sf1, &sf2, &sf3);
 	if (res < 0) {
 		free_subnet_file(&sf1);
-		free_subnet_file(&sf2);
 		free_subnet_file(&sf3);
 		return res;
 	}
@@ -1076,10 +1120,10 @@ static int run_bgpcmp(int argc, char **argv, void *st_options)
 		return res;
 	}
 
-	compare_bgp_file(&sf1, &sf2, st_options);
+	res = compare_bgp_file(&sf1, &sf2, st_options);
 	free_bgp_file(&sf1);
 	free_bgp_file(&sf2);
-	return 0;
+	return (res < 0 ? res : 0);
 }
 
 static int run_bgpsortby(int argc, char **argv, void *st_options)
@@ -1191,6 +1235,15 @@ static int option_grepfield(int argc, char **argv, void *st_options)
 	return 0;
 }
 
+static int option_greptag(int argc, char **argv, void *st_options)
+{
+	struct st_options *nof = st_options;
+
+	nof->grep_tag = 1;
+	debug(PARSEOPTS, 3, "grep will print the matching prefix\n");
+	return 0;
+}
+
 static int option_output(int argc, char **argv, void *st_options)
 {
 	struct st_options *nof = st_options;
@@ -1282,6 +1335,91 @@ static int option_ecmp(int argc, char **argv, void *st_options)
 	return 0;
 }
 
+static int option_bgpcmp_new(int argc, char **argv, void *st_options)
+{
+	struct st_options *nof = st_options;
+
+	nof->bgpcmp_new = 1;
+	debug(PARSEOPTS, 3, "bgpcmp will now print prefixes found only in AFTER\n");
+	return 0;
+}
+
+static int option_threads(int argc, char **argv, void *st_options)
+{
+	int a, res;
+
+	if (!isUnsignedInt(argv[1])) {
+		fprintf(stderr, "expected an unsigned int after option '-j', but got '%s'\n",
+				argv[1]);
+		return -1;
+	}
+	a = string2int(argv[1], &res);
+	if (res < 0)
+		return res;
+	if (a < 1 || a > ST_SORT_MAX_THREADS) {
+		fprintf(stderr, "number of threads must be between 1 and %d\n",
+				ST_SORT_MAX_THREADS);
+		return -1;
+	}
+	st_sort_threads = a;
+	debug(PARSEOPTS, 3, "sorting with up to %d threads\n", a);
+	return 0;
+}
+
+static int option_sort_mem(int argc, char **argv, void *st_options)
+{
+	struct st_options *nof = st_options;
+	unsigned long mem;
+	int shift = 0;
+	char *end;
+
+	/* strtoul would accept '-5' or leading blanks */
+	if (!isdigit(argv[1][0])) {
+		fprintf(stderr, "expected a size after option '-mem', but got '%s'\n", argv[1]);
+		return -1;
+	}
+	errno = 0;
+	mem = strtoul(argv[1], &end, 10);
+	if (errno == ERANGE) {
+		fprintf(stderr, "size '%s' for option '-mem' is too big\n", argv[1]);
+		return -1;
+	}
+	switch (*end) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		end++;
+		break;
+	}
+	if (*end != '\0') {
+		fprintf(stderr, "invalid size '%s' for option '-mem', use N, NK, NM or NG\n",
+				argv[1]);
+		return -1;
+	}
+	if (mem > (ULONG_MAX >> shift)) {
+		fprintf(stderr, "size '%s' for option '-mem' is too big\n", argv[1]);
+		return -1;
+	}
+	mem <<= shift;
+	if (mem < EXTSORT_MIN_MEM) {
+		fprintf(stderr, "option '-mem' must be at least %dK\n", EXTSORT_MIN_MEM >> 10);
+		return -1;
+	}
+	nof->sort_mem = mem;
+	debug(PARSEOPTS, 3, "sort will use at most %lu bytes\n", mem);
+	return 0;
+}
+
 static int option_ipam_ea(int argc, char **argv, void *st_options)
 {
 	struct st_options *nof = st_options;
@@ -1360,6 +1498,9 @@ int main(int argc, char **argv)
 	} else
 		open_config_file(nof.config_file, &nof);
 
+	/* files are freed right before exit; don't walk them unless looking for leaks */
+	if (debugs_level[__D_MEMORY] == 0 && debugs_level[__D_ALL] == 0)
+		st_skip_teardown = 1;
 	res = generic_command_run(argc, argv, PROG_NAME, &nof);
 	fclose(nof.output_file);
 	exit(res);
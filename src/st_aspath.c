@@ -0,0 +1,160 @@
+/*
+ * AS_PATH pool, shared by all BGP routes
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "debug.h"
+#include "st_memory.h"
+#include "st_hashtab.h"
+#include "st_printf.h"
+#include "st_aspath.h"
+
+#define ASPATH_CHUNK_SIZE	(64 * 1024)
+
+/* aspath_pool[id] is AS_PATH 'id'; slots is an open addressing hash table
+ * of ids, 0 meaning a free slot
+ */
+struct aspath *aspath_pool;
+static unsigned long pool_nr; /* including id 0 */
+static unsigned long pool_max_nr;
+static unsigned int *slots;
+static unsigned long slots_size; /* power of two */
+static struct st_arena strings;
+
+static int as_path_length(const char *s)
+{
+	int i = 0;
+	int num = 0;
+	int in_confed = 0;
+	int in_asset = 0;
+	char c;
+
+	while (isspace(s[i]))
+		i++;
+	if (s[i] == '\0')
+		return 0;
+	for ( ; s[i] != '\0'; i++) {
+		c = s[i];
+		if (in_confed && (c == '{' || c == '}' || c == '(')) {
+			st_debug(BGPCMP, 2, "BAD AS_PATH '%s'\n", s);
+			return -1;
+		}
+		if (in_asset && (c == '(' || c == ')' || c == '{')) {
+			st_debug(BGPCMP, 2, "BAD AS_PATH '%s'\n", s);
+			return -1;
+		}
+		if (c == '(')
+			in_confed = 1;
+		else if (c == '{')
+			in_asset = 1;
+		else if (c == ')' && in_confed) {
+			in_confed = 0;
+			continue;
+		} else if (c == '}' && in_asset) {
+			in_asset = 0;
+			continue;
+		}
+		/* AS in AS_CONFED or AS_SET doesnt count int the AS_PATH length */
+		if (in_asset || in_confed)
+			continue;
+		if  (isdigit(s[i]) && (isspace(s[i + 1]) || s[i + 1] == '\0'))
+			num++;
+	}
+	if (in_asset || in_confed) {
+		st_debug(BGPCMP, 2, "BAD AS_PATH '%s'\n", s);
+		return -1;
+	}
+	return num;
+}
+
+static int aspath_pool_grow(void)
+{
+	struct aspath *new_pool;
+	unsigned int *new_slots;
+	unsigned long i, h, size, max_nr;
+
+	if (pool_max_nr == 0)
+		st_arena_init(&strings, ASPATH_CHUNK_SIZE);
+	max_nr = (pool_max_nr ? pool_max_nr * 2 : 512);
+	size   = 2 * max_nr;
+	new_pool  = st_malloc(max_nr * sizeof(struct aspath), "AS_PATH pool");
+	new_slots = st_malloc(size * sizeof(unsigned int), "AS_PATH pool");
+	if (new_pool == NULL || new_slots == NULL) {
+		st_free(new_pool, max_nr * sizeof(struct aspath));
+		st_free(new_slots, size * sizeof(unsigned int));
+		return -1;
+	}
+	memset(new_slots, 0, size * sizeof(unsigned int));
+	if (pool_nr == 0) {
+		/* id 0 is the empty AS_PATH, never looked up */
+		new_pool[0].path = "";
+		new_pool[0].len  = 0;
+		new_pool[0].hash = 0;
+		pool_nr = 1;
+	} else
+		memcpy(new_pool, aspath_pool, pool_nr * sizeof(struct aspath));
+	for (i = 1; i < pool_nr; i++) {
+		h = new_pool[i].hash & (size - 1);
+		while (new_slots[h])
+			h = (h + 1) & (size - 1);
+		new_slots[h] = i;
+	}
+	st_free(aspath_pool, pool_max_nr * sizeof(struct aspath));
+	st_free(slots, slots_size * sizeof(unsigned int));
+	aspath_pool = new_pool;
+	pool_max_nr = max_nr;
+	slots       = new_slots;
+	slots_size  = size;
+	return 1;
+}
+
+long aspath_intern(const char *s)
+{
+	unsigned long len, h;
+	unsigned int hv, id;
+	char *p;
+
+	if (s[0] == '\0')
+		return 0;
+	if (pool_nr == pool_max_nr && aspath_pool_grow() < 0)
+		return -1;
+	len = strlen(s);
+	hv  = fnv_hash(s, len);
+	h   = hv & (slots_size - 1);
+	while ((id = slots[h])) {
+		if (aspath_pool[id].hash == hv && !strcmp(aspath_pool[id].path, s))
+			return id;
+		h = (h + 1) & (slots_size - 1);
+	}
+	p = st_arena_alloc(&strings, len + 1);
+	if (p == NULL)
+		return -1;
+	memcpy(p, s, len + 1);
+	id = pool_nr++;
+	aspath_pool[id].path = p;
+	aspath_pool[id].len  = as_path_length(p);
+	aspath_pool[id].hash = hv;
+	slots[h] = id;
+	debug(MEMORY, 7, "new AS_PATH %u '%s'\n", id, p);
+	return id;
+}
+
+void aspath_pool_free(void)
+{
+	if (pool_nr)
+		debug(MEMORY, 4, "AS_PATH pool: %lu paths\n", pool_nr - 1);
+	st_arena_free(&strings);
+	st_free(aspath_pool, pool_max_nr * sizeof(struct aspath));
+	st_free(slots, slots_size * sizeof(unsigned int));
+	aspath_pool = NULL;
+	slots       = NULL;
+	pool_nr = pool_max_nr = slots_size = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef ST_ASPATH_H
+#define ST_ASPATH_H
+
+/*
+ * AS_PATH pool; BGP tables have far less distinct AS_PATHs than routes, so
+ * routes carry the 4-byte id of a pool entry instead of the path itself
+ * each entry holds the path and its length, computed once
+ * id 0 is the empty AS_PATH, so a zeroed route has an empty AS_PATH
+ * ids stay valid until aspath_pool_free()
+ */
+struct aspath {
+	const char *path;
+	int len; /* AS_PATH length, as used by BGP best path selection */
+	unsigned int hash;
+};
+
+extern struct aspath *aspath_pool;
+
+/* aspath_intern: get the id of an AS_PATH, adding it to the pool if needed
+ * @s : the AS_PATH, like '65001 (65010 65011) 3356 {174,1299}'
+ * returns:
+ *	the id; two equal AS_PATHs get the same id
+ *	-1 on ENOMEM
+ */
+long aspath_intern(const char *s);
+
+/* aspath_str: get the AS_PATH of id 'id'
+ * @id : an id returned by aspath_intern, or 0
+ */
+static inline const char *aspath_str(unsigned int id)
+{
+	return (id ? aspath_pool[id].path : "");
+}
+
+/* aspath_len: get the length of AS_PATH 'id'
+ * AS in AS_SET '{}' and AS_CONFED '()' don't count
+ * @id : an id returned by aspath_intern, or 0
+ * returns:
+ *	the length
+ *	-1 if the AS_PATH is invalid
+ */
+static inline int aspath_len(unsigned int id)
+{
+	return (id ? aspath_pool[id].len : 0);
+}
+
+/* aspath_pool_free: release all AS_PATHs
+ * must only be called when no route references them anymore
+ */
+void aspath_pool_free(void);
+
+#else
+#endif
@@ -0,0 +1,145 @@
+/*
+ * DIR-24-8 IPv4 longest prefix match table
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "iptools.h"
+#include "st_memory.h"
+#include "st_routes_csv.h"
+#include "st_dir24.h"
+
+struct dir24_prefix {
+	ipv4 ip; /* host bits cleared */
+	int mask;
+	unsigned long index;
+};
+
+/* shorter masks first; on equal prefixes, the first route is inserted last */
+static int dir24_prefix_cmp(const void *v1, const void *v2)
+{
+	const struct dir24_prefix *p1 = v1;
+	const struct dir24_prefix *p2 = v2;
+
+	if (p1->mask != p2->mask)
+		return p1->mask - p2->mask;
+	return (p1->index < p2->index) - (p1->index > p2->index);
+}
+
+int alloc_dir24(struct st_dir24 *d)
+{
+	d->tbl24 = st_malloc(DIR24_TBL24_SIZE * sizeof(unsigned int), "dir24 tbl24");
+	if (d->tbl24 == NULL)
+		return -1;
+	memset(d->tbl24, 0, DIR24_TBL24_SIZE * sizeof(unsigned int));
+	d->tbl8_max = 64;
+	d->tbl8_nr  = 0;
+	d->tbl8 = st_malloc(d->tbl8_max * 256 * sizeof(unsigned int), "dir24 tbl8");
+	if (d->tbl8 == NULL) {
+		st_free(d->tbl24, DIR24_TBL24_SIZE * sizeof(unsigned int));
+		return -1;
+	}
+	return 1;
+}
+
+void free_dir24(struct st_dir24 *d)
+{
+	st_free(d->tbl24, DIR24_TBL24_SIZE * sizeof(unsigned int));
+	st_free(d->tbl8, d->tbl8_max * 256 * sizeof(unsigned int));
+	d->tbl24 = NULL;
+	d->tbl8  = NULL;
+	d->tbl8_nr = d->tbl8_max = 0;
+}
+
+/* return the tbl8 group of tbl24 entry 'i', creating it if needed */
+static unsigned int *dir24_get_group(struct st_dir24 *d, unsigned long i)
+{
+	unsigned int *new_tbl8, *g, e;
+	int j;
+
+	e = d->tbl24[i];
+	if (e & DIR24_GROUP)
+		return d->tbl8 + ((unsigned long)(e & ~DIR24_GROUP) << 8);
+	if (d->tbl8_nr == d->tbl8_max) {
+		if (2 * d->tbl8_max > DIR24_GROUP) {
+			fprintf(stderr, "error: too many tbl8 groups\n");
+			return NULL;
+		}
+		new_tbl8 = st_realloc(d->tbl8, 2 * d->tbl8_max * 256 * sizeof(unsigned int),
+				d->tbl8_max * 256 * sizeof(unsigned int), "dir24 tbl8");
+		if (new_tbl8 == NULL)
+			return NULL;
+		d->tbl8 = new_tbl8;
+		d->tbl8_max *= 2;
+	}
+	/* the group inherits the route covering the whole /24 */
+	g = d->tbl8 + (d->tbl8_nr << 8);
+	for (j = 0; j < 256; j++)
+		g[j] = e;
+	d->tbl24[i] = DIR24_GROUP | d->tbl8_nr;
+	d->tbl8_nr++;
+	return g;
+}
+
+int dir24_load_subnet_file(struct st_dir24 *d, const struct subnet_file *sf)
+{
+	struct dir24_prefix *p;
+	unsigned long i, j, n = 0, start, len;
+	unsigned int *g, e;
+	int res;
+
+	if (sf->nr > DIR24_MAX_ROUTES) {
+		fprintf(stderr, "error: too many routes to fit in a DIR-24-8 table\n");
+		return -1;
+	}
+	p = st_malloc((sf->nr + 1) * sizeof(struct dir24_prefix), "dir24 prefixes");
+	if (p == NULL)
+		return -1;
+	for (i = 0; i < sf->nr; i++) {
+		if (sf->routes[i].subnet.ip_ver != IPV4_A)
+			continue;
+		p[n].mask  = sf->routes[i].subnet.mask;
+		p[n].ip    = (p[n].mask == 0 ? 0 :
+				sf->routes[i].subnet.ip & (~0U << (32 - p[n].mask)));
+		p[n].index = i;
+		n++;
+	}
+	res = alloc_dir24(d);
+	if (res < 0) {
+		st_free(p, (sf->nr + 1) * sizeof(struct dir24_prefix));
+		return res;
+	}
+	/* a prefix overwrites the shorter ones inserted before it */
+	qsort(p, n, sizeof(struct dir24_prefix), &dir24_prefix_cmp);
+	for (i = 0; i < n; i++) {
+		e = p[i].index + 1;
+		if (p[i].mask <= 24) {
+			/* no tbl8 group exists yet, they are created by longer masks */
+			start = p[i].ip >> 8;
+			len   = 1UL << (24 - p[i].mask);
+			for (j = start; j < start + len; j++)
+				d->tbl24[j] = e;
+			continue;
+		}
+		g = dir24_get_group(d, p[i].ip >> 8);
+		if (g == NULL) {
+			free_dir24(d);
+			st_free(p, (sf->nr + 1) * sizeof(struct dir24_prefix));
+			return -1;
+		}
+		start = p[i].ip & 0xff;
+		len   = 1UL << (32 - p[i].mask);
+		for (j = start; j < start + len; j++)
+			g[j] = e;
+	}
+	debug(LOOKUP, 3, "%lu IPv4 routes loaded, %lu tbl8 groups used\n", n, d->tbl8_nr);
+	st_free(p, (sf->nr + 1) * sizeof(struct dir24_prefix));
+	return 1;
+}
@@ -0,0 +1,59 @@
+#ifndef ST_DIR24_H
+#define ST_DIR24_H
+
+#include "iptools.h"
+#include "st_routes_csv.h"
+
+/*
+ * DIR-24-8 IPv4 longest prefix match table
+ * tbl24 is indexed by the 24 high bits of an address; an entry is either
+ * a route index + 1 (0 means no route) or, if DIR24_GROUP is set, the number
+ * of a tbl8 group of 256 entries indexed by the 8 low bits
+ * lookup is 1 or 2 memory accesses
+ */
+#define DIR24_TBL24_SIZE (1 << 24)
+#define DIR24_GROUP      0x80000000U
+#define DIR24_MAX_ROUTES (DIR24_GROUP - 2)
+
+struct st_dir24 {
+	unsigned int *tbl24;
+	unsigned int *tbl8;
+	unsigned long tbl8_nr; /* number of tbl8 groups used */
+	unsigned long tbl8_max; /* number of tbl8 groups malloc'ed */
+};
+
+/* alloc_dir24: alloc memory for an empty table (64MB)
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int alloc_dir24(struct st_dir24 *d);
+
+/* free_dir24: release memory attached to a table */
+void free_dir24(struct st_dir24 *d);
+
+/* dir24_load_subnet_file: alloc a table and insert all IPv4 routes from 'sf'
+ * index of each prefix is its route number in sf
+ * on equal prefixes, the first route in sf wins
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM or if sf has too many routes
+ */
+int dir24_load_subnet_file(struct st_dir24 *d, const struct subnet_file *sf);
+
+/* dir24_lookup: longest prefix match of address 'ip'
+ * returns:
+ *	the index of the matching route
+ *	-1 if no route matches
+ */
+static inline long dir24_lookup(const struct st_dir24 *d, ipv4 ip)
+{
+	unsigned int e = d->tbl24[ip >> 8];
+
+	if (e & DIR24_GROUP)
+		e = d->tbl8[((e & ~DIR24_GROUP) << 8) + (ip & 0xff)];
+	return (long)e - 1;
+}
+
+#else
+#endif
@@ -15,12 +15,14 @@
 #include "utils.h"
 #include "st_ea.h"
 #include "st_scanf.h"
+#include "st_strpool.h"
 
 
 int ea_strdup(struct st_ea *ea, const char *value)
 {
 	int len;
 
+	ea->pooled = 0;
 	if (value == NULL) {
 		ea->len   = 0;
 		ea->value = NULL;
@@ -41,7 +43,34 @@ int ea_strdup(struct st_ea *ea, const char *value)
 	return 1;
 }
 
-void free_ea_array(struct st_ea *ea, int n)
+int ea_intern(struct st_ea *ea, const char *value)
+{
+	if (value == NULL)
+		return ea_strdup(ea, NULL);
+	/* pool strings are never written to, see ea->pooled */
+	ea->value = (char *)st_intern(value);
+	if (ea->value == NULL) {
+		ea->len    = 0;
+		ea->pooled = 0;
+		return -1;
+	}
+	ea->len    = strlen(value) + 1;
+	ea->pooled = 1;
+	return 1;
+}
+
+int ea_clone(struct st_ea *ea, const struct st_ea *src)
+{
+	if (src->value && src->pooled) {
+		ea->value  = src->value;
+		ea->len    = src->len;
+		ea->pooled = 1;
+		return 1;
+	}
+	return ea_strdup(ea, src->value);
+}
+
+void free_ea_values(struct st_ea *ea, int n)
 {
 	int i;
 
@@ -52,32 +81,62 @@ void free_ea_array(struct st_ea *ea, int n)
 			free_ea(&ea[i]);
 		}
 	}
-	st_free(ea, sizeof(struct st_ea) * n);
 }
 
-struct st_ea *alloc_ea_array(int n)
+void free_ea_array(struct st_ea *ea, int n)
 {
-	int j;
-	struct st_ea *ea;
+	free_ea_values(ea, n);
+	st_free(ea, sizeof(struct st_ea) * n);
+}
 
+static int check_ea_array_size(int n, const char *func)
+{
 	if (n <= 0) {
-		fprintf(stderr, "BUG, %s called with %d size\n", __func__, n);
-		return NULL;
+		fprintf(stderr, "BUG, %s called with %d size\n", func, n);
+		return -1;
 	}
 	if (n >= MAX_EA_NUMBER) {
 		fprintf(stderr, "BUG, %s tries to allocate %d EAs but MAX_EA_NUMBER is %d\n",
-				__func__, n, MAX_EA_NUMBER);
-		return NULL;
+				func, n, MAX_EA_NUMBER);
+		return -1;
 	}
+	return 1;
+}
+
+static void init_ea_array(struct st_ea *ea, int n)
+{
+	int j;
+
+	for (j = 0; j < n; j++) {
+		ea[j].value  = NULL;
+		ea[j].len    = 0;
+		ea[j].pooled = 0;
+	}
+}
+
+struct st_ea *alloc_ea_array(int n)
+{
+	struct st_ea *ea;
 
+	if (check_ea_array_size(n, __func__) < 0)
+		return NULL;
 	ea = st_malloc_nodebug(n * sizeof(struct st_ea), "st_ea");
 	if (ea == NULL)
 		return NULL;
+	init_ea_array(ea, n);
+	return ea;
+}
 
-	for (j = 0; j < n; j++) {
-		ea[j].value = NULL;
-		ea[j].len   = 0;
-	}
+struct st_ea *arena_alloc_ea_array(struct st_arena *a, int n)
+{
+	struct st_ea *ea;
+
+	if (check_ea_array_size(n, __func__) < 0)
+		return NULL;
+	ea = st_arena_alloc(a, n * sizeof(struct st_ea));
+	if (ea == NULL)
+		return NULL;
+	init_ea_array(ea, n);
 	return ea;
 }
 
@@ -103,8 +162,9 @@ struct st_ea *realloc_ea_array(struct st_ea *ea,
 		return NULL;
 
 	for (j = old_n; j < new_n; j++) {
-		new_ea[j].value = NULL;
-		new_ea[j].len   = 0;
+		new_ea[j].value  = NULL;
+		new_ea[j].len    = 0;
+		new_ea[j].pooled = 0;
 	}
 	return new_ea;
 }
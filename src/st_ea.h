@@ -11,14 +11,15 @@
 
 struct  st_ea {
 	const char *name; /* name must not be malloced or strdup; it has to point to a table of name or static string */ 
-	char *value; /* value of EA; MUST be malloc'ed*/
+	char *value; /* value of EA; malloc'ed, or a string pool string if pooled */
 	int len; /* strlen(value) + 1 */
+	int pooled; /* value is shared in the string pool; it MUST not be modified or freed */
 };
 
 /* return the malloc'd size of ea*/
 static inline int ea_size(const struct st_ea *ea)
 {
-        if (ea->value == NULL)
+        if (ea->value == NULL || ea->pooled)
                 return 0;
         return ea->len;
 }
@@ -32,9 +33,11 @@ static inline void free_ea(struct st_ea *ea) {
 		}
 		return;
 	}
-	st_free(ea->value, ea->len);
-	ea->len   = 0;
-	ea->value = NULL;
+	if (!ea->pooled)
+		st_free(ea->value, ea->len);
+	ea->len    = 0;
+	ea->value  = NULL;
+	ea->pooled = 0;
 }
 /* set value of 'ea' to 'value'
  * ea->value should be freed before
@@ -44,8 +47,31 @@ static inline void free_ea(struct st_ea *ea) {
  **/
 int ea_strdup(struct st_ea *ea, const char *value);
 
+/* set value of 'ea' to the string pool copy of 'value'
+ * use it for values likely shared by many objects (comments, values read from a file)
+ * ea->value should be freed before
+ * returns:
+ *	-1 if no memory
+ *	1  if SUCCESS
+ **/
+int ea_intern(struct st_ea *ea, const char *value);
+
+/* copy the value of 'src' into 'ea'; pooled values are shared, others duplicated
+ * ea->value should be freed before
+ * returns:
+ *	-1 if no memory
+ *	1  if SUCCESS
+ **/
+int ea_clone(struct st_ea *ea, const struct st_ea *src);
+
 void free_ea_array(struct st_ea *ea, int n);
 
+/* free_ea_values: free the values of an EA array, but not the array itself
+ * @ea : the EA array
+ * @n  : number of Extended Attributes
+ */
+void free_ea_values(struct st_ea *ea, int n);
+
 /*  alloc_ea_array
  *  alloc an array of Extended Attributes
  *	@n : number of Extended Attributes
@@ -55,6 +81,18 @@ void free_ea_array(struct st_ea *ea, int n);
  */
 struct st_ea *alloc_ea_array(int n);
 
+/*  arena_alloc_ea_array
+ *  alloc an array of Extended Attributes from an arena
+ *  the array MUST NOT be freed with free_ea_array, its values must be freed
+ *  with free_ea_values
+ *	@a : the arena
+ *	@n : number of Extended Attributes
+ *  returns:
+ *	a pointer to a struct st_ea
+ *	NULL if ENOMEM
+ */
+struct st_ea *arena_alloc_ea_array(struct st_arena *a, int n);
+
 /*
  *  realloc_ea_array
  *  increase size of an EA array; set new members to NULL
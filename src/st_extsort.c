@@ -0,0 +1,397 @@
+/*
+ * external merge sort of route files
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "debug.h"
+#include "iptools.h"
+#include "st_memory.h"
+#include "st_routes.h"
+#include "st_routes_csv.h"
+#include "generic_csv.h"
+#include "heap.h"
+#include "st_printf.h"
+#include "st_strpool.h"
+#include "subnet_tool.h"
+#include "st_extsort.h"
+
+struct ext_sort {
+	struct st_options *nof;
+	FILE **runs;
+	unsigned long runs_nr;
+	unsigned long runs_max;
+	int header_done;
+};
+
+/* a run being merged, and its current route */
+struct ext_run {
+	FILE *f;
+	struct route r;
+	unsigned long id; /* run number, used as a tie-breaker to keep the sort stable */
+};
+
+/*
+ * binary route encoding:
+ * ip_ver, mask, address (4 or 16 bytes), gw ip_ver, gw address (0, 4 or 16 bytes)
+ * device length, device, number of EA, then for each EA:
+ * strlen + 1 (varint, 0 for a NULL value), value without the NUL
+ */
+static void ext_put_varint(FILE *f, unsigned long v)
+{
+	while (v >= 0x80) {
+		putc((v & 0x7F) | 0x80, f);
+		v >>= 7;
+	}
+	putc(v, f);
+}
+
+static int ext_get_varint(FILE *f, unsigned long *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+	while (shift < 64) {
+		c = getc(f);
+		if (c == EOF)
+			return -1;
+		*v |= (unsigned long)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return 1;
+		shift += 7;
+	}
+	return -1;
+}
+
+static void ext_put_addr(FILE *f, const struct ip_addr *a)
+{
+	putc(a->ip_ver, f);
+	if (a->ip_ver == IPV4_A)
+		fwrite(&a->ip, sizeof(a->ip), 1, f);
+	else if (a->ip_ver == IPV6_A)
+		fwrite(&a->ip6, sizeof(a->ip6), 1, f);
+}
+
+static int ext_get_addr(FILE *f, struct ip_addr *a)
+{
+	int c;
+
+	c = getc(f);
+	if (c == EOF)
+		return -1;
+	a->ip_ver = c;
+	if (c == IPV4_A)
+		return (fread(&a->ip, sizeof(a->ip), 1, f) == 1 ? 1 : -1);
+	if (c == IPV6_A)
+		return (fread(&a->ip6, sizeof(a->ip6), 1, f) == 1 ? 1 : -1);
+	a->ip_ver = 0;
+	return 1;
+}
+
+static void ext_write_route(FILE *f, const struct route *r)
+{
+	int i, len;
+
+	ext_put_addr(f, &r->subnet.ip_addr);
+	putc(r->subnet.mask, f);
+	ext_put_addr(f, &r->gw);
+	len = strlen(r->device);
+	putc(len, f);
+	fwrite(r->device, 1, len, f);
+	ext_put_varint(f, r->ea_nr);
+	for (i = 0; i < r->ea_nr; i++) {
+		if (r->ea[i].value == NULL) {
+			ext_put_varint(f, 0);
+			continue;
+		}
+		len = strlen(r->ea[i].value);
+		ext_put_varint(f, len + 1);
+		fwrite(r->ea[i].value, 1, len, f);
+	}
+}
+
+/* read the next route of a run; EA names are taken from sf
+ * returns:
+ *	1 if a route was read
+ *	0 at end of run
+ *	-1 on error
+ */
+static int ext_read_route(FILE *f, struct route *r, const struct subnet_file *sf)
+{
+	char buffer[CSV_MAX_LINE_LEN];
+	unsigned long ea_nr, len;
+	int i, c;
+
+	c = getc(f);
+	if (c == EOF)
+		return 0;
+	ungetc(c, f);
+	zero_route(r);
+	if (ext_get_addr(f, &r->subnet.ip_addr) < 0)
+		return -1;
+	c = getc(f);
+	if (c == EOF)
+		return -1;
+	r->subnet.mask = c;
+	if (ext_get_addr(f, &r->gw) < 0)
+		return -1;
+	c = getc(f);
+	if (c == EOF || c >= sizeof(buffer))
+		return -1;
+	if (fread(buffer, 1, c, f) != c)
+		return -1;
+	buffer[c] = '\0';
+	r->device = st_intern(buffer);
+	if (r->device == NULL)
+		return -1;
+	if (ext_get_varint(f, &ea_nr) < 0 || ea_nr != sf->ea_nr)
+		return -1;
+	if (alloc_route_ea(r, ea_nr) < 0)
+		return -1;
+	for (i = 0; i < ea_nr; i++) {
+		r->ea[i].name = sf->ea[i];
+		if (ext_get_varint(f, &len) < 0 || len > sizeof(buffer))
+			goto bad;
+		if (len == 0)
+			continue;
+		if (fread(buffer, 1, len - 1, f) != len - 1)
+			goto bad;
+		buffer[len - 1] = '\0';
+		/* not interned: the pool is never released, read back routes are */
+		if (ea_strdup(&r->ea[i], buffer) < 0)
+			goto bad;
+	}
+	return 1;
+bad:
+	free_route(r);
+	return -1;
+}
+
+static void ext_print_route(struct ext_sort *e, const struct route *r)
+{
+	if (e->header_done == 0) {
+		if (e->nof->print_header)
+			fprint_route_header(e->nof->output_file, r, e->nof->output_fmt);
+		e->header_done = 1;
+	}
+	fprint_route_fmt(e->nof->output_file, r, e->nof->output_fmt);
+}
+
+/* same order as the 'sort' command; equal prefixes are taken from the earliest run */
+static inline int ext_run_is_superior(void *v1, void *v2)
+{
+	const struct ext_run *a = v1;
+	const struct ext_run *b = v2;
+
+	if (subnet_is_before(&a->r.subnet, &b->r.subnet))
+		return 1;
+	if (subnet_is_before(&b->r.subnet, &a->r.subnet))
+		return 0;
+	return (a->id < b->id);
+}
+
+TAS_DEFINE(ext_heap, ext_run_is_superior)
+
+/* k-way merge of runs; merged routes are written to 'out', or printed if out is NULL */
+static int ext_merge_runs(struct ext_sort *e, const struct subnet_file *sf,
+		FILE **runs, unsigned long nr, FILE *out)
+{
+	struct ext_run *cursors, *c;
+	unsigned long i;
+	TAS tas;
+	int res;
+
+	cursors = st_malloc(nr * sizeof(struct ext_run), "ext_run");
+	if (cursors == NULL)
+		return -1;
+	res = alloc_tas(&tas, nr, &ext_run_is_superior);
+	if (res < 0) {
+		st_free(cursors, nr * sizeof(struct ext_run));
+		return res;
+	}
+	for (i = 0; i < nr; i++) {
+		cursors[i].f  = runs[i];
+		cursors[i].id = i;
+		res = ext_read_route(runs[i], &cursors[i].r, sf);
+		if (res < 0)
+			goto out;
+		if (res > 0)
+			ext_heap_add(&tas, &cursors[i]);
+	}
+	res = 1;
+	while ((c = ext_heap_pop(&tas)) != NULL) {
+		if (out)
+			ext_write_route(out, &c->r);
+		else
+			ext_print_route(e, &c->r);
+		free_route(&c->r);
+		res = ext_read_route(c->f, &c->r, sf);
+		if (res < 0)
+			goto out;
+		if (res > 0)
+			ext_heap_add(&tas, c);
+		res = 1;
+	}
+out:
+	if (res < 0) {
+		fprintf(stderr, "error reading a temporary sort file\n");
+		/* free routes still in the heap */
+		while ((c = ext_heap_pop(&tas)) != NULL)
+			free_route(&c->r);
+	}
+	free_tas(&tas);
+	st_free(cursors, nr * sizeof(struct ext_run));
+	return res;
+}
+
+static void ext_close_runs(struct ext_sort *e)
+{
+	unsigned long i;
+
+	for (i = 0; i < e->runs_nr; i++)
+		fclose(e->runs[i]);
+	st_free(e->runs, e->runs_max * sizeof(FILE *));
+	e->runs    = NULL;
+	e->runs_nr = e->runs_max = 0;
+}
+
+/* merge runs EXTSORT_MAX_FANIN at a time until they can all be merged at once
+ * consecutive runs are merged, so the sort remains stable
+ */
+static int ext_reduce_runs(struct ext_sort *e, const struct subnet_file *sf)
+{
+	unsigned long i, j, n, new_nr;
+	FILE *f;
+	int res = 1;
+
+	while (e->runs_nr > EXTSORT_MAX_FANIN) {
+		/* new_nr <= i, so merged runs never overwrite runs not merged yet */
+		new_nr = 0;
+		for (i = 0; i < e->runs_nr; i += n) {
+			n = e->runs_nr - i;
+			if (n > EXTSORT_MAX_FANIN)
+				n = EXTSORT_MAX_FANIN;
+			if (n == 1) {
+				e->runs[new_nr++] = e->runs[i];
+				continue;
+			}
+			f = tmpfile();
+			if (f == NULL) {
+				fprintf(stderr, "cannot create a temporary sort file: %s\n",
+						strerror(errno));
+				res = -1;
+				break;
+			}
+			res = ext_merge_runs(e, sf, e->runs + i, n, f);
+			if (res < 0 || fflush(f) || ferror(f)) {
+				fclose(f);
+				res = -1;
+				break;
+			}
+			rewind(f);
+			for (j = i; j < i + n; j++)
+				fclose(e->runs[j]);
+			e->runs[new_nr++] = f;
+		}
+		/* on error, keep the runs not merged so they can be closed */
+		for (; i < e->runs_nr; i++)
+			e->runs[new_nr++] = e->runs[i];
+		e->runs_nr = new_nr;
+		if (res < 0)
+			return res;
+		debug(SORT, 2, "%lu runs left after a merge pass\n", e->runs_nr);
+	}
+	return 1;
+}
+
+/* run handler called by load_netcsv_file_by_runs */
+static int ext_sort_run(struct subnet_file *sf, int last, void *arg)
+{
+	struct ext_sort *e = arg;
+	FILE **new_runs;
+	FILE *f;
+	unsigned long i;
+	int res;
+
+	if (sf->nr == 0)
+		return 1;
+	res = subnet_sort_by(sf, "prefix");
+	if (res < 0)
+		return res;
+	if (last && e->runs_nr == 0) {
+		/* everything fit in memory, no need to spill */
+		for (i = 0; i < sf->nr; i++) {
+			ext_print_route(e, &sf->routes[i]);
+			free_route(&sf->routes[i]);
+		}
+		sf->nr = 0;
+		return 1;
+	}
+	if (e->runs_nr == e->runs_max) {
+		new_runs = st_realloc(e->runs, (e->runs_max * 2 + 16) * sizeof(FILE *),
+				e->runs_max * sizeof(FILE *), "sort runs");
+		if (new_runs == NULL)
+			return -1;
+		e->runs = new_runs;
+		e->runs_max = e->runs_max * 2 + 16;
+	}
+	f = tmpfile();
+	if (f == NULL) {
+		fprintf(stderr, "cannot create a temporary sort file: %s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < sf->nr; i++) {
+		ext_write_route(f, &sf->routes[i]);
+		free_route(&sf->routes[i]);
+	}
+	debug(SORT, 2, "run %lu, %lu routes spilled, %ld bytes\n",
+			e->runs_nr, sf->nr, ftell(f));
+	sf->nr = 0;
+	if (fflush(f) || ferror(f)) {
+		fprintf(stderr, "cannot write a temporary sort file: %s\n", strerror(errno));
+		fclose(f);
+		return -1;
+	}
+	rewind(f);
+	e->runs[e->runs_nr++] = f;
+	/* bound the number of open temporary files */
+	if (e->runs_nr >= 2 * EXTSORT_MAX_FANIN)
+		return ext_reduce_runs(e, sf);
+	return 1;
+}
+
+int subnet_file_external_sort(char *name, struct st_options *nof)
+{
+	struct subnet_file sf;
+	struct ext_sort e;
+	int res;
+
+	e.nof = nof;
+	e.runs = NULL;
+	e.runs_nr = e.runs_max = 0;
+	e.header_done = 0;
+	/* a third of the budget for routes; the route array slack and the sort
+	 * buffers use the rest
+	 */
+	res = load_netcsv_file_by_runs(name, &sf, nof, nof->sort_mem / 3, &ext_sort_run, &e);
+	if (res < 0) {
+		ext_close_runs(&e);
+		return res;
+	}
+	if (e.runs_nr) {
+		debug(SORT, 1, "merging %lu runs\n", e.runs_nr);
+		res = ext_reduce_runs(&e, &sf);
+		if (res > 0)
+			res = ext_merge_runs(&e, &sf, e.runs, e.runs_nr, NULL);
+	}
+	ext_close_runs(&e);
+	free_subnet_file(&sf);
+	return res;
+}
@@ -0,0 +1,25 @@
+#ifndef ST_EXTSORT_H
+#define ST_EXTSORT_H
+
+#include "st_options.h"
+
+/* max number of runs merged at once; more runs are merged in several passes */
+#define EXTSORT_MAX_FANIN	256
+/* smallest memory budget accepted */
+#define EXTSORT_MIN_MEM		(64 * 1024)
+
+/* subnet_file_external_sort: sort a route file by prefix with bounded memory
+ * routes are loaded by runs using at most nof->sort_mem / 3 bytes; each run
+ * is sorted and written to a temporary file in a compact binary form
+ * runs are then merged through a heap and printed with nof->output_fmt
+ * output is the same as the 'sort' command
+ * @name : the file to sort
+ * @nof  : options
+ * returns:
+ *	1 on SUCCESS
+ *	negative on error
+ */
+int subnet_file_external_sort(char *name, struct st_options *nof);
+
+#else
+#endif
@@ -33,6 +33,7 @@ void usage_en_simplify(void)
 	printf("-------------------------\n");
 	printf("sort [FILE]           : sort FILE by prefix\n");
 	printf("sortby name [FILE]    : sort FILE by (prefix|gw|mask), prefix is a tie-breaker\n");
+	printf("                        several keys can be given, like gw,mask\n");
 	printf("sortby help	      : print available sort options\n");
 	printf("subnetagg [FILE]      : sort and aggregate subnets in FILE; GW is not checked\n");
 	printf("routeagg  [FILE]      : sort and aggregate subnets in FILE; GW is checked\n");
@@ -51,6 +52,8 @@ void usage_en_routecompare(void)
 	printf("common [FILE1] [FILE2]     : merge FILE1 & FILE2; prints common routes only; GW isn't checked\n");
 	printf("addfiles [FILE1] [FILE2]   : merge FILE1 & FILE2; prints the sum of both files\n");
 	printf("grep [FILE] [prefix]       : grep FILE for prefix/mask\n");
+	printf("grep -f [PFILE] [FILE]     : grep FILE for all prefix/mask listed in PFILE\n");
+	printf("lookup [FILE] [IPFILE]     : print the route of FILE forwarding each IP of IPFILE (or stdin)\n");
 	printf("filter [FILE] [EXPR]       : grep netcsv FILE using regexp EXPR\n");
 	printf("filter help                : prints help about filters\n");
 }
@@ -80,7 +83,9 @@ void usage_en_bgp(void)
 	printf("--------------------\n");
 	printf("bgpprint [FILE]         : just read & print FILE; best used with -fmt FMT\n");
 	printf("bgpcmp [BEFORE] [AFTER] : show what changed in BGP files BEFORE and AFTER\n");
+	printf("                          use option -new to print prefixes found only in AFTER\n");
 	printf("bgpsortby [NAME] [FILE] : sort FILE by prefix, MED, etc.. prefix is a tie-breaker\n");
+	printf("                          several keys can be given, like localpref,aspath,med\n");
 	printf("bgpsortby help	        : print available sort options\n");
 	printf("bgpfilter [FILE] [EXPR] : grep FILE using regexp EXPR\n");
 	printf("bgpfilter help          : prints help about bgp filters\n");
@@ -117,7 +122,11 @@ void usage_en_options(void)
 	printf("-rt             : when converting routing table, set route type as comment\n");
 	printf("-ecmp           : when converting routing table, print all routes in case of ECMP\n");
 	printf("-noheader|-nh   : do not print netcsv header file\n");
+	printf("-new            : bgpcmp prints NEW prefixes, found only in AFTER\n");
 	printf("-grep_field <N> : grep field N only\n");
+	printf("-grep_tag       : grep prints the matching prefix before the line\n");
+	printf("-j <N>          : sort with up to N threads; output is the same whatever N\n");
+	printf("-mem <size>     : sort with an external merge sort using about <size> (K/M/G) bytes of memory\n");
 	printf("-D <debug>      : DEBUG MODE ; use '%s -D help' for more info\n", PROG_NAME);
 	printf("-fmt            : change the output format (default :%s)\n", DEFAULT_FMT);
 	printf("-V              : verbose mode; same as '-D all:1'\n");
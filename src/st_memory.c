@@ -14,6 +14,7 @@
 #include "st_memory.h"
 
 unsigned long total_memory;
+int st_skip_teardown;
 
 #ifdef DEBUG_ST_MEMORY
 void *__st_malloc_nodebug(unsigned long n, const char *desc,
@@ -196,3 +197,51 @@ void st_free(void *ptr, unsigned long len)
 }
 #else
 #endif
+
+struct st_arena_chunk {
+	struct st_arena_chunk *next;
+	unsigned long size; /* malloc'd size, header included */
+	unsigned long used;
+	char data[]; /* the header size keeps data 8 bytes aligned */
+};
+
+void st_arena_init(struct st_arena *a, unsigned long chunk_size)
+{
+	a->chunks     = NULL;
+	a->chunk_size = chunk_size;
+}
+
+void *st_arena_alloc(struct st_arena *a, unsigned long n)
+{
+	struct st_arena_chunk *c = a->chunks;
+	unsigned long size;
+	void *p;
+
+	n = (n + 7) & ~7UL;
+	if (c == NULL || c->used + n > c->size - sizeof(*c)) {
+		size = sizeof(*c) + n;
+		if (size < a->chunk_size)
+			size = a->chunk_size;
+		c = st_malloc(size, "arena chunk");
+		if (c == NULL)
+			return NULL;
+		c->size = size;
+		c->used = 0;
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+	p = c->data + c->used;
+	c->used += n;
+	return p;
+}
+
+void st_arena_free(struct st_arena *a)
+{
+	struct st_arena_chunk *c, *next;
+
+	for (c = a->chunks; c != NULL; c = next) {
+		next = c->next;
+		st_free(c, c->size);
+	}
+	a->chunks = NULL;
+}
@@ -54,5 +54,42 @@ void st_simple_memdup(const void *s, size_t len);
 
 #endif
 
+/*
+ * arena (bump) allocator, for many small objects that die together
+ * objects are carved out of big chunks allocated with st_malloc; they are
+ * never freed one by one, st_arena_free releases all of them at once
+ */
+struct st_arena_chunk;
+
+struct st_arena {
+	struct st_arena_chunk *chunks;
+	unsigned long chunk_size;
+};
+
+/* st_arena_init: init an empty arena; chunks are allocated on first use
+ * @a          : the arena
+ * @chunk_size : usual size of a chunk
+ */
+void st_arena_init(struct st_arena *a, unsigned long chunk_size);
+
+/* st_arena_alloc: allocate memory from an arena, aligned on 8 bytes
+ * @a : the arena
+ * @n : number of bytes
+ * returns:
+ *	a pointer to the memory, released by st_arena_free
+ *	NULL on ENOMEM
+ */
+void *st_arena_alloc(struct st_arena *a, unsigned long n);
+
+/* st_arena_free: release all objects of an arena, the arena can be reused
+ * @a : the arena
+ */
+void st_arena_free(struct st_arena *a);
+
+/* when set, free_subnet_file & free_ipam_file return at once; set by the CLI
+ * since files are freed right before exit, which reclaims their memory faster
+ */
+extern int st_skip_teardown;
+
 #else
 #endif
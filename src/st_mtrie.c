@@ -0,0 +1,335 @@
+/*
+ * IPv6 multibit trie (Tree Bitmap)
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "iptools.h"
+#include "st_memory.h"
+#include "st_routes_csv.h"
+#include "st_mtrie.h"
+
+/* the MTRIE_STRIDE bits of an IPv6 address starting at bit 'd', bit 0 is the most
+ * significant; bits after bit 127 are 0
+ */
+static inline int ipv6_chunk(const struct subnet *s, int d)
+{
+	uint32_t w;
+	int i = d / 16;
+
+	w = (uint32_t)block(s->ip6, i) << 16;
+	if (i < 7)
+		w |= block(s->ip6, i + 1);
+	return (w >> (32 - MTRIE_STRIDE - d % 16)) & ((1 << MTRIE_STRIDE) - 1);
+}
+
+/* number of bits set before bit 'pos' */
+static inline int bitmap_rank(uint64_t b, int pos)
+{
+	return __builtin_popcountll(b & (((uint64_t)1 << pos) - 1));
+}
+
+/* compare address then mask; prefixes are normalized */
+static int mtrie_net_cmp(const struct st_mtrie_prefix *p1, const struct st_mtrie_prefix *p2)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		if (block(p1->prefix.ip6, i) != block(p2->prefix.ip6, i))
+			return (block(p1->prefix.ip6, i) < block(p2->prefix.ip6, i) ? -1 : 1);
+	if (p1->prefix.mask != p2->prefix.mask)
+		return (p1->prefix.mask < p2->prefix.mask ? -1 : 1);
+	return 0;
+}
+
+static int mtrie_prefix_cmp(const void *v1, const void *v2)
+{
+	const struct st_mtrie_prefix *p1 = v1;
+	const struct st_mtrie_prefix *p2 = v2;
+	int res;
+
+	res = mtrie_net_cmp(p1, p2);
+	if (res)
+		return res;
+	return (p1->index > p2->index) - (p1->index < p2->index);
+}
+
+static long mtrie_alloc_nodes(struct st_mtrie *t, unsigned long n)
+{
+	struct st_mtrie_node *new_n;
+	unsigned long i, new_max;
+
+	/* child_base is 32 bits */
+	if (t->nodes_nr + n > UINT32_MAX) {
+		fprintf(stderr, "error: too many prefixes to fit in a multibit trie\n");
+		return -1;
+	}
+	if (t->nodes_nr + n > t->nodes_max) {
+		new_max = 2 * t->nodes_max;
+		while (t->nodes_nr + n > new_max)
+			new_max *= 2;
+		new_n = st_realloc(t->nodes, new_max * sizeof(struct st_mtrie_node),
+				t->nodes_max * sizeof(struct st_mtrie_node), "mtrie nodes");
+		if (new_n == NULL)
+			return -1;
+		t->nodes = new_n;
+		t->nodes_max = new_max;
+	}
+	memset(t->nodes + t->nodes_nr, 0, n * sizeof(struct st_mtrie_node));
+	i = t->nodes_nr;
+	t->nodes_nr += n;
+	return i;
+}
+
+static int mtrie_add_result(struct st_mtrie *t, const struct st_mtrie_prefix *p,
+		unsigned long lo, unsigned long hi)
+{
+	struct st_mtrie_result *new_r, *r;
+
+	if (t->results_nr == UINT32_MAX) {
+		fprintf(stderr, "error: too many prefixes to fit in a multibit trie\n");
+		return -1;
+	}
+	if (t->results_nr == t->results_max) {
+		new_r = st_realloc(t->results, 2 * t->results_max * sizeof(struct st_mtrie_result),
+				t->results_max * sizeof(struct st_mtrie_result), "mtrie results");
+		if (new_r == NULL)
+			return -1;
+		t->results = new_r;
+		t->results_max *= 2;
+	}
+	r = &t->results[t->results_nr++];
+	/* p[lo] .. p[hi - 1] share the same prefix, sorted by index */
+	r->first = p[lo].index;
+	r->last  = p[hi - 1].index;
+	r->mask  = p[lo].prefix.mask;
+	return 1;
+}
+
+/*
+ * fill node 'ni' at depth 'd' from p[lo] .. p[hi - 1]
+ * all prefixes share their 'd' first bits; those shorter than 'd' are skipped
+ */
+static int mtrie_build_node(struct st_mtrie *t, unsigned long ni, int d,
+		const struct st_mtrie_prefix *p, unsigned long lo, unsigned long hi)
+{
+	long res_lo[1 << MTRIE_STRIDE];
+	long res_hi[1 << MTRIE_STRIDE];
+	unsigned long i, j, n_child;
+	long base;
+	int prev;
+	int l, b, pos, res;
+
+	for (pos = 0; pos < (1 << MTRIE_STRIDE); pos++)
+		res_lo[pos] = -1;
+	/* internal prefixes, and number of distinct children */
+	n_child = 0;
+	for (i = lo; i < hi; i = j) {
+		for (j = i + 1; j < hi && !mtrie_net_cmp(&p[i], &p[j]); j++)
+			;
+		l = (int)p[i].prefix.mask - d;
+		if (l < 0)
+			continue;
+		b = ipv6_chunk(&p[i].prefix, d);
+		if (l < MTRIE_STRIDE) {
+			pos = (1 << l) - 1 + (b >> (MTRIE_STRIDE - l));
+			t->nodes[ni].internal |= (uint64_t)1 << pos;
+			res_lo[pos] = i;
+			res_hi[pos] = j;
+			continue;
+		}
+		if (!(t->nodes[ni].external & ((uint64_t)1 << b))) {
+			t->nodes[ni].external |= (uint64_t)1 << b;
+			n_child++;
+		}
+	}
+	t->nodes[ni].result_base = t->results_nr;
+	for (pos = 0; pos < (1 << MTRIE_STRIDE); pos++) {
+		if (res_lo[pos] == -1)
+			continue;
+		res = mtrie_add_result(t, p, res_lo[pos], res_hi[pos]);
+		if (res < 0)
+			return res;
+	}
+	if (n_child == 0)
+		return 1;
+	base = mtrie_alloc_nodes(t, n_child);
+	if (base < 0)
+		return -1;
+	t->nodes[ni].child_base = base;
+	/* children, grouped by their bits at depth d; sorted order keeps them contiguous */
+	n_child = 0;
+	for (i = lo; i < hi; i = j) {
+		if ((int)p[i].prefix.mask < d + MTRIE_STRIDE) {
+			j = i + 1;
+			continue;
+		}
+		prev = ipv6_chunk(&p[i].prefix, d);
+		for (j = i + 1; j < hi && ipv6_chunk(&p[j].prefix, d) == prev; j++)
+			;
+		res = mtrie_build_node(t, base + n_child, d + MTRIE_STRIDE, p, i, j);
+		if (res < 0)
+			return res;
+		n_child++;
+	}
+	return 1;
+}
+
+/* fill the direct table by walking the first levels for each value of the 18 first bits */
+static int mtrie_build_direct(struct st_mtrie *t)
+{
+	const struct st_mtrie_node *n;
+	unsigned long v;
+	uint32_t best;
+	int d, l, b, pos;
+
+	t->direct = st_malloc((1UL << MTRIE_DIRECT_BITS) * sizeof(struct st_mtrie_direct),
+			"mtrie direct table");
+	if (t->direct == NULL)
+		return -1;
+	for (v = 0; v < (1UL << MTRIE_DIRECT_BITS); v++) {
+		n = &t->nodes[0];
+		best = MTRIE_NONE;
+		for (d = 0; d < MTRIE_DIRECT_BITS; d += MTRIE_STRIDE) {
+			b = (v >> (MTRIE_DIRECT_BITS - MTRIE_STRIDE - d)) & ((1 << MTRIE_STRIDE) - 1);
+			for (l = MTRIE_STRIDE - 1; l >= 0; l--) {
+				pos = (1 << l) - 1 + (b >> (MTRIE_STRIDE - l));
+				if (n->internal & ((uint64_t)1 << pos)) {
+					best = n->result_base + bitmap_rank(n->internal, pos);
+					break;
+				}
+			}
+			if (!(n->external & ((uint64_t)1 << b))) {
+				n = NULL;
+				break;
+			}
+			n = &t->nodes[n->child_base + bitmap_rank(n->external, b)];
+		}
+		t->direct[v].node   = (n ? n - t->nodes : MTRIE_NONE);
+		t->direct[v].result = best;
+	}
+	return 1;
+}
+
+void free_st_mtrie(struct st_mtrie *t)
+{
+	st_free(t->nodes, t->nodes_max * sizeof(struct st_mtrie_node));
+	st_free(t->results, t->results_max * sizeof(struct st_mtrie_result));
+	if (t->direct)
+		st_free(t->direct, (1UL << MTRIE_DIRECT_BITS) * sizeof(struct st_mtrie_direct));
+	t->nodes = NULL;
+	t->results = NULL;
+	t->direct = NULL;
+	t->nodes_nr = t->nodes_max = 0;
+	t->results_nr = t->results_max = 0;
+}
+
+int st_mtrie_build(struct st_mtrie *t, struct st_mtrie_prefix *p, unsigned long n)
+{
+	unsigned long i, k = 0;
+	int res;
+
+	/* keep IPv6 prefixes only, host bits cleared */
+	for (i = 0; i < n; i++) {
+		if (p[i].prefix.ip_ver != IPV6_A)
+			continue;
+		p[k] = p[i];
+		if (p[k].prefix.mask == 0)
+			memset(&p[k].prefix.ip6, 0, sizeof(p[k].prefix.ip6));
+		else
+			first_ip(&p[k].prefix);
+		k++;
+	}
+	qsort(p, k, sizeof(struct st_mtrie_prefix), &mtrie_prefix_cmp);
+
+	t->nodes_nr = t->results_nr = 0;
+	t->nodes_max = t->results_max = 64;
+	t->direct = NULL;
+	t->nodes = st_malloc(t->nodes_max * sizeof(struct st_mtrie_node), "mtrie nodes");
+	t->results = st_malloc(t->results_max * sizeof(struct st_mtrie_result), "mtrie results");
+	if (t->nodes == NULL || t->results == NULL) {
+		if (t->nodes)
+			st_free(t->nodes, t->nodes_max * sizeof(struct st_mtrie_node));
+		if (t->results)
+			st_free(t->results, t->results_max * sizeof(struct st_mtrie_result));
+		return -1;
+	}
+	mtrie_alloc_nodes(t, 1);
+	res = mtrie_build_node(t, 0, 0, p, 0, k);
+	if (res > 0)
+		res = mtrie_build_direct(t);
+	if (res < 0) {
+		free_st_mtrie(t);
+		return res;
+	}
+	debug(LOOKUP, 3, "%lu IPv6 prefixes loaded, %lu nodes, %lu results\n",
+			k, t->nodes_nr, t->results_nr);
+	return 1;
+}
+
+int st_mtrie_load_subnet_file(struct st_mtrie *t, const struct subnet_file *sf)
+{
+	struct st_mtrie_prefix *p;
+	unsigned long i;
+	int res;
+
+	p = st_malloc((sf->nr + 1) * sizeof(struct st_mtrie_prefix), "mtrie prefixes");
+	if (p == NULL)
+		return -1;
+	for (i = 0; i < sf->nr; i++) {
+		copy_subnet(&p[i].prefix, &sf->routes[i].subnet);
+		p[i].index = i;
+	}
+	res = st_mtrie_build(t, p, sf->nr);
+	st_free(p, (sf->nr + 1) * sizeof(struct st_mtrie_prefix));
+	return res;
+}
+
+const struct st_mtrie_result *st_mtrie_lookup(const struct st_mtrie *t, const struct subnet *s)
+{
+	const struct st_mtrie_node *n;
+	const struct st_mtrie_result *best = NULL;
+	const struct st_mtrie_direct *e;
+	int d = 0, l, b, pos;
+
+	if (s->ip_ver != IPV6_A || t->nodes_nr == 0)
+		return NULL;
+	n = &t->nodes[0];
+	if (s->mask >= MTRIE_DIRECT_BITS) {
+		/* skip the first levels */
+		e = &t->direct[((uint32_t)block(s->ip6, 0) << (MTRIE_DIRECT_BITS - 16)) |
+			(block(s->ip6, 1) >> (32 - MTRIE_DIRECT_BITS))];
+		if (e->result != MTRIE_NONE)
+			best = &t->results[e->result];
+		if (e->node == MTRIE_NONE)
+			return best;
+		n = &t->nodes[e->node];
+		d = MTRIE_DIRECT_BITS;
+	}
+	while (1) {
+		b = ipv6_chunk(s, d);
+		/* longest internal prefix matching s, not longer than s */
+		l = (int)s->mask - d;
+		if (l >= MTRIE_STRIDE)
+			l = MTRIE_STRIDE - 1;
+		for (; l >= 0; l--) {
+			pos = (1 << l) - 1 + (b >> (MTRIE_STRIDE - l));
+			if (n->internal & ((uint64_t)1 << pos)) {
+				best = &t->results[n->result_base + bitmap_rank(n->internal, pos)];
+				break;
+			}
+		}
+		if (d + MTRIE_STRIDE > s->mask || !(n->external & ((uint64_t)1 << b)))
+			break;
+		n = &t->nodes[n->child_base + bitmap_rank(n->external, b)];
+		d += MTRIE_STRIDE;
+	}
+	return best;
+}
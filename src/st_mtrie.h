@@ -0,0 +1,92 @@
+#ifndef ST_MTRIE_H
+#define ST_MTRIE_H
+
+#include <stdint.h>
+#include "iptools.h"
+#include "st_routes_csv.h"
+
+/*
+ * IPv6 multibit trie (Tree Bitmap), stride 6, at most 22 levels
+ * a node covers 6 bits of the address :
+ * - internal has one bit per prefix of length 0..5 stored in the node,
+ *   bit number is (1 << len) - 1 + (value of the 'len' first bits)
+ * - external has one bit per existing child (64 possible)
+ * children of a node, and results of a node, are contiguous; the position
+ * of a child (or result) is the number of bits set before its bit
+ * with 64-bit bitmaps a node is 24 bytes, so the upper levels stay in cache
+ *
+ * the first 3 levels are also flattened in a direct table indexed by the
+ * 18 first bits of the address; it gives the node at depth 18, and the
+ * longest prefix shorter than 18 bits, in one memory access
+ */
+#define MTRIE_STRIDE 6
+#define MTRIE_DIRECT_BITS (3 * MTRIE_STRIDE)
+#define MTRIE_NONE UINT32_MAX
+
+struct st_mtrie_node {
+	uint64_t internal; /* 63 bits used */
+	uint64_t external;
+	uint32_t child_base; /* index of the first child in nodes[] */
+	uint32_t result_base; /* index of the first result in results[] */
+};
+
+struct st_mtrie_direct {
+	uint32_t node; /* node at depth MTRIE_DIRECT_BITS, MTRIE_NONE if none */
+	uint32_t result; /* longest prefix shorter than MTRIE_DIRECT_BITS, or MTRIE_NONE */
+};
+
+/* objects sharing a prefix */
+struct st_mtrie_result {
+	long first; /* index of the first object with this prefix */
+	long last;  /* index of the last object with this prefix */
+	int mask;
+};
+
+struct st_mtrie {
+	struct st_mtrie_node *nodes;
+	struct st_mtrie_result *results;
+	struct st_mtrie_direct *direct; /* 1 << MTRIE_DIRECT_BITS entries */
+	unsigned long nodes_nr, nodes_max;
+	unsigned long results_nr, results_max;
+};
+
+/* prefixes to build a trie from */
+struct st_mtrie_prefix {
+	struct subnet prefix;
+	unsigned long index;
+};
+
+/* st_mtrie_build: build a trie from 'n' IPv6 prefixes
+ * non-IPv6 prefixes are ignored; 'p' is sorted
+ * @t : the trie to build
+ * @p : the prefixes, and index of the object carrying them
+ * @n : number of prefixes
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int st_mtrie_build(struct st_mtrie *t, struct st_mtrie_prefix *p, unsigned long n);
+
+/* st_mtrie_load_subnet_file: build a trie from IPv6 routes of 'sf'
+ * index of each prefix is its route number in sf
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int st_mtrie_load_subnet_file(struct st_mtrie *t, const struct subnet_file *sf);
+
+/* free_st_mtrie: release memory attached to a trie */
+void free_st_mtrie(struct st_mtrie *t);
+
+/* st_mtrie_lookup: longest prefix including or equal to 's'
+ * use s->mask = 128 for an address lookup
+ * @t : the trie
+ * @s : an IPv6 prefix
+ * returns:
+ *	the objects carrying the longest prefix of length <= s->mask including s
+ *	NULL if none
+ */
+const struct st_mtrie_result *st_mtrie_lookup(const struct st_mtrie *t, const struct subnet *s);
+
+#else
+#endif
@@ -26,6 +26,7 @@ struct st_options {
 	int subnet_off;
 	int print_header;
 	int grep_field; /* when grepping, grep only on this field **/
+	int grep_tag; /* when grepping, print the matching query before the line */
 	int simplify_mode; /* == 0 means we print the simplified routes,
 			    * == 1 print the routes we can discard
 			    */
@@ -57,6 +58,10 @@ struct st_options {
 	/* converter options */
 	int rt; /* dynamic type as a comment */
 	int ecmp; /* print 2 routes in case of ecmp */
+	/* bgpcmp options */
+	int bgpcmp_new; /* also print prefixes found only in AFTER */
+	/* sort options */
+	unsigned long sort_mem; /* memory budget in bytes; 0 means sort in memory */
 };
 #else
 #endif
@@ -0,0 +1,127 @@
+/*
+ * exact-prefix hash index, used to join files on EQUALS prefixes in linear time
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "debug.h"
+#include "iptools.h"
+#include "st_memory.h"
+#include "st_hashtab.h"
+#include "st_prefix_hash.h"
+
+/*
+ * exact-prefix key of a subnet, host bits cleared
+ * key is memset'ed first so it can be hashed & compared with memcmp
+ */
+static void subnet_hash_key(struct subnet *key, const struct subnet *s)
+{
+	memset(key, 0, sizeof(*key));
+	key->ip_ver = s->ip_ver;
+	key->mask   = s->mask;
+	if (s->ip_ver == IPV4_A)
+		key->ip = s->ip;
+	else if (s->ip_ver == IPV6_A)
+		key->ip6 = s->ip6;
+	if (key->mask)
+		first_ip(key);
+	else
+		memset(&key->ip6, 0, sizeof(key->ip6));
+}
+
+/*
+ * hash of a key built by subnet_hash_key
+ * buckets are picked with the low bits of the hash, so ip_ver, address and
+ * mask are all mixed in and the result finalized (murmur3 fmix64); host
+ * bits are cleared, most keys only differ by a few high bits
+ */
+static unsigned int hash_prefix_key(const void *key, int len)
+{
+	const struct subnet *s = key;
+	uint64_t w[2], h;
+
+	h = ((uint64_t)s->ip_ver << 8) | s->mask;
+	if (s->ip_ver == IPV4_A) {
+		h = (h ^ ((uint64_t)s->ip << 16)) * 0x9E3779B97F4A7C15ULL;
+	} else {
+		memcpy(w, &s->ip6, sizeof(w));
+		h = (h ^ w[0]) * 0x9E3779B97F4A7C15ULL;
+		h = (h ^ w[1]) * 0x9E3779B97F4A7C15ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return (unsigned int)h;
+}
+
+void free_prefix_hash(struct prefix_hash *ph)
+{
+	if (ph->ht.tab)
+		st_free(ph->ht.tab, ph->ht.max_nr * sizeof(struct st_list));
+	st_free(ph->keys, (ph->nr + 1) * sizeof(struct subnet));
+	st_free(ph->buckets, (ph->nr + 1) * sizeof(struct st_bucket));
+	st_free(ph->next, (ph->nr + 1) * sizeof(long));
+	st_free(ph->last, (ph->nr + 1) * sizeof(long));
+	memset(ph, 0, sizeof(*ph));
+}
+
+int alloc_prefix_hash(struct prefix_hash *ph, unsigned long n)
+{
+	int res;
+
+	memset(ph, 0, sizeof(*ph));
+	ph->nr = n;
+	res = alloc_hash_tab(&ph->ht, n + 1, &hash_prefix_key);
+	if (res < 0)
+		return res;
+	ph->keys    = st_malloc((n + 1) * sizeof(struct subnet), "prefix hash keys");
+	ph->buckets = st_malloc((n + 1) * sizeof(struct st_bucket), "prefix hash buckets");
+	ph->next    = st_malloc((n + 1) * sizeof(long), "prefix hash chain");
+	ph->last    = st_malloc((n + 1) * sizeof(long), "prefix hash chain");
+	if (!ph->keys || !ph->buckets || !ph->next || !ph->last) {
+		free_prefix_hash(ph);
+		return -1;
+	}
+	return 1;
+}
+
+void prefix_hash_insert(struct prefix_hash *ph, const struct subnet *s, unsigned long index)
+{
+	struct st_bucket *b;
+	unsigned long first;
+
+	subnet_hash_key(&ph->keys[index], s);
+	ph->next[index] = -1;
+	b = find_key(&ph->ht, (char *)&ph->keys[index], sizeof(struct subnet));
+	if (b) {
+		first = b - ph->buckets;
+		ph->next[ph->last[first]] = index;
+		ph->last[first] = index;
+		return;
+	}
+	ph->last[index] = index;
+	ph->buckets[index].key     = &ph->keys[index];
+	ph->buckets[index].key_len = sizeof(struct subnet);
+	insert_bucket(&ph->ht, &ph->buckets[index]);
+}
+
+long prefix_hash_find(struct prefix_hash *ph, const struct subnet *s)
+{
+	struct subnet key;
+	struct st_bucket *b;
+
+	subnet_hash_key(&key, s);
+	b = find_key(&ph->ht, (char *)&key, sizeof(key));
+	if (b == NULL)
+		return -1;
+	return b - ph->buckets;
+}
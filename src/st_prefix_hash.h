@@ -0,0 +1,55 @@
+#ifndef ST_PREFIX_HASH_H
+#define ST_PREFIX_HASH_H
+
+#include "iptools.h"
+#include "st_hashtab.h"
+
+/*
+ * exact-prefix hash index (prefix + mask + ip_ver, host bits cleared)
+ * objects are identified by their index in the caller's array
+ * objects with the same prefix are chained in insertion order
+ * one bucket per distinct prefix, the bucket of object 'i' is buckets[i]
+ */
+struct prefix_hash {
+	struct hash_table ht;
+	struct subnet *keys;
+	struct st_bucket *buckets;
+	long *next; /* next[i] : next object with the same prefix as object i, -1 if none */
+	long *last; /* last[i] : last object of the chain starting at i */
+	unsigned long nr; /* max number of objects */
+};
+
+/* alloc_prefix_hash: alloc memory for a hash able to index n objects
+ * @ph : the prefix hash to init
+ * @n  : max number of objects
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int alloc_prefix_hash(struct prefix_hash *ph, unsigned long n);
+
+/* free_prefix_hash: release memory attached to a prefix hash
+ * @ph : the prefix hash
+ */
+void free_prefix_hash(struct prefix_hash *ph);
+
+/* prefix_hash_insert: add object 'index' with prefix 's'
+ * @ph    : the prefix hash
+ * @s     : the prefix
+ * @index : must be < n passed to alloc_prefix_hash, inserted only once
+ */
+void prefix_hash_insert(struct prefix_hash *ph, const struct subnet *s, unsigned long index);
+
+/* prefix_hash_find: find objects with a prefix EQUALS to s
+ * @ph : the prefix hash
+ * @s  : the prefix to look for
+ * returns:
+ *	index of the first object inserted with that prefix; use prefix_hash_next for others
+ *	-1 if none
+ */
+long prefix_hash_find(struct prefix_hash *ph, const struct subnet *s);
+
+#define prefix_hash_next(__ph, __i) ((__ph)->next[__i])
+
+#else
+#endif
@@ -306,8 +306,9 @@ static int __print_ea(char *outbuf, size_t buffer_len,
 	} \
 	})
 
-/* a very specialized function to print a struct route */
-static int __fprint_route_fmt(FILE *output, const struct route *r, const char *fmt, int header)
+/* a very specialized function to print a struct route into 'out' */
+static int __sprint_route_fmt(char *out, size_t len, const struct route *r,
+		const char *fmt, int header)
 {
 	int i, j, i2, compression_level;
 	int res, pad_left;
@@ -466,17 +467,28 @@ static int __fprint_route_fmt(FILE *output, const struct route *r, const char *f
 	}
 	outbuf[j++] = '\n';
 	outbuf[j] = '\0';
-	return fputs(outbuf, output);
+	return strxcpy(out, outbuf, len);
+}
+
+int sprint_route_fmt(char *out, size_t len, const struct route *r, const char *fmt)
+{
+	return __sprint_route_fmt(out, len, r, fmt, 0);
 }
 
 int fprint_route_fmt(FILE *output, const struct route *r, const char *fmt)
 {
-	return __fprint_route_fmt(output, r, fmt, 0);
+	char outbuf[1024];
+
+	__sprint_route_fmt(outbuf, sizeof(outbuf), r, fmt, 0);
+	return fputs(outbuf, output);
 }
 
 int fprint_route_header(FILE *output, const struct route *r, const char *fmt)
 {
-	return __fprint_route_fmt(output, r, fmt, 1);
+	char outbuf[1024];
+
+	__sprint_route_fmt(outbuf, sizeof(outbuf), r, fmt, 1);
+	return fputs(outbuf, output);
 }
 
 static int __fprint_ipam_fmt(FILE *output, const struct ipam_line *r,
@@ -677,9 +689,9 @@ int fprint_bgproute_fmt(FILE *output, const struct bgp_route *r, const char *fmt
 				break;
 			case 'A':
 				PRINT_FILE_HEADER(AS_PATH);
-				res = strlen(r->AS_PATH);
+				res = strlen(aspath_str(r->aspath));
 				res = pad_buffer_out(outbuf + j, sizeof(outbuf) - j - 1,
-						r->AS_PATH,
+						aspath_str(r->aspath),
 						res, field_width, pad_left, ' ');
 				j += res;
 				break;
@@ -1141,12 +1153,74 @@ void fprint_subnet_file(FILE *output, const struct subnet_file *sf, int compress
 		fprint_route(output, &sf->routes[i], compress_level);
 }
 
+/*
+ * IPv4 routes printed with DEFAULT_FMT, by far the most common output, don't
+ * need the format interpreter; returns the line length, or 0 if the line
+ * might be truncated by __sprint_route_fmt and must take the generic path
+ * out must hold 1024 bytes
+ */
+static int sprint_route_default_ipv4(char *out, const struct route *r)
+{
+	struct subnet gw;
+	int i, j, len, ea_len = 0;
+
+	for (i = 0; i < r->ea_nr; i++) {
+		if (r->ea[i].value == NULL)
+			continue;
+		len = strlen(r->ea[i].value);
+		if (len >= ST_PRINTF_MAX_STRING_SIZE)
+			return 0;
+		ea_len += len + 1;
+	}
+	len = strlen(r->device);
+	if (len + ea_len > 900)
+		return 0;
+	j = subnet2str(&r->subnet, out, 16, 3);
+	out[j++] = ';';
+	j += sprint_uint(out + j, r->subnet.mask);
+	out[j++] = ';';
+	memcpy(out + j, r->device, len);
+	j += len;
+	out[j++] = ';';
+	/* like %G, the gateway is printed in the family of the prefix */
+	copy_ipaddr(&gw.ip_addr, &r->gw);
+	gw.ip_ver = IPV4_A;
+	j += subnet2str(&gw, out + j, 16, 3);
+	out[j++] = ';';
+	for (i = 0; i < r->ea_nr; i++) {
+		if (r->ea[i].value) {
+			len = strlen(r->ea[i].value);
+			memcpy(out + j, r->ea[i].value, len);
+			j += len;
+		}
+		if (i != r->ea_nr - 1)
+			out[j++] = ';';
+	}
+	out[j++] = '\n';
+	out[j] = '\0';
+	return j;
+}
+
 void fprint_subnet_file_fmt(FILE *output, const struct subnet_file *sf, const char *fmt)
 {
+	char outbuf[64 * 1024];
 	unsigned long i;
+	int j = 0, res, ipv4_fast;
 
-	for (i = 0; i < sf->nr; i++)
-		fprint_route_fmt(output, &sf->routes[i], fmt);
+	ipv4_fast = !strcmp(fmt, DEFAULT_FMT);
+	for (i = 0; i < sf->nr; i++) {
+		if (j > sizeof(outbuf) - 1024) {
+			fwrite(outbuf, 1, j, output);
+			j = 0;
+		}
+		res = 0;
+		if (ipv4_fast && sf->routes[i].subnet.ip_ver == IPV4_A)
+			res = sprint_route_default_ipv4(outbuf + j, &sf->routes[i]);
+		if (res == 0)
+			res = __sprint_route_fmt(outbuf + j, 1024, &sf->routes[i], fmt, 0);
+		j += res;
+	}
+	fwrite(outbuf, 1, j, output);
 }
 
 void print_subnet_file(const struct subnet_file *sf, int compress_level)
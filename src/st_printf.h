@@ -14,6 +14,11 @@ void fprint_route(FILE *output, const struct route *r, int compress_level);
  * print struct route 'r' with format 'fmt' to 'output'
  */
 int fprint_route_fmt(FILE *output, const struct route *r, const char *fmt);
+/*
+ * same, into buffer 'out' of size 'len', '\n' included
+ * returns the length of the formatted route, truncated if >= len
+ */
+int sprint_route_fmt(char *out, size_t len, const struct route *r, const char *fmt);
 int fprint_route_header(FILE *output, const struct route *r, const char *fmt);
 
 /*
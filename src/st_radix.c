@@ -0,0 +1,357 @@
+/*
+ * LSD radix sort of fixed-width keys
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "iptools.h"
+#include "st_memory.h"
+#include "st_sort.h"
+#include "st_radix.h"
+
+#define RADIX_BITS	16
+#define RADIX_SIZE	(1 << RADIX_BITS)
+/* inputs made of up to that many segments are merged, not radix sorted */
+#define RADIX_MAX_RUNS	16
+/* shorter natural runs are grouped in segments radix sorted on their own */
+#define RADIX_MIN_RUN	1024
+
+struct radix_job {
+	const uint64_t *src;
+	uint64_t *dst;
+	unsigned long lo, hi;
+	unsigned long *count; /* RADIX_SIZE counters for src[lo, hi) */
+	int stride, w, shift;
+};
+
+static void *radix_count_job(void *v)
+{
+	struct radix_job *j = v;
+	unsigned long i;
+
+	memset(j->count, 0, RADIX_SIZE * sizeof(unsigned long));
+	for (i = j->lo; i < j->hi; i++)
+		j->count[(j->src[i * j->stride + j->w] >> j->shift) & (RADIX_SIZE - 1)]++;
+	return NULL;
+}
+
+static void *radix_scatter_job(void *v)
+{
+	struct radix_job *j = v;
+	unsigned long i;
+	unsigned int d;
+
+	for (i = j->lo; i < j->hi; i++) {
+		d = (j->src[i * j->stride + j->w] >> j->shift) & (RADIX_SIZE - 1);
+		memcpy(j->dst + j->count[d]++ * j->stride, j->src + i * j->stride,
+				j->stride * sizeof(uint64_t));
+	}
+	return NULL;
+}
+
+/* sort items of 'stride' words on their first 'nw' words
+ * bits of the last key word below 'lo_bit' are not part of the key
+ */
+static int __radix_sort(uint64_t *items, unsigned long n, int nw, int stride, int lo_bit)
+{
+	struct radix_job jobs[ST_SORT_MAX_THREADS];
+	uint64_t *tmp, *src, *dst, *swap;
+	unsigned long *count;
+	unsigned long sum, c;
+	int w, shift, passes = 0;
+	int t, k;
+	unsigned int d, d0;
+
+	if (n < 2)
+		return 1;
+	/* each thread counts and moves its own chunk; offsets are computed so that
+	 * chunk k items go after chunk k - 1 items with the same digit, keeping
+	 * the sort stable whatever the number of threads
+	 */
+	t = st_sort_threads;
+	if (t > ST_SORT_MAX_THREADS)
+		t = ST_SORT_MAX_THREADS;
+	if (n / ST_SORT_MIN_CHUNK < t)
+		t = n / ST_SORT_MIN_CHUNK;
+	if (t < 1)
+		t = 1;
+	tmp = st_malloc(n * stride * sizeof(uint64_t), "radix buffer");
+	if (tmp == NULL)
+		return -1;
+	count = st_malloc(t * RADIX_SIZE * sizeof(unsigned long), "radix count");
+	if (count == NULL) {
+		st_free(tmp, n * stride * sizeof(uint64_t));
+		return -1;
+	}
+	for (k = 0; k < t; k++) {
+		jobs[k].lo     = n * k / t;
+		jobs[k].hi     = n * (k + 1) / t;
+		jobs[k].count  = count + k * RADIX_SIZE;
+		jobs[k].stride = stride;
+	}
+	src = items;
+	dst = tmp;
+	for (w = nw - 1; w >= 0; w--) {
+		for (shift = (w == nw - 1 ? lo_bit : 0); shift < 64; shift += RADIX_BITS) {
+			for (k = 0; k < t; k++) {
+				jobs[k].src   = src;
+				jobs[k].dst   = dst;
+				jobs[k].w     = w;
+				jobs[k].shift = shift;
+			}
+			st_parallel_run(radix_count_job, jobs, t, sizeof(struct radix_job));
+			/* same digit everywhere, nothing to do */
+			d0 = (src[w] >> shift) & (RADIX_SIZE - 1);
+			sum = 0;
+			for (k = 0; k < t; k++)
+				sum += jobs[k].count[d0];
+			if (sum == n)
+				continue;
+			sum = 0;
+			for (d = 0; d < RADIX_SIZE; d++) {
+				for (k = 0; k < t; k++) {
+					c = jobs[k].count[d];
+					jobs[k].count[d] = sum;
+					sum += c;
+				}
+			}
+			st_parallel_run(radix_scatter_job, jobs, t, sizeof(struct radix_job));
+			swap = src;
+			src  = dst;
+			dst  = swap;
+			passes++;
+		}
+	}
+	if (src != items)
+		memcpy(items, src, n * stride * sizeof(uint64_t));
+	debug(TIMING, 3, "%lu items sorted in %d passes with %d threads\n", n, passes, t);
+	st_free(count, t * RADIX_SIZE * sizeof(unsigned long));
+	st_free(tmp, n * stride * sizeof(uint64_t));
+	return 1;
+}
+
+int radix_sort_items(uint64_t *items, unsigned long n, int nw)
+{
+	return __radix_sort(items, n, nw, nw + 1, 0);
+}
+
+/*
+ * one word keys are often short, like IPv4 prefixes (40 bits); if the value
+ * fits in the unused low bits, items are packed in place in one word and
+ * sorted on the key bits only: half the memory moved at each pass
+ * returns 0 if keys & values don't fit, and items are left untouched
+ */
+static int radix_sort_packed(uint64_t *items, unsigned long n, unsigned long *order)
+{
+	uint64_t kmax = 0, vmax = 0;
+	unsigned long i;
+	int b = 1, res;
+
+	for (i = 0; i < n; i++) {
+		kmax |= items[2 * i];
+		vmax |= items[2 * i + 1];
+	}
+	while (b < 64 && (vmax >> b))
+		b++;
+	if (b >= 64 || (kmax >> (64 - b)))
+		return 0;
+	for (i = 0; i < n; i++)
+		items[i] = (items[2 * i] << b) | items[2 * i + 1];
+	debug(TIMING, 3, "%lu items packed, %d bits values\n", n, b);
+	res = __radix_sort(items, n, 1, 1, b);
+	if (res < 0)
+		return res;
+	for (i = 0; i < n; i++)
+		order[i] = items[i] & ((1UL << b) - 1);
+	return 1;
+}
+
+static inline int item_is_before(const uint64_t *a, const uint64_t *b, int nw)
+{
+	int w;
+
+	for (w = 0; w < nw; w++)
+		if (a[w] != b[w])
+			return a[w] < b[w];
+	return 0;
+}
+
+/*
+ * stable merge of 'runs' sorted runs of items, run r is [bound[r], bound[r + 1])
+ * runs are merged two by two, so it costs log2(runs) passes
+ */
+static int merge_item_runs(uint64_t *items, unsigned long n, int nw,
+		unsigned long *bound, int runs)
+{
+	uint64_t *tmp, *src, *dst, *swap;
+	unsigned long a, a1, b, b1, k;
+	int r, stride = nw + 1;
+	size_t sz = stride * sizeof(uint64_t);
+
+	tmp = st_malloc(n * sz, "merge buffer");
+	if (tmp == NULL)
+		return -1;
+	src = items;
+	dst = tmp;
+	while (runs > 1) {
+		for (r = 0; r < runs; r += 2) {
+			a  = bound[r];
+			a1 = bound[r + 1];
+			if (r + 1 == runs) {
+				/* odd run out */
+				memcpy(dst + a * stride, src + a * stride, (a1 - a) * sz);
+				break;
+			}
+			b  = a1;
+			b1 = bound[r + 2];
+			k  = a;
+			while (a < a1 && b < b1) {
+				if (item_is_before(src + b * stride, src + a * stride, nw))
+					memcpy(dst + k++ * stride, src + b++ * stride, sz);
+				else
+					memcpy(dst + k++ * stride, src + a++ * stride, sz);
+			}
+			memcpy(dst + k * stride, src + a * stride, (a1 - a) * sz);
+			k += a1 - a;
+			memcpy(dst + k * stride, src + b * stride, (b1 - b) * sz);
+		}
+		for (r = 0; 2 * r < runs; r++)
+			bound[r] = bound[2 * r];
+		bound[r] = n;
+		runs = r;
+		swap = src;
+		src  = dst;
+		dst  = swap;
+	}
+	if (src != items)
+		memcpy(items, src, n * sz);
+	st_free(tmp, n * sz);
+	return 1;
+}
+
+int radix_prefix_order(const void *base, unsigned long n, size_t size, size_t offset,
+		unsigned long *order)
+{
+	const struct subnet *s;
+	uint64_t *items, *k;
+	unsigned long i;
+	int nw = 1, stride, res;
+
+	for (i = 0; i < n; i++) {
+		s = (const struct subnet *)((const char *)base + i * size + offset);
+		if (s->ip_ver != IPV4_A) {
+			nw = 4;
+			break;
+		}
+	}
+	stride = nw + 1;
+	items = st_malloc(n * stride * sizeof(uint64_t), "radix keys");
+	if (items == NULL)
+		return -1;
+	for (i = 0; i < n; i++) {
+		s = (const struct subnet *)((const char *)base + i * size + offset);
+		k = items + i * stride;
+		if (nw == 1) {
+			/* IPv4 only, address and mask fit in 40 bits */
+			k[0] = ((uint64_t)s->ip << 8) | s->mask;
+		} else {
+			k[0] = (unsigned int)s->ip_ver;
+			if (s->ip_ver == IPV6_A) {
+				k[1] = ((uint64_t)block(s->ip6, 0) << 48) |
+					((uint64_t)block(s->ip6, 1) << 32) |
+					((uint64_t)block(s->ip6, 2) << 16) | block(s->ip6, 3);
+				k[2] = ((uint64_t)block(s->ip6, 4) << 48) |
+					((uint64_t)block(s->ip6, 5) << 32) |
+					((uint64_t)block(s->ip6, 6) << 16) | block(s->ip6, 7);
+			} else if (s->ip_ver == IPV4_A) {
+				k[1] = 0;
+				k[2] = s->ip;
+			} else {
+				k[1] = k[2] = 0;
+			}
+			k[3] = s->mask;
+		}
+		k[nw] = i;
+	}
+	res = radix_order_items(items, n, nw, order);
+	st_free(items, n * stride * sizeof(uint64_t));
+	return res;
+}
+
+int radix_order_items(uint64_t *items, unsigned long n, int nw, unsigned long *order)
+{
+	unsigned long bound[RADIX_MAX_RUNS + 1], rs;
+	int sorted[RADIX_MAX_RUNS];
+	int segs, g, pending;
+	unsigned long i;
+	int stride = nw + 1, res;
+
+	/* look for natural runs; input is often the output of another command
+	 * long runs are kept, short ones are grouped in segments to radix sort;
+	 * then all segments are merged
+	 */
+	bound[0] = 0;
+	segs = 0;
+	pending = 0;
+	rs = 0;
+	for (i = 1; i <= n && segs < RADIX_MAX_RUNS; i++) {
+		if (i < n && !item_is_before(items + i * stride, items + (i - 1) * stride, nw))
+			continue;
+		/* [rs, i) is a natural run */
+		if (i - rs >= RADIX_MIN_RUN || i - rs == n) {
+			if (pending) {
+				sorted[segs++] = 0;
+				bound[segs] = rs;
+				pending = 0;
+			}
+			if (segs == RADIX_MAX_RUNS)
+				break;
+			sorted[segs++] = 1;
+			bound[segs] = i;
+		} else {
+			/* mostly unsorted, merging would not save much */
+			if (i - bound[segs] > n / 4)
+				break;
+			pending = 1;
+		}
+		rs = i;
+	}
+	if (pending && segs < RADIX_MAX_RUNS) {
+		sorted[segs++] = 0;
+		bound[segs] = n;
+	}
+	if (bound[segs] != n || (segs == 1 && !sorted[0])) {
+		if (nw == 1) {
+			res = radix_sort_packed(items, n, order);
+			if (res)
+				return res;
+		}
+		res = radix_sort_items(items, n, nw);
+	} else if (segs <= 1) {
+		for (i = 0; i < n; i++)
+			order[i] = items[i * stride + nw];
+		debug(TIMING, 3, "%lu items already sorted\n", n);
+		return 0;
+	} else {
+		debug(TIMING, 3, "%lu items in %d segments, merging\n", n, segs);
+		res = 1;
+		for (g = 0; g < segs && res > 0; g++)
+			if (!sorted[g])
+				res = radix_sort_items(items + bound[g] * stride,
+						bound[g + 1] - bound[g], nw);
+		if (res > 0)
+			res = merge_item_runs(items, n, nw, bound, segs);
+	}
+	if (res < 0)
+		return res;
+	for (i = 0; i < n; i++)
+		order[i] = items[i * stride + nw];
+	return 1;
+}
@@ -0,0 +1,60 @@
+#ifndef ST_RADIX_H
+#define ST_RADIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * radix_sort_items: stable LSD radix sort of 'n' items
+ * an item is 'nw' 64-bit key words, most significant first, followed by
+ * one 64-bit value (usually the index of the object carrying the key)
+ * keys are sorted 16 bits at a time; digits equal for all items are skipped,
+ * so sorting 40 bits keys costs 3 passes whatever 'nw' is
+ * up to st_sort_threads threads are used; the result doesn't depend on it
+ * @items : n * (nw + 1) 64-bit words
+ * @n     : number of items
+ * @nw    : number of key words
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int radix_sort_items(uint64_t *items, unsigned long n, int nw);
+
+/*
+ * radix_order_items: stable order of 'n' items, same layout as radix_sort_items
+ * sorted input is detected in O(n); input made of a few sorted runs (like
+ * concatenated sorted files) is merged instead of radix sorted
+ * one word keys that leave room for the value are packed with it and sorted
+ * as one word items
+ * items are sorted in place, or destroyed if they were packed
+ * @items : n * (nw + 1) 64-bit words
+ * @n     : number of items
+ * @nw    : number of key words
+ * @order : n indexes; order[i] is the value word of the i-th item in sorted order
+ * returns:
+ *	1  on SUCCESS
+ *	0  if items were already sorted
+ *	-1 on ENOMEM
+ */
+int radix_order_items(uint64_t *items, unsigned long n, int nw, unsigned long *order);
+
+/*
+ * radix_prefix_order: compute the stable prefix order of an array of objects
+ * each object embeds a 'struct subnet' at offset 'offset'
+ * order is IP version, then address (host bits included), then mask
+ * this is the order of subnet_is_superior(), but stable; see radix_order_items
+ * @base   : the array of objects
+ * @n      : number of objects
+ * @size   : size of one object
+ * @offset : offset of the 'struct subnet' inside an object
+ * @order  : n indexes; order[i] is the index of the i-th object in sorted order
+ * returns:
+ *	1  on SUCCESS
+ *	0  if objects were already sorted (order is the identity)
+ *	-1 on ENOMEM
+ */
+int radix_prefix_order(const void *base, unsigned long n, size_t size, size_t offset,
+		unsigned long *order);
+
+#else
+#endif
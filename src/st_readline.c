@@ -13,7 +13,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include "debug.h"
 #include "st_readline.h"
 
 //#define DEBUG_READ
@@ -28,6 +35,33 @@ int read_debug_level = 5;
 #define debug_read(level, FMT...)
 #endif
 
+#define RA_CHUNKS 4
+/* a mapped file is released by chunks of MAP_DROP_SIZE bytes, page aligned */
+#define MAP_DROP_SIZE (1 << 20)
+
+/*
+ * ring of RA_CHUNKS buffers; the read-ahead thread fills chunk
+ * (head % RA_CHUNKS), the parser consumes chunk (tail % RA_CHUNKS)
+ * a chunk is owned by the parser from when head moves past it until tail does
+ */
+struct st_readahead {
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;     /* a chunk was filled or released */
+	int fileno;
+	int chunk_size;
+	char *chunk[RA_CHUNKS];
+	int len[RA_CHUNKS];      /* number of bytes in a filled chunk */
+	unsigned long head;      /* number of chunks filled */
+	unsigned long tail;      /* number of chunks consumed */
+	int pos;                 /* parser offset in chunk (tail % RA_CHUNKS) */
+	int eof;                 /* no more chunk will be filled */
+	int error;
+	int stop;                /* the file is being closed */
+	unsigned long waits;     /* number of times the parser waited for input */
+	struct timeval stalled;  /* total time the parser waited for input */
+};
+
 struct st_file *st_open(const char *name, int buffer_size)
 {
 	int a;
@@ -61,11 +95,212 @@ struct st_file *st_open(const char *name, int buffer_size)
 	f->bp           = f->buffer;
 	f->fileno       = a;
 	f->bytes        = 0;
+	f->map          = NULL;
+	f->map_size     = 0;
+	f->map_drop     = NULL;
+	f->ra           = NULL;
+	return f;
+}
+
+static void readahead_unlock(void *arg)
+{
+	struct st_readahead *ra = arg;
+
+	pthread_mutex_unlock(&ra->lock);
+}
+
+static void *readahead_thread(void *arg)
+{
+	struct st_readahead *ra = arg;
+	int n, stop;
+
+	while (1) {
+		/* the thread may be cancelled while waiting, don't keep the lock */
+		pthread_mutex_lock(&ra->lock);
+		pthread_cleanup_push(readahead_unlock, ra);
+		while (ra->head - ra->tail == RA_CHUNKS && !ra->stop)
+			pthread_cond_wait(&ra->cond, &ra->lock);
+		stop = ra->stop;
+		pthread_cleanup_pop(1);
+		if (stop)
+			return NULL;
+		/* publish what each read returns, so pipes still stream */
+		n = read(ra->fileno, ra->chunk[ra->head % RA_CHUNKS], ra->chunk_size);
+		pthread_mutex_lock(&ra->lock);
+		if (n > 0) {
+			ra->len[ra->head % RA_CHUNKS] = n;
+			ra->head++;
+		} else {
+			ra->eof   = 1;
+			ra->error = (n < 0);
+		}
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+		if (n <= 0)
+			return NULL;
+	}
+}
+
+static void readahead_free(struct st_readahead *ra)
+{
+	int i;
+
+	for (i = 0; i < RA_CHUNKS; i++)
+		free(ra->chunk[i]);
+	free(ra);
+}
+
+/* readahead_start: start a read-ahead thread on a file
+ * @f : the file
+ * returns:
+ *	1 on SUCCESS
+ *	-1 on error; f is left untouched and read with read()
+ */
+static int readahead_start(struct st_file *f)
+{
+	struct st_readahead *ra;
+	int i;
+
+	ra = malloc(sizeof(struct st_readahead));
+	if (ra == NULL)
+		return -1;
+	memset(ra, 0, sizeof(struct st_readahead));
+	ra->fileno     = f->fileno;
+	ra->chunk_size = f->buffer_size / 2; /* what refill asks for */
+	for (i = 0; i < RA_CHUNKS; i++) {
+		ra->chunk[i] = malloc(ra->chunk_size);
+		if (ra->chunk[i] == NULL) {
+			readahead_free(ra);
+			return -1;
+		}
+	}
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	if (pthread_create(&ra->tid, NULL, readahead_thread, ra)) {
+		pthread_mutex_destroy(&ra->lock);
+		pthread_cond_destroy(&ra->cond);
+		readahead_free(ra);
+		return -1;
+	}
+	f->ra = ra;
+	return 1;
+}
+
+static void readahead_stop(struct st_readahead *ra)
+{
+	pthread_mutex_lock(&ra->lock);
+	ra->stop = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+	/* the writer may still be writing, don't wait for EOF */
+	pthread_cancel(ra->tid);
+	pthread_join(ra->tid, NULL);
+	debug(TIMING, 2, "%lu chunks read, parser waited %lu times for input, %lu sec %lu millisec\n",
+			ra->head, ra->waits,
+			(unsigned long)ra->stalled.tv_sec,
+			(unsigned long)ra->stalled.tv_usec / 1000);
+	pthread_mutex_destroy(&ra->lock);
+	pthread_cond_destroy(&ra->cond);
+	readahead_free(ra);
+}
+
+/* readahead_read: copy up to 'size' bytes of input filled by the read-ahead thread
+ * like read(), waits only if no byte is available
+ * @ra   : the read-ahead ring
+ * @buf  : where to copy
+ * @size : number of bytes wanted
+ * returns:
+ *	number of bytes copied
+ *	0 on EOF
+ *	-1 on error
+ */
+static int readahead_read(struct st_readahead *ra, char *buf, int size)
+{
+	struct timeval t1, t2;
+	int c, l, n = 0;
+
+	pthread_mutex_lock(&ra->lock);
+	while (n < size) {
+		if (ra->head == ra->tail) {
+			if (ra->eof || n)
+				break;
+			gettimeofday(&t1, NULL);
+			while (ra->head == ra->tail && !ra->eof)
+				pthread_cond_wait(&ra->cond, &ra->lock);
+			gettimeofday(&t2, NULL);
+			timersub(&t2, &t1, &t1);
+			timeradd(&ra->stalled, &t1, &ra->stalled);
+			ra->waits++;
+			continue;
+		}
+		c = ra->tail % RA_CHUNKS;
+		l = ra->len[c] - ra->pos;
+		if (l > size - n)
+			l = size - n;
+		/* the chunk is ours until tail moves */
+		pthread_mutex_unlock(&ra->lock);
+		memcpy(buf + n, ra->chunk[c] + ra->pos, l);
+		pthread_mutex_lock(&ra->lock);
+		n       += l;
+		ra->pos += l;
+		if (ra->pos == ra->len[c]) {
+			ra->pos = 0;
+			ra->tail++;
+			pthread_cond_broadcast(&ra->cond);
+		}
+	}
+	if (n == 0 && ra->error)
+		n = -1;
+	pthread_mutex_unlock(&ra->lock);
+	return n;
+}
+
+struct st_file *st_open_mmap(const char *name, int buffer_size)
+{
+	struct st_file *f;
+	struct stat st;
+	void *map;
+
+	f = st_open(name, buffer_size);
+	if (f == NULL)
+		return NULL;
+	if (fstat(f->fileno, &st) < 0)
+		return f;
+	/* pipes & sockets are read in the background */
+	if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)) {
+		if (readahead_start(f) < 0)
+			debug_read(1, "cannot start read-ahead thread, using read()\n");
+		return f;
+	}
+	/* terminals & empty files are read with read() */
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+		return f;
+	if ((unsigned long long)st.st_size > SIZE_MAX)
+		return f;
+	/* stdin may have been read already */
+	if (lseek(f->fileno, 0, SEEK_CUR) != 0)
+		return f;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, f->fileno, 0);
+	if (map == MAP_FAILED) {
+		debug_read(1, "cannot map file, using read()\n");
+		return f;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	f->map      = map;
+	f->map_size = st.st_size;
+	f->map_drop = map;
+	f->bp       = map;
+	f->bytes    = st.st_size;
+	f->endoffile = 1;
 	return f;
 }
 
 void st_close(struct st_file *f)
 {
+	if (f->map)
+		munmap(f->map, f->map_size);
+	if (f->ra)
+		readahead_stop(f->ra);
 	if (f->fileno) /* don't 'close' stdin */
 		close(f->fileno);
 	free(f->buffer);
@@ -89,7 +324,10 @@ static int refill(struct st_file *f)
 		memcpy(f->buffer, f->bp, f->bytes);
 		f->bp = f->buffer;
 	}
-	i = read(f->fileno, f->bp + f->bytes, size);
+	if (f->ra)
+		i = readahead_read(f->ra, f->bp + f->bytes, size);
+	else
+		i = read(f->fileno, f->bp + f->bytes, size);
 	if (i < 0)
 		return i;
 	if (i == 0) {
@@ -114,7 +352,7 @@ static void discard_bytes(struct st_file *f)
 		if (i < 0) /* IO/error */
 			return;
 		t = memchr(f->bp, '\n', f->bytes);
-		if (t != NULL || f->endoffile) {
+		if (t != NULL) {
 			len = t - f->bp;
 			discarded += len;
 			debug_read(5, "Trunc discarding %d chars\n", discarded);
@@ -122,15 +360,79 @@ static void discard_bytes(struct st_file *f)
 			f->bp += (len + 1);
 			break;
 		}
+		if (f->endoffile) {
+			f->bp   += f->bytes;
+			f->bytes = 0;
+			break;
+		}
 		discarded += f->bytes;
 		f->bp     += f->bytes;
 		f->bytes = 0;
 	}
 }
 
+/* fill_line: refill the buffer until it holds a full line, more than
+ * 'size' chars, or the end of file; a pipe may hand a line in many reads
+ * @f    : a pointer to a struct file
+ * @size : max line length, without the NUL char
+ * returns:
+ *	pointer to the newline, NULL if there is none
+ *	(void *)-1 on error
+ */
+static char *fill_line(struct st_file *f, size_t size)
+{
+	char *t;
+	unsigned long searched = 0;
+
+	while (1) {
+		t = memchr(f->bp + searched, '\n', f->bytes - searched);
+		if (t != NULL || f->bytes > size || f->endoffile)
+			return t;
+		searched = f->bytes;
+		if (refill(f) < 0)
+			return (void *)-1;
+	}
+}
+
+/* map_getline: get the next line of a mapped file, without its newline
+ * @f         : a mapped struct file
+ * @size      : keep at most size - 1 chars
+ * @len       : pointer to the length of the line, after truncation
+ * @discarded : number of discarded chars
+ * returns:
+ *	pointer to the line inside the mapping (NOT NUL terminated)
+ *	NULL on EOF
+ */
+static char *map_getline(struct st_file *f, size_t size, int *len, int *discarded)
+{
+	char *t, *p = f->bp;
+	unsigned long l;
+
+	if (f->bytes == 0)
+		return NULL;
+	t = memchr(p, '\n', f->bytes);
+	l = (t ? t - p : f->bytes);
+	f->bp    += (t ? l + 1 : l);
+	f->bytes -= (t ? l + 1 : l);
+	/* mapped pages count in RSS, release the ones already parsed */
+	if (p - f->map_drop >= MAP_DROP_SIZE) {
+		madvise(f->map_drop, MAP_DROP_SIZE, MADV_DONTNEED);
+		f->map_drop += MAP_DROP_SIZE;
+	}
+	size--; /* same truncation as st_getline_truncate, that keeps room for NUL */
+	if (l > size) {
+		debug_read(8, "Trunc discarding %lu chars\n", l - size);
+		*discarded = l - size;
+		l = size;
+	} else
+		*discarded = 0;
+	*len = l;
+	return p;
+}
+
 char *st_getline_truncate(struct st_file *f, size_t size, int *read, int *discarded)
 {
-	int i, len;
+	int len;
 	char *t, *p;
 
 	if (size < 2)
@@ -140,21 +442,27 @@ char *st_getline_truncate(struct st_file *f, size_t size, int *read, int *discar
 			__func__, (int)size, f->buffer_size);
 		return NULL;
 	}
+	if (f->map) {
+		p = map_getline(f, size, &len, discarded);
+		if (p == NULL) {
+			*read = 0;
+			return NULL;
+		}
+		/* callers may modify the line, the mapping is R/O */
+		memcpy(f->buffer, p, len);
+		f->buffer[len] = '\0';
+		*read = len + 1;
+		return f->buffer;
+	}
 	size--; /* for NUL char */
 	if (f->need_discard) {
 		discard_bytes(f);
 		f->need_discard = 0;
 	}
-	/** need to refill buffer or not **/
-	if (f->bytes <= size) {
-		i = refill(f);
-		if (i < 0)
-			return NULL;
-		if (i == 0)
-			size = f->bytes;
-	}
+	t = fill_line(f, size);
+	if (t == (void *)-1)
+		return NULL;
 	p = f->bp;
-	t = memchr(p, '\n', f->bytes);
 	/* if we found a newline within 'size' char lets return */
 	if (t != NULL) {
 		debug_read(8, "GOOD: len = %d bytes=%d\n", t - f->bp, f->bytes);
@@ -179,19 +487,25 @@ char *st_getline_truncate(struct st_file *f, size_t size, int *read, int *discar
 		return p;
 	}
 	/* no newline found */
-	p[size] = '\0';
-	size++;
-	f->bp    += size;
-	f->bytes -= size;
 	if (f->endoffile) {
-		*discarded = 0;
-		if  (size == 1) {
+		/* last line, without a newline */
+		if (f->bytes == 0) {
 			*read = 0;
 			return NULL;
 		}
-		*read = size;
+		len = (f->bytes > size ? size : f->bytes);
+		p[len] = '\0';
+		*discarded = f->bytes - len;
+		*read = len + 1;
+		f->bp   += f->bytes;
+		f->bytes = 0;
 		return p;
 	}
+	/* line too long */
+	p[size] = '\0';
+	size++;
+	f->bp    += size;
+	f->bytes -= size;
 	*read = size;
 	debug_read(3, "Need discard#2 : %d\n", f->bytes);
 	*discarded = f->bytes + 1; /* at least */
@@ -199,10 +513,27 @@ char *st_getline_truncate(struct st_file *f, size_t size, int *read, int *discar
 	return p;
 }
 
+const char *st_getline_slice(struct st_file *f, size_t size, int *len, int *discarded)
+{
+	char *s;
+	int read;
+
+	if (f->map == NULL) {
+		s = st_getline_truncate(f, size, &read, discarded);
+		if (s == NULL)
+			return NULL;
+		*len = read - 1;
+		return s;
+	}
+	if (size < 2)
+		return NULL;
+	return map_getline(f, size, len, discarded);
+}
+
 char *st_gets_truncate(struct st_file *f, char *buffer, size_t size,
 		int *read, int *discarded)
 {
-	int i, len;
+	int len;
 	char *t, *p;
 
 	if (size < 2)
@@ -212,17 +543,22 @@ char *st_gets_truncate(struct st_file *f, char *buffer, size_t size,
 			__func__, (int)size, f->buffer_size);
 		return NULL;
 	}
-	size--; /* for NUL char */
-	/** need to refill buffer or not **/
-	if (f->bytes <= size) {
-		i = refill(f);
-		if (i < 0)
+	if (f->map) {
+		p = map_getline(f, size, &len, discarded);
+		if (p == NULL) {
+			*read = 0;
 			return NULL;
-		if (i == 0)
-			size = f->bytes;
+		}
+		memcpy(buffer, p, len);
+		buffer[len] = '\0';
+		*read = len + 1;
+		return buffer;
 	}
+	size--; /* for NUL char */
+	t = fill_line(f, size);
+	if (t == (void *)-1)
+		return NULL;
 	p = f->bp;
-	t = memchr(p, '\n', f->bytes);
 	/* if we found a newline within 'size' char lets return */
 	if (t != NULL) {
 		debug_read(8, "GOOD: len = %d bytes=%d\n", t - f->bp, f->bytes);
@@ -249,20 +585,26 @@ char *st_gets_truncate(struct st_file *f, char *buffer, size_t size,
 		return buffer;
 	}
 	/* no newline found */
-	p[size] = '\0';
-	size++;
-	f->bp    += size;
-	f->bytes -= size;
 	if (f->endoffile) {
-		*discarded = 0;
-		if  (size == 1) {
+		/* last line, without a newline */
+		if (f->bytes == 0) {
 			*read = 0;
 			return NULL;
 		}
-		*read = size;
-		memcpy(buffer, p, size);
+		len = (f->bytes > size ? size : f->bytes);
+		memcpy(buffer, p, len);
+		buffer[len] = '\0';
+		*discarded = f->bytes - len;
+		*read = len + 1;
+		f->bp   += f->bytes;
+		f->bytes = 0;
 		return buffer;
 	}
+	/* line too long */
+	p[size] = '\0';
+	size++;
+	f->bp    += size;
+	f->bytes -= size;
 	*read = size;
 	debug_read(3, "Need discard#2 : %d\n", f->bytes);
 	*discarded = f->bytes + 1; /* at least */
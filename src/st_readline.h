@@ -9,6 +9,10 @@ struct st_file {
 	char *buffer; /* dynamic pointer (malloc'ed) */
 	char *bp; /* current pointer */
 	int buffer_size;
+	char *map; /* file mapping, NULL if read with read() */
+	size_t map_size;
+	char *map_drop; /* mapped pages below map_drop have been released */
+	struct st_readahead *ra; /* read-ahead thread, NULL if none */
 };
 
 
@@ -21,6 +25,22 @@ struct st_file {
  */
 struct st_file *st_open(const char *name, int buffer_size);
 
+/* st_open_mmap: open a file R/O, mapping it in memory if possible
+ * regular files are mapped and lines are read straight from the mapping;
+ * pipes and sockets are read by a read-ahead thread filling a ring of
+ * buffers while the caller parses, so the writer (zcat...) and the parser
+ * run in parallel; time the parser waited for input is reported with
+ * '-D timing:2'
+ * terminals and empty files are read with read() like st_open
+ * all st_getline* functions work on all of them
+ * @name : name of the file; if NULL, use stdin
+ * @buffer_size : size of internal buffer
+ * returns:
+ *	pointer to malloc struct on SUCCESS
+ *	NULL on error (cannot access file, or malloc failure)
+ */
+struct st_file *st_open_mmap(const char *name, int buffer_size);
+
 /* st_close: release resources attached to a st_file
  * @f : a pointer to a struct st_file
  */
@@ -39,6 +59,20 @@ void st_close(struct st_file *f);
  */
 char *st_getline_truncate(struct st_file *f, size_t size, int *read, int *discarded);
 
+/* st_getline_slice: read one line from a file, truncate if line too long
+ * same truncation as st_getline_truncate, but the line is NOT NUL terminated
+ * and must not be modified; on a mapped file, it points inside the mapping
+ * and no byte is copied; the line is valid until the next read
+ * @f         : struct file
+ * @size      : read at most size - 1 char on each line; must be < buffer_size / 4
+ * @len       : pointer to the length of the line (without the newline)
+ * @discarded : number of discarded chars (not always precise)
+ * returns:
+ *	pointer to the line
+ *	NULL on error or EOF
+ */
+const char *st_getline_slice(struct st_file *f, size_t size, int *len, int *discarded);
+
 /* st_gets_truncate: read one line from a file, truncate if line too long
  * if strlen(line) > size, chars are DISCARDED until a NEWLINE is found
  * As opposed to st_getline_truncate, store line in a user provided buffer
@@ -0,0 +1,321 @@
+/*
+ * columnar view of route files, used by sort and compare kernels
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "debug.h"
+#include "iptools.h"
+#include "st_memory.h"
+#include "st_hashtab.h"
+#include "st_radix.h"
+#include "st_sort.h"
+#include "st_routes_csv.h"
+#include "st_route_cols.h"
+
+/* distinct gateways, indexed by an open addressing hash table */
+struct gw_table {
+	struct ip_addr *gws;
+	unsigned int nr, max_nr;
+	unsigned int *slots; /* gateway id + 1, 0 if empty */
+	unsigned int size;   /* power of two */
+};
+
+/* gateway key, memset'ed so it can be hashed & compared with memcmp
+ * routes without a gateway all get the same key
+ */
+static void gw_key(struct ip_addr *key, const struct ip_addr *a)
+{
+	memset(key, 0, sizeof(*key));
+	if (a->ip_ver == IPV4_A) {
+		key->ip_ver = IPV4_A;
+		key->ip     = a->ip;
+	} else if (a->ip_ver == IPV6_A) {
+		key->ip_ver = IPV6_A;
+		key->ip6    = a->ip6;
+	}
+}
+
+static int gw_table_grow(struct gw_table *t)
+{
+	unsigned int *slots, size, i, h;
+
+	size  = t->size * 2;
+	slots = st_malloc(size * sizeof(unsigned int), "gw hash");
+	if (slots == NULL)
+		return -1;
+	memset(slots, 0, size * sizeof(unsigned int));
+	for (i = 0; i < t->nr; i++) {
+		h = fnv_hash(&t->gws[i], sizeof(struct ip_addr)) & (size - 1);
+		while (slots[h])
+			h = (h + 1) & (size - 1);
+		slots[h] = i + 1;
+	}
+	st_free(t->slots, t->size * sizeof(unsigned int));
+	t->slots = slots;
+	t->size  = size;
+	return 1;
+}
+
+/* return the id of gateway 'key', add it if needed; -1 on ENOMEM */
+static long gw_table_id(struct gw_table *t, const struct ip_addr *key)
+{
+	struct ip_addr *new_gws;
+	unsigned int h;
+
+	h = fnv_hash(key, sizeof(struct ip_addr)) & (t->size - 1);
+	while (t->slots[h]) {
+		if (!memcmp(&t->gws[t->slots[h] - 1], key, sizeof(struct ip_addr)))
+			return t->slots[h] - 1;
+		h = (h + 1) & (t->size - 1);
+	}
+	if (t->nr == t->max_nr) {
+		new_gws = st_realloc(t->gws, t->max_nr * 2 * sizeof(struct ip_addr),
+				t->max_nr * sizeof(struct ip_addr), "gateways");
+		if (new_gws == NULL)
+			return -1;
+		t->gws = new_gws;
+		t->max_nr *= 2;
+	}
+	memcpy(&t->gws[t->nr], key, sizeof(struct ip_addr));
+	t->slots[h] = ++t->nr;
+	/* keep the load factor under 1/2 */
+	if (2 * t->nr >= t->size && gw_table_grow(t) < 0)
+		return -1;
+	return t->nr - 1;
+}
+
+static int gw_id_is_before(const void *v1, const void *v2, void *arg)
+{
+	const struct ip_addr *gws = arg;
+
+	return addr_is_before(&gws[*(const unsigned int *)v1], &gws[*(const unsigned int *)v2]);
+}
+
+/* fill c->gw with gateway ids numbered in gateway order */
+static int route_cols_load_gw(struct route_cols *c, const struct subnet_file *sf)
+{
+	struct gw_table t;
+	struct ip_addr key, last;
+	unsigned int *ids, *rank;
+	unsigned long i;
+	long id = -1;
+	int res = -1;
+
+	t.nr     = 0;
+	t.max_nr = 16;
+	t.size   = 64;
+	t.gws    = st_malloc(t.max_nr * sizeof(struct ip_addr), "gateways");
+	t.slots  = st_malloc(t.size * sizeof(unsigned int), "gw hash");
+	if (t.gws == NULL || t.slots == NULL)
+		goto out;
+	memset(t.slots, 0, t.size * sizeof(unsigned int));
+	memset(&last, 0, sizeof(last));
+	for (i = 0; i < sf->nr; i++) {
+		gw_key(&key, &sf->routes[i].gw);
+		/* routes to the same gateway are often grouped */
+		if (id < 0 || memcmp(&key, &last, sizeof(key))) {
+			id = gw_table_id(&t, &key);
+			if (id < 0)
+				goto out;
+			memcpy(&last, &key, sizeof(key));
+		}
+		c->gw[i] = id;
+	}
+	ids  = st_malloc(t.nr * sizeof(unsigned int), "gw ids");
+	rank = st_malloc(t.nr * sizeof(unsigned int), "gw ranks");
+	if (ids == NULL || rank == NULL) {
+		st_free(ids, t.nr * sizeof(unsigned int));
+		st_free(rank, t.nr * sizeof(unsigned int));
+		goto out;
+	}
+	for (i = 0; i < t.nr; i++)
+		ids[i] = i;
+	res = st_sort(ids, t.nr, sizeof(unsigned int), &gw_id_is_before, t.gws);
+	if (res >= 0) {
+		for (i = 0; i < t.nr; i++)
+			rank[ids[i]] = i;
+		for (i = 0; i < sf->nr; i++)
+			c->gw[i] = rank[c->gw[i]];
+		c->gw_nr = t.nr;
+		debug(SORT, 3, "%u distinct gateways\n", t.nr);
+		res = 1;
+	}
+	st_free(ids, t.nr * sizeof(unsigned int));
+	st_free(rank, t.nr * sizeof(unsigned int));
+out:
+	st_free(t.gws, t.max_nr * sizeof(struct ip_addr));
+	st_free(t.slots, t.size * sizeof(unsigned int));
+	return res;
+}
+
+void free_route_cols(struct route_cols *c)
+{
+	st_free(c->ip_ver, (c->nr + 1) * sizeof(unsigned char));
+	st_free(c->mask, (c->nr + 1) * sizeof(unsigned char));
+	st_free(c->pos, (c->nr + 1) * sizeof(unsigned long));
+	st_free(c->ip4, (c->nr4 + 1) * sizeof(ipv4));
+	st_free(c->ip6, (c->nr6 + 1) * sizeof(ipv6));
+	st_free(c->gw, (c->nr + 1) * sizeof(unsigned int));
+	memset(c, 0, sizeof(*c));
+}
+
+int route_cols_load(struct route_cols *c, const struct subnet_file *sf, int cols)
+{
+	const struct subnet *s;
+	unsigned long i;
+
+	memset(c, 0, sizeof(*c));
+	c->nr = sf->nr;
+	for (i = 0; i < sf->nr; i++) {
+		if (sf->routes[i].subnet.ip_ver == IPV4_A)
+			c->nr4++;
+		else
+			c->nr6++;
+	}
+	c->mask   = st_malloc((c->nr + 1) * sizeof(unsigned char), "route cols");
+	c->ip4    = st_malloc((c->nr4 + 1) * sizeof(ipv4), "route cols");
+	if (c->nr6) {
+		c->ip_ver = st_malloc((c->nr + 1) * sizeof(unsigned char), "route cols");
+		c->pos    = st_malloc((c->nr + 1) * sizeof(unsigned long), "route cols");
+		c->ip6    = st_malloc((c->nr6 + 1) * sizeof(ipv6), "route cols");
+	}
+	if (cols & ROUTE_COLS_GW)
+		c->gw = st_malloc((c->nr + 1) * sizeof(unsigned int), "route cols");
+	if (!c->mask || !c->ip4 || (c->nr6 && (!c->ip_ver || !c->pos || !c->ip6)) ||
+			((cols & ROUTE_COLS_GW) && !c->gw)) {
+		free_route_cols(c);
+		return -1;
+	}
+	if (c->nr6 == 0) {
+		/* IPv4 only, row i is ip4[i] */
+		for (i = 0; i < sf->nr; i++) {
+			c->ip4[i]  = sf->routes[i].subnet.ip;
+			c->mask[i] = sf->routes[i].subnet.mask;
+		}
+	} else {
+		c->nr4 = c->nr6 = 0;
+		for (i = 0; i < sf->nr; i++) {
+			s = &sf->routes[i].subnet;
+			c->ip_ver[i] = s->ip_ver;
+			c->mask[i]   = s->mask;
+			if (s->ip_ver == IPV4_A) {
+				c->pos[i] = c->nr4;
+				c->ip4[c->nr4++] = s->ip;
+			} else {
+				c->pos[i] = c->nr6;
+				c->ip6[c->nr6++] = s->ip6;
+			}
+		}
+	}
+	if ((cols & ROUTE_COLS_GW) && route_cols_load_gw(c, sf) < 0) {
+		free_route_cols(c);
+		return -1;
+	}
+	return 1;
+}
+
+/* append a 'width' bits field to the key words of an item
+ * a field never spans two words; all items share the same layout, so
+ * comparing words compares fields in order
+ */
+static inline void key_put(uint64_t *k, int *w, int *used, uint64_t v, int width)
+{
+	if (*used + width > 64) {
+		(*w)++;
+		*used = 0;
+	}
+	if (*used == 0)
+		k[*w] = v;
+	else
+		k[*w] = (k[*w] << width) | v;
+	*used += width;
+}
+
+static inline void route_cols_key(const struct route_cols *c, unsigned long i, int key,
+		int gw_bits, uint64_t *k, int *w, int *used)
+{
+	uint64_t hi, lo;
+	ipv6 a;
+
+	switch (key) {
+	case ROUTE_KEY_GW:
+		key_put(k, w, used, c->gw[i], gw_bits);
+		break;
+	case ROUTE_KEY_MASK:
+		key_put(k, w, used, c->mask[i], 8);
+		break;
+	default:
+		if (c->nr6 == 0) {
+			/* IPv4 only, address and mask fit in 40 bits */
+			key_put(k, w, used, ((uint64_t)c->ip4[i] << 8) | c->mask[i], 40);
+			break;
+		}
+		if (c->ip_ver[i] == IPV6_A) {
+			a  = c->ip6[c->pos[i]];
+			hi = ((uint64_t)block(a, 0) << 48) | ((uint64_t)block(a, 1) << 32) |
+				((uint64_t)block(a, 2) << 16) | block(a, 3);
+			lo = ((uint64_t)block(a, 4) << 48) | ((uint64_t)block(a, 5) << 32) |
+				((uint64_t)block(a, 6) << 16) | block(a, 7);
+		} else {
+			hi = 0;
+			lo = c->ip4[c->pos[i]];
+		}
+		/* IPv4 first */
+		key_put(k, w, used, c->ip_ver[i] == IPV6_A, 1);
+		key_put(k, w, used, hi, 64);
+		key_put(k, w, used, lo, 64);
+		key_put(k, w, used, c->mask[i], 8);
+		break;
+	}
+}
+
+/* key words of row 'i'; returns the number of words */
+static inline int route_cols_item(const struct route_cols *c, unsigned long i,
+		const int *keys, int nr, int gw_bits, uint64_t *k)
+{
+	int j, w = 0, used = 0;
+
+	for (j = 0; j < nr; j++)
+		route_cols_key(c, i, keys[j], gw_bits, k, &w, &used);
+	route_cols_key(c, i, ROUTE_KEY_PREFIX, gw_bits, k, &w, &used);
+	return w + 1;
+}
+
+int route_cols_order(const struct route_cols *c, const int *keys, int nr,
+		unsigned long *order)
+{
+	uint64_t *items, *scratch;
+	unsigned long i;
+	int nw, stride, res, gw_bits = 1;
+
+	if (c->nr == 0)
+		return 0;
+	while (gw_bits < 32 && (1UL << gw_bits) < c->gw_nr)
+		gw_bits++;
+	/* a key takes at most 4 words */
+	scratch = st_malloc(4 * (nr + 1) * sizeof(uint64_t), "radix keys");
+	if (scratch == NULL)
+		return -1;
+	nw = route_cols_item(c, 0, keys, nr, gw_bits, scratch);
+	st_free(scratch, 4 * (nr + 1) * sizeof(uint64_t));
+	stride = nw + 1;
+	items = st_malloc(c->nr * stride * sizeof(uint64_t), "radix keys");
+	if (items == NULL)
+		return -1;
+	for (i = 0; i < c->nr; i++) {
+		route_cols_item(c, i, keys, nr, gw_bits, items + i * stride);
+		items[i * stride + nw] = i;
+	}
+	debug(SORT, 3, "%d keys packed in %d words\n", nr + 1, nw);
+	res = radix_order_items(items, c->nr, nw, order);
+	st_free(items, c->nr * stride * sizeof(uint64_t));
+	return res;
+}
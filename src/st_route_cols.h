@@ -0,0 +1,91 @@
+#ifndef ST_ROUTE_COLS_H
+#define ST_ROUTE_COLS_H
+
+#include "iptools.h"
+#include "st_routes_csv.h"
+
+/* columns built by route_cols_load */
+#define ROUTE_COLS_PREFIX	1
+#define ROUTE_COLS_GW		2
+
+/* sort keys understood by route_cols_order */
+#define ROUTE_KEY_PREFIX	0
+#define ROUTE_KEY_GW		1
+#define ROUTE_KEY_MASK		2
+
+/*
+ * columnar view of the routes of a subnet_file
+ * row i is sf->routes[i]; kernels that need a few fields only scan these
+ * dense arrays instead of dragging a whole struct route through the cache
+ * IPv4 and IPv6 prefixes are stored in separate arrays, pos[i] is the index
+ * of row i inside the array matching ip_ver[i]
+ * most files are IPv4 only; they are stored packed, 5 bytes per prefix:
+ * ip_ver, pos and ip6 are NULL and row i is ip4[i], mask[i]
+ */
+struct route_cols {
+	unsigned long nr;       /* number of rows */
+	unsigned long nr4;      /* number of IPv4 prefixes */
+	unsigned long nr6;      /* number of IPv6 prefixes */
+	unsigned char *ip_ver;  /* NULL if IPv4 only */
+	unsigned char *mask;
+	unsigned long *pos;     /* NULL if IPv4 only */
+	ipv4 *ip4;
+	ipv6 *ip6;
+	unsigned int *gw;       /* gateway ids, numbered in gateway order */
+	unsigned int gw_nr;     /* number of distinct gateways */
+};
+
+/* route_cols_load: build the columnar view of a subnet_file
+ * routes without a gateway share the same gateway id, the smallest one
+ * @c    : the view to fill
+ * @sf   : the subnet file
+ * @cols : ROUTE_COLS_PREFIX, optionally ORed with ROUTE_COLS_GW
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int route_cols_load(struct route_cols *c, const struct subnet_file *sf, int cols);
+
+/* free_route_cols: release memory attached to a columnar view
+ * @c : the view
+ */
+void free_route_cols(struct route_cols *c);
+
+/* route_cols_subnet: get the prefix of row 'i'
+ * @c : the view
+ * @i : the row
+ * @s : the prefix
+ */
+static inline void route_cols_subnet(const struct route_cols *c, unsigned long i,
+		struct subnet *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->mask = c->mask[i];
+	if (c->nr6 == 0) {
+		s->ip_ver = IPV4_A;
+		s->ip     = c->ip4[i];
+		return;
+	}
+	s->ip_ver = c->ip_ver[i];
+	if (s->ip_ver == IPV4_A)
+		s->ip = c->ip4[c->pos[i]];
+	else
+		s->ip6 = c->ip6[c->pos[i]];
+}
+
+/* route_cols_order: stable order of the rows on several keys, then by prefix
+ * keys are packed into integer words and radix sorted
+ * @c     : the view, with ROUTE_COLS_GW if ROUTE_KEY_GW is used
+ * @keys  : ROUTE_KEY_* values
+ * @nr    : number of keys
+ * @order : c->nr indexes; order[i] is the i-th row in sorted order
+ * returns:
+ *	1  on SUCCESS
+ *	0  if rows were already sorted (order is the identity)
+ *	-1 on ENOMEM
+ */
+int route_cols_order(const struct route_cols *c, const int *keys, int nr,
+		unsigned long *order);
+
+#else
+#endif
@@ -20,16 +20,26 @@ void zero_route_ea(struct route *a)
 	int i;
 	void *ea  = a->ea;
 	int ea_nr = a->ea_nr;
+	int ea_arena = a->ea_arena;
 
-	for (i = 0; i < ea_nr; i++)
-		a->ea[i].value[0] = '\0';
+	for (i = 0; i < ea_nr; i++) {
+		/* pooled values are shared with other routes, just drop them */
+		if (a->ea[i].pooled) {
+			a->ea[i].value  = NULL;
+			a->ea[i].len    = 0;
+			a->ea[i].pooled = 0;
+		} else if (a->ea[i].value)
+			a->ea[i].value[0] = '\0';
+	}
 	zero_route(a);
 	a->ea    = ea;
 	a->ea_nr = ea_nr;
+	a->ea_arena = ea_arena;
 }
 
 int alloc_route_ea(struct route *r, int n)
 {
+	r->ea_arena = 0;
 	r->ea = alloc_ea_array(n);
 	if (r->ea == NULL) {
 		r->ea_nr = 0;
@@ -39,11 +49,34 @@ int alloc_route_ea(struct route *r, int n)
 	return 1;
 }
 
+int arena_alloc_route_ea(struct route *r, int n, struct st_arena *a)
+{
+	r->ea = arena_alloc_ea_array(a, n);
+	if (r->ea == NULL) {
+		r->ea_nr    = 0;
+		r->ea_arena = 0;
+		return -1;
+	}
+	r->ea_nr    = n;
+	r->ea_arena = 1;
+	return 1;
+}
+
 int realloc_route_ea(struct route *r, int new_n)
 {
 	struct st_ea *new_ea;
 
-	new_ea = realloc_ea_array(r->ea, r->ea_nr, new_n);
+	if (r->ea_arena) {
+		/* arena memory can't grow */
+		if (new_n < r->ea_nr)
+			return -1;
+		new_ea = alloc_ea_array(new_n);
+		if (new_ea == NULL)
+			return -1;
+		memcpy(new_ea, r->ea, r->ea_nr * sizeof(struct st_ea));
+		r->ea_arena = 0;
+	} else
+		new_ea = realloc_ea_array(r->ea, r->ea_nr, new_n);
 	if (new_ea == NULL) /* we don't free original ea, caller should */
 		return -1;
 	r->ea    = new_ea;
@@ -63,7 +96,7 @@ int clone_route(struct route *dest, const struct route *src)
 	for (i = 0; i <	dest->ea_nr; i++) {
 		/* name IS not malloc'ed, only value */
 		dest->ea[i].name = src->ea[i].name;
-		ea_strdup(&dest->ea[i], src->ea[i].value);
+		ea_clone(&dest->ea[i], &src->ea[i]);
 	}
 	return 1;
 }
@@ -78,16 +111,20 @@ int clone_route_nofree(struct route *dest, const struct route *src)
 		return res;
 	for (i = 0; i <	dest->ea_nr; i++) {
 		dest->ea[i].name = src->ea[i].name;
-		ea_strdup(&dest->ea[i], src->ea[i].value);
+		ea_clone(&dest->ea[i], &src->ea[i]);
 	}
 	return 1;
 }
 
 void free_route(struct route *r)
 {
-	free_ea_array(r->ea, r->ea_nr);
+	if (r->ea_arena) /* the array goes away with the arena */
+		free_ea_values(r->ea, r->ea_nr);
+	else
+		free_ea_array(r->ea, r->ea_nr);
 	r->ea    = NULL;
 	r->ea_nr = 0;
+	r->ea_arena = 0;
 }
 
 int is_equal_gw(struct route *r1, struct route *r2)
@@ -104,7 +141,7 @@ int is_equal_gw(struct route *r1, struct route *r2)
 		if (!ipv6_is_link_local(r1->gw.ip6))
 			return 1;
 		/* if link local adress, we must check if the device is the same */
-		return !strcmp(r1->device, r2->device);
+		return (r1->device == r2->device || !strcmp(r1->device, r2->device));
 	}
 	return 0;
 }
@@ -8,9 +8,10 @@
 
 struct route {
 	struct subnet subnet;
-	char device[ST_MAX_DEVNAME_LEN];
+	const char *device; /* a string pool string, or a static string; never modified */
 	struct ip_addr gw;
 	int ea_nr; /* number of EA */
+	int ea_arena; /* ea was allocated from the arena of the route file */
 	struct st_ea *ea; /* Extended Attributes */
 };
 
@@ -18,6 +19,7 @@ struct route {
 static inline void zero_route(struct route *a)
 {
 	memset(a, 0, sizeof(struct route));
+	a->device = "";
 }
 
 /* __init_route: set only required fields to zero
@@ -28,7 +30,7 @@ static inline void __init_route(struct route *a)
 	a->subnet.ip_ver = 0;
 	a->subnet.mask   = 0;
 	a->gw.ip_ver     = 0;
-	a->device[0]     = '\0';
+	a->device        = "";
 }
 /* copy_route can be used if it is just moving route from one container to another
  * clone_route MUST BE used if the src route is still referenced
@@ -37,7 +39,7 @@ static inline void copy_route(struct route *a, const struct route *b)
 {
 	memcpy(a, b, sizeof(struct route));
 }
-/* clone src into dest, allocating new buffer to dst
+/* clone src into dest, allocating new buffer to dst; pooled EA values are shared
  * if dest had alloc'ed buffer, free them
  * returns:
  *	1  on success
@@ -53,6 +55,10 @@ int clone_route(struct route *dst, const struct route *src);
  */
 int clone_route_nofree(struct route *dst, const struct route *src);
 
+/* zero_route_ea: zero a route but keep its EA array
+ * private EA values are emptied, pooled ones are dropped (value = NULL)
+ * @a : the route
+ */
 void zero_route_ea(struct route *a);
 
 /*
@@ -66,9 +72,23 @@ void zero_route_ea(struct route *a);
  */
 int alloc_route_ea(struct route *r, int n);
 
+/*
+ * arena_alloc_route_ea
+ * Alloc memory for a route Extended Attributes from an arena
+ * the route must not outlive the arena
+ * @r	: the route
+ * @n	: the number of Extended Attributes to alloc
+ * @a	: the arena
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on failure (ENOMEM)
+ */
+int arena_alloc_route_ea(struct route *r, int n, struct st_arena *a);
+
 /*
  * realloc_route_ea
  * realloc memory for a route Extended Attributes
+ * EA allocated from an arena are moved to the heap
  * @r	: the route
  * @n	: the new number of Extended Attributes to alloc
  * returns:
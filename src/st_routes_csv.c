@@ -21,9 +21,11 @@
 #include "generic_csv.h"
 #include "st_printf.h"
 #include "bgp_tool.h"
+#include "st_strpool.h"
 #include "st_routes_csv.h"
 
 #define ROUTEFILE_STATIC_REGISTERED_FIELDS 4
+#define SF_ARENA_CHUNK_SIZE (256 * 1024)
 
 int alloc_subnet_file(struct subnet_file *sf, unsigned long n)
 {
@@ -39,6 +41,8 @@ int alloc_subnet_file(struct subnet_file *sf, unsigned long n)
 	}
 	sf->nr     = 0;
 	sf->max_nr = n;
+	sf->private_ea = 0;
+	st_arena_init(&sf->arena, SF_ARENA_CHUNK_SIZE);
 	sf->ea	   = st_malloc(sizeof(char *) * 1, "st route ea");
 	if (sf->ea == NULL) {
 		st_free(sf->routes, sf->max_nr * sizeof(struct route));
@@ -60,8 +64,11 @@ void free_subnet_file(struct subnet_file *sf)
 {
 	unsigned long i;
 
+	if (st_skip_teardown)
+		return;
 	for (i = 0; i < sf->nr; i++)
 		free_route(&sf->routes[i]);
+	st_arena_free(&sf->arena);
 	for (i = 0; i < sf->ea_nr; i++)
 		st_free_string(sf->ea[i]);
 	st_free(sf->routes, sf->max_nr * sizeof(struct route));
@@ -73,7 +80,7 @@ void free_subnet_file(struct subnet_file *sf)
 }
 
 /* sf_init_route: init a route in a subnet_file
- * alloc  Extended Attribute array and copy EA names from sf->ea int routes
+ * alloc  Extended Attribute array from the file arena and copy EA names from sf->ea int routes
  * @sf  : the subnet file
  * @n   : the element to alloc_memory
  * returns:
@@ -85,7 +92,7 @@ static int sf_init_route(struct subnet_file *sf, unsigned long n)
 	int res, i;
 
 	__init_route(&sf->routes[n]);
-	res = alloc_route_ea(&sf->routes[n], sf->ea_nr);
+	res = arena_alloc_route_ea(&sf->routes[n], sf->ea_nr, &sf->arena);
 	if (res < 0) /* routes->ea will be set to NULL, and ea_nr to zero */
 		return res;
 	for (i = 0; i < sf->ea_nr; i++)
@@ -128,15 +135,30 @@ static int netcsv_mask_handle(char *s, void *data, struct csv_state *state)
 static int netcsv_device_handle(char *s, void *data, struct csv_state *state)
 {
 	struct subnet_file *sf = data;
+	char device[ST_MAX_DEVNAME_LEN];
+	const char *p;
 	int res;
 
-	res = strxcpy(sf->routes[sf->nr].device, s, sizeof(sf->routes[sf->nr].device));
-	if (res >= sizeof(sf->routes[sf->nr].device))
+	res = strxcpy(device, s, sizeof(device));
+	if (res >= sizeof(device))
 		debug(LOAD_CSV, 3, "line %lu STRING device '%s' too long, truncating to '%s'\n",
-				state->line, s, sf->routes[sf->nr].device);
+				state->line, s, device);
+	/* few distinct devices, routes share them */
+	p = st_intern(device);
+	if (p == NULL)
+		return CSV_CATASTROPHIC_FAILURE;
+	sf->routes[sf->nr].device = p;
 	return CSV_VALID_FIELD;
 }
 
+/* values read from a file are interned, unless the loader must account for them */
+static int netcsv_set_ea(const struct subnet_file *sf, struct st_ea *ea, const char *s)
+{
+	if (sf->private_ea)
+		return ea_strdup(ea, s);
+	return ea_intern(ea, s);
+}
+
 static int netcsv_GW_handle(char *s, void *data, struct csv_state *state)
 {
 	struct subnet_file *sf = data;
@@ -147,7 +169,7 @@ static int netcsv_GW_handle(char *s, void *data, struct csv_state *state)
 	/* we accept that there's no gateway but we treat it has a comment instead */
 	if (res != IPV4_A && res != IPV6_A && s[0] != '\0') {
 		/* we dont care if memory alloc failed here */
-		ea_strdup(&sf->routes[sf->nr].ea[0], s);
+		netcsv_set_ea(sf, &sf->routes[sf->nr].ea[0], s);
 	} else {
 		if (res == sf->routes[sf->nr].subnet.ip_ver) {/* does the gw have same IPversion*/
 			copy_ipaddr(&sf->routes[sf->nr].gw, &addr);
@@ -163,8 +185,8 @@ static int netcsv_comment_handle(char *s, void *data, struct csv_state *state)
 {
 	struct subnet_file *sf = data;
 
-	st_free_string(sf->routes[sf->nr].ea[0].value);
-	ea_strdup(&sf->routes[sf->nr].ea[0], s);
+	free_ea(&sf->routes[sf->nr].ea[0]);
+	netcsv_set_ea(sf, &sf->routes[sf->nr].ea[0], s);
 	return CSV_VALID_FIELD;
 }
 
@@ -181,8 +203,8 @@ static int netcsv_ea_handler(char *s, void *data, struct csv_state *state)
 	 */
 	ea_nr = state->csv_id - ROUTEFILE_STATIC_REGISTERED_FIELDS;
 	
-	/* we dont care if memory failed on strdup; we continue */
-	ea_strdup(&sf->routes[sf->nr].ea[ea_nr], s);
+	/* we dont care if memory failed; we continue */
+	netcsv_set_ea(sf, &sf->routes[sf->nr].ea[ea_nr], s);
 	debug(LOAD_CSV, 6, "Found ea_nr#%d, %s = %s\n",  ea_nr, sf->ea[ea_nr], s);
 
 	return CSV_VALID_FIELD;
@@ -225,6 +247,9 @@ static int netcsv_endofline_callback(struct csv_state *state, void *data)
 					SF_MAX_ROUTES_NUMBER);
 			return CSV_CATASTROPHIC_FAILURE;
 		}
+		/* big arrays are mmap'ed and glibc realloc moves their pages
+		 * with mremap instead of copying them, so doubling stays cheap
+		 */
 		new_r = st_realloc(sf->routes, sizeof(struct route) * 2 * sf->max_nr,
 				sizeof(struct route) * sf->max_nr,
 				"struct route");
@@ -269,43 +294,54 @@ static int netcsv_validate_header(struct csv_file *cf, void *data)
 	return 1;
 }
 
-int load_netcsv_file(char *name, struct subnet_file *sf, struct st_options *nof)
+/* init a CSV file description for netcsv files */
+static int netcsv_init_csv_file(struct csv_file *cf, char *name, struct st_options *nof)
 {
-	struct csv_file cf;
-	struct csv_state state;
 	int res;
 	char *s;
 
 	if (nof->delim[1] == '\0') /* one delim,, use optimised strtok */
-		res = init_csv_file(&cf, name, 20 + 1, nof->delim, '\0', '\0',
+		res = init_csv_file(cf, name, 20 + 1, nof->delim, '\0', '\0',
 				&st_strtok_string_r1);
 	else
-		res = init_csv_file(&cf, name, 20 + 1, nof->delim, '\0', '\0',
+		res = init_csv_file(cf, name, 20 + 1, nof->delim, '\0', '\0',
 				&st_strtok_string_r);
 	if (res < 0)
 		return res;
-	init_csv_state(&state, name);
-	cf.is_header            = &netcsv_is_header;
-	cf.endofline_callback   = &netcsv_endofline_callback;
-	cf.startofline_callback = &netcsv_startofline_callback;
-	cf.validate_header      = &netcsv_validate_header;
-	cf.default_handler      = &netcsv_ea_handler;
+	cf->is_header            = &netcsv_is_header;
+	cf->endofline_callback   = &netcsv_endofline_callback;
+	cf->startofline_callback = &netcsv_startofline_callback;
+	cf->validate_header      = &netcsv_validate_header;
+	cf->default_handler      = &netcsv_ea_handler;
 	/* netcsv field may have been set by conf file, otherwise set their 'default' value */
 	s = (nof->netcsv_prefix_field[0] ? nof->netcsv_prefix_field : "prefix");
-	register_csv_field(&cf, s, mandatory, 1, 1, &netcsv_prefix_handle);
+	register_csv_field(cf, s, mandatory, 1, 1, &netcsv_prefix_handle);
 	s = (nof->netcsv_mask[0] ? nof->netcsv_mask : "mask");
-	register_csv_field(&cf, s, optional, 0, 2, &netcsv_mask_handle);
+	register_csv_field(cf, s, optional, 0, 2, &netcsv_mask_handle);
 	s = (nof->netcsv_device[0] ? nof->netcsv_device : "device");
-	register_csv_field(&cf, s, optional, 0, 0, &netcsv_device_handle);
+	register_csv_field(cf, s, optional, 0, 0, &netcsv_device_handle);
 	s = (nof->netcsv_gw[0] ? nof->netcsv_gw : "GW");
-	register_csv_field(&cf, s, optional, 0, 3, &netcsv_GW_handle);
+	register_csv_field(cf, s, optional, 0, 3, &netcsv_GW_handle);
 	s = (nof->netcsv_comment[0] ? nof->netcsv_comment : "comment");
-	register_csv_field(&cf, s, optional, 0, 4, &netcsv_comment_handle);
+	register_csv_field(cf, s, optional, 0, 4, &netcsv_comment_handle);
 
-	if (cf.csv_field == NULL) {/* failed malloc of csv_field name */
-		free_csv_file(&cf);
+	if (cf->csv_field == NULL) {/* failed malloc of csv_field name */
+		free_csv_file(cf);
 		return -2;
 	}
+	return 1;
+}
+
+int load_netcsv_file(char *name, struct subnet_file *sf, struct st_options *nof)
+{
+	struct csv_file cf;
+	struct csv_state state;
+	int res;
+
+	res = netcsv_init_csv_file(&cf, name, nof);
+	if (res < 0)
+		return res;
+	init_csv_state(&state, name);
 	if (alloc_subnet_file(sf, 4096) < 0) {
 		free_csv_file(&cf);
 		return -2;
@@ -326,13 +362,97 @@ int load_netcsv_file(char *name, struct subnet_file *sf, struct st_options *nof)
 	return res;
 }
 
+/*
+ * netcsv loading by runs; the handlers get a 'struct subnet_file *'
+ * so sf MUST be the first member
+ */
+struct netcsv_runs {
+	struct subnet_file sf;
+	unsigned long max_bytes; /* memory held by routes before a run is handed */
+	unsigned long bytes;
+	unsigned long total; /* number of routes loaded */
+	int (*run_cb)(struct subnet_file *sf, int last, void *arg);
+	void *arg;
+};
+
+static int netcsv_runs_endofline_callback(struct csv_state *state, void *data)
+{
+	struct netcsv_runs *runs = data;
+	struct route *r;
+	int i, res;
+
+	res = netcsv_endofline_callback(state, data);
+	if (res == CSV_CATASTROPHIC_FAILURE || state->badline)
+		return res;
+	runs->total++;
+	r = &runs->sf.routes[runs->sf.nr - 1];
+	runs->bytes += sizeof(struct route) + r->ea_nr * sizeof(struct st_ea);
+	for (i = 0; i < r->ea_nr; i++)
+		runs->bytes += ea_size(&r->ea[i]);
+	if (runs->bytes < runs->max_bytes)
+		return res;
+	debug(LOAD_CSV, 3, "line %lu, %lu routes use %lu bytes, handing a run\n",
+			state->line, runs->sf.nr, runs->bytes);
+	if (runs->run_cb(&runs->sf, 0, runs->arg) < 0)
+		return CSV_CATASTROPHIC_FAILURE;
+	/* the routes of the run are gone, and so are the users of their EA */
+	st_arena_free(&runs->sf.arena);
+	runs->bytes = 0;
+	return res;
+}
+
+int load_netcsv_file_by_runs(char *name, struct subnet_file *sf, struct st_options *nof,
+		unsigned long max_bytes,
+		int (*run_cb)(struct subnet_file *sf, int last, void *arg), void *arg)
+{
+	struct csv_file cf;
+	struct csv_state state;
+	struct netcsv_runs runs;
+	int res;
+
+	res = netcsv_init_csv_file(&cf, name, nof);
+	if (res < 0)
+		return res;
+	cf.endofline_callback = &netcsv_runs_endofline_callback;
+	init_csv_state(&state, name);
+	if (alloc_subnet_file(&runs.sf, 4096) < 0) {
+		free_csv_file(&cf);
+		return -2;
+	}
+	/* pooled values are never released, they would escape max_bytes */
+	runs.sf.private_ea = 1;
+	runs.max_bytes = max_bytes;
+	runs.bytes     = 0;
+	runs.total     = 0;
+	runs.run_cb    = run_cb;
+	runs.arg       = arg;
+	res = generic_load_csv(name, &cf, &state, &runs);
+	free_csv_file(&cf);
+	memcpy(sf, &runs.sf, sizeof(*sf));
+	if (res < 0) {
+		free_subnet_file(sf);
+		return res;
+	}
+	if (runs.total == 0) {
+		debug(LOAD_CSV, 2, "Not a single valid line in %s", name);
+		free_subnet_file(sf);
+		return -2;
+	}
+	res = run_cb(sf, 1, arg);
+	if (res < 0) {
+		free_subnet_file(sf);
+		return res;
+	}
+	return 1;
+}
+
 static int ipam_comment_handle(char *s, void *data, struct csv_state *state)
 {
 	struct  subnet_file *sf = data;
 	/* sometimes comment are fucked and a better one is in EA-Name */
 	if (strlen(s) > 2) {
 		free_ea(&sf->routes[sf->nr].ea[0]);
-		ea_strdup(&sf->routes[sf->nr].ea[0], s);
+		ea_intern(&sf->routes[sf->nr].ea[0], s);
 	}
 	return CSV_VALID_FIELD;
 }
@@ -524,12 +644,12 @@ static int bgpcsv_weight_handle(char *s, void *data, struct csv_state *state)
 static int bgpcsv_aspath_handle(char *s, void *data, struct csv_state *state)
 {
 	struct bgp_file *sf = data;
-	int res;
+	long id;
 
-	res = strxcpy(sf->routes[sf->nr].AS_PATH, s, sizeof(sf->routes[sf->nr].AS_PATH));
-	if (res >= sizeof(sf->routes[sf->nr].AS_PATH))
-		debug(LOAD_CSV, 3, "line %lu AS_PATH '%s' too long, truncating to '%s'\n",
-				state->line, s, sf->routes[sf->nr].AS_PATH);
+	id = aspath_intern(s);
+	if (id < 0)
+		return CSV_CATASTROPHIC_FAILURE;
+	sf->routes[sf->nr].aspath = id;
 	return CSV_VALID_FIELD;
 }
 
@@ -601,6 +721,7 @@ static int bgpcsv_endofline_callback(struct csv_state *state, void *data)
 					SF_BGP_MAX_ROUTES_NUMBER);
 			return CSV_CATASTROPHIC_FAILURE;
 		}
+		/* doubling is cheap, see netcsv_endofline_callback */
 		new_r = st_realloc(sf->routes, sizeof(struct bgp_route) * sf->max_nr * 2,
 				sizeof(struct bgp_route) * sf->max_nr,
 				"bgp_route");
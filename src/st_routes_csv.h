@@ -12,6 +12,8 @@ struct subnet_file {
 	unsigned long max_nr; /* the number of routes that has been malloced */
 	int ea_nr;
 	char **ea;
+	struct st_arena arena; /* route EA arrays */
+	int private_ea; /* EA values are malloc'ed, not interned; see load_netcsv_file_by_runs */
 };
 
 struct bgp_file {
@@ -24,6 +26,24 @@ int alloc_subnet_file(struct subnet_file *sf, unsigned long n);
 void free_subnet_file(struct subnet_file *sf);
 
 int load_netcsv_file(char *name, struct subnet_file *sf, struct st_options *nof);
+
+/* load_netcsv_file_by_runs: load a netcsv file by runs of bounded memory
+ * each time routes loaded in sf use more than 'max_bytes', run_cb is called
+ * run_cb must consume the routes (free them and set sf->nr to 0)
+ * it is called a last time at end of file with 'last' set
+ * @name      : the file name
+ * @sf        : on SUCCESS holds EA names, must be freed with free_subnet_file
+ * @nof       : options
+ * @max_bytes : memory budget of a run
+ * @run_cb    : the run handler; returns negative on error
+ * @arg       : passed to run_cb
+ * returns:
+ *	1 on SUCCESS
+ *	negative on error
+ */
+int load_netcsv_file_by_runs(char *name, struct subnet_file *sf, struct st_options *nof,
+		unsigned long max_bytes,
+		int (*run_cb)(struct subnet_file *sf, int last, void *arg), void *arg);
 int load_ipam_no_EA(char  *name, struct subnet_file *sf, struct st_options *nof);
 
 int alloc_bgp_file(struct bgp_file *sf, unsigned long n);
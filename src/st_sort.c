@@ -0,0 +1,334 @@
+/*
+ * parallel stable merge sort
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "debug.h"
+#include "st_memory.h"
+#include "st_sort.h"
+
+int st_sort_threads = 1;
+
+void st_parallel_run(void *(*fn)(void *), void *jobs, int nr, size_t size)
+{
+	pthread_t tid[2 * ST_SORT_MAX_THREADS];
+	int started[2 * ST_SORT_MAX_THREADS];
+	int i;
+
+	for (i = 0; i < nr - 1; i++) {
+		started[i] = 0;
+		if (i < 2 * ST_SORT_MAX_THREADS &&
+				!pthread_create(&tid[i], NULL, fn, (char *)jobs + i * size))
+			started[i] = 1;
+		else
+			fn((char *)jobs + i * size);
+	}
+	if (nr > 0)
+		fn((char *)jobs + (nr - 1) * size);
+	for (i = 0; i < nr - 1 && i < 2 * ST_SORT_MAX_THREADS; i++)
+		if (started[i])
+			pthread_join(tid[i], NULL);
+}
+
+/*
+ * a chunk sort sorts src[a0, a1), using dst[a0, a1) as a buffer
+ * a merge merges src[a0, a1) & src[b0, b1) into dst[k0, ...)
+ */
+struct sort_job {
+	const struct st_sort_ops *ops;
+	void *arg;
+	char *src;
+	char *dst;
+	unsigned long a0, a1, b0, b1, k0;
+};
+
+static void *sort_chunk_job(void *v)
+{
+	struct sort_job *j = v;
+
+	j->ops->sort_chunk(j->src, j->dst, j->a0, j->a1, j->arg);
+	return NULL;
+}
+
+static void *sort_merge_job(void *v)
+{
+	struct sort_job *j = v;
+
+	j->ops->merge(j->src, j->dst, j->a0, j->a1, j->b0, j->b1, j->k0, j->arg);
+	return NULL;
+}
+
+int __st_sort(void *base, unsigned long n, size_t size,
+		const struct st_sort_ops *ops, void *arg)
+{
+	struct sort_job jobs[2 * ST_SORT_MAX_THREADS];
+	unsigned long bound[ST_SORT_MAX_THREADS + 1];
+	unsigned long a0, a1, b1, k0, k1, i0, i1, total;
+	char *tmp, *src, *dst, *swap;
+	int t, runs, p, q, nj, pieces;
+
+	if (n < 2)
+		return 1;
+	t = st_sort_threads;
+	if (t > ST_SORT_MAX_THREADS)
+		t = ST_SORT_MAX_THREADS;
+	if (n / ST_SORT_MIN_CHUNK < t)
+		t = n / ST_SORT_MIN_CHUNK;
+	if (t < 1)
+		t = 1;
+	tmp = st_malloc(n * size, "sort buffer");
+	if (tmp == NULL)
+		return -1;
+	debug_timing_start(3);
+	for (p = 0; p <= t; p++)
+		bound[p] = n * p / t;
+	for (p = 0; p < t; p++) {
+		jobs[p].ops = ops;
+		jobs[p].arg = arg;
+		jobs[p].src = base;
+		jobs[p].dst = tmp;
+		jobs[p].a0  = bound[p];
+		jobs[p].a1  = bound[p + 1];
+	}
+	st_parallel_run(sort_chunk_job, jobs, t, sizeof(struct sort_job));
+
+	/* merge runs two by two; each merge is split between t / pairs threads */
+	src = base;
+	dst = tmp;
+	for (runs = t; runs > 1; runs = (runs + 1) / 2) {
+		nj = 0;
+		pieces = t / (runs / 2);
+		for (p = 0; p + 1 < runs; p += 2) {
+			a0 = bound[p];
+			a1 = bound[p + 1];
+			b1 = bound[p + 2];
+			total = b1 - a0;
+			i0 = 0;
+			k0 = 0;
+			for (q = 1; q <= pieces; q++) {
+				k1 = total * q / pieces;
+				i1 = ops->corank(src, a0, a1 - a0, a1, b1 - a1, k1, arg);
+				jobs[nj].ops = ops;
+				jobs[nj].arg = arg;
+				jobs[nj].src = src;
+				jobs[nj].dst = dst;
+				jobs[nj].a0  = a0 + i0;
+				jobs[nj].a1  = a0 + i1;
+				jobs[nj].b0  = a1 + (k0 - i0);
+				jobs[nj].b1  = a1 + (k1 - i1);
+				jobs[nj].k0  = a0 + k0;
+				nj++;
+				i0 = i1;
+				k0 = k1;
+			}
+		}
+		if (runs % 2) {
+			/* odd run out, just copy it */
+			jobs[nj].ops = ops;
+			jobs[nj].arg = arg;
+			jobs[nj].src = src;
+			jobs[nj].dst = dst;
+			jobs[nj].a0  = bound[runs - 1];
+			jobs[nj].a1  = bound[runs];
+			jobs[nj].b0  = jobs[nj].b1 = bound[runs];
+			jobs[nj].k0  = bound[runs - 1];
+			nj++;
+		}
+		st_parallel_run(sort_merge_job, jobs, nj, sizeof(struct sort_job));
+		for (p = 0; 2 * p < runs; p++)
+			bound[p] = bound[2 * p];
+		bound[p] = n;
+		swap = src;
+		src  = dst;
+		dst  = swap;
+	}
+	if (src != base)
+		memcpy(base, src, n * size);
+	debug(TIMING, 3, "%lu records sorted with %d threads\n", n, t);
+	debug_timing_end(3);
+	st_free(tmp, n * size);
+	return 1;
+}
+
+/*
+ * generic records of ctx->size bytes, compared through ctx->less
+ */
+struct sort_ctx {
+	size_t size;
+	int (*less)(const void *, const void *, void *);
+	void *arg;
+};
+
+/* stable merge, ties are taken from the first run */
+static void generic_merge(const void *__src, void *__dst,
+		unsigned long a0, unsigned long a1, unsigned long b0, unsigned long b1,
+		unsigned long k, void *arg)
+{
+	const struct sort_ctx *c = arg;
+	const char *src = __src;
+	char *dst = __dst;
+	size_t sz = c->size;
+	unsigned long lo, hi, mid, d, e = b1;
+
+	if (a0 < a1 && b0 < b1) {
+		/* gallop: A records not placed after B[b0] are already in place */
+		lo = a0;
+		for (d = 1; d <= a1 - a0 &&
+				!c->less(src + b0 * sz, src + (a0 + d - 1) * sz, c->arg); d *= 2)
+			lo = a0 + d;
+		hi = (d <= a1 - a0 ? a0 + d - 1 : a1);
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (c->less(src + b0 * sz, src + mid * sz, c->arg))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		memcpy(dst + k * sz, src + a0 * sz, (lo - a0) * sz);
+		k += lo - a0;
+		a0 = lo;
+	}
+	if (a0 < a1 && b0 < b1) {
+		/* and so are B records not placed before A[a1 - 1] */
+		hi = b1;
+		for (d = 1; d <= b1 - b0 &&
+				!c->less(src + (b1 - d) * sz, src + (a1 - 1) * sz, c->arg); d *= 2)
+			hi = b1 - d;
+		lo = (d <= b1 - b0 ? b1 - d + 1 : b0);
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (c->less(src + mid * sz, src + (a1 - 1) * sz, c->arg))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		e = lo;
+	}
+	memcpy(dst + (k + (a1 - a0) + (e - b0)) * sz, src + e * sz, (b1 - e) * sz);
+	while (a0 < a1 && b0 < e) {
+		if (c->less(src + b0 * sz, src + a0 * sz, c->arg)) {
+			memcpy(dst + k * sz, src + b0 * sz, sz);
+			b0++;
+		} else {
+			memcpy(dst + k * sz, src + a0 * sz, sz);
+			a0++;
+		}
+		k++;
+	}
+	if (a0 < a1) {
+		memcpy(dst + k * sz, src + a0 * sz, (a1 - a0) * sz);
+		k += a1 - a0;
+	}
+	if (b0 < e)
+		memcpy(dst + k * sz, src + b0 * sz, (e - b0) * sz);
+}
+
+static void generic_sort_chunk(void *__src, void *__dst,
+		unsigned long lo, unsigned long hi, void *arg)
+{
+	const struct sort_ctx *c = arg;
+	size_t sz = c->size;
+	unsigned long s, m, e, i, k, w;
+	char *src = __src, *dst = __dst, *swap, *x;
+
+	/* already sorted chunk */
+	for (i = lo + 1; i < hi && !c->less(src + i * sz, src + (i - 1) * sz, c->arg); i++)
+		;
+	if (i >= hi)
+		return;
+	/* insertion sort of small runs; dst is still free, use it to save a record */
+	x = dst + lo * sz;
+	for (s = lo; s < hi; s += ST_SORT_RUN) {
+		e = (s + ST_SORT_RUN < hi ? s + ST_SORT_RUN : hi);
+		for (i = s + 1; i < e; i++) {
+			if (!c->less(src + i * sz, src + (i - 1) * sz, c->arg))
+				continue;
+			memcpy(x, src + i * sz, sz);
+			k = i;
+			while (k > s && c->less(x, src + (k - 1) * sz, c->arg)) {
+				memcpy(src + k * sz, src + (k - 1) * sz, sz);
+				k--;
+			}
+			memcpy(src + k * sz, x, sz);
+		}
+	}
+	for (w = ST_SORT_RUN; w < hi - lo; w *= 2) {
+		for (s = lo; s < hi; s += 2 * w) {
+			m = (s + w < hi ? s + w : hi);
+			e = (s + 2 * w < hi ? s + 2 * w : hi);
+			generic_merge(src, dst, s, m, m, e, s, arg);
+		}
+		swap = src;
+		src  = dst;
+		dst  = swap;
+	}
+	if (src != __src)
+		memcpy((char *)__src + lo * sz, src + lo * sz, (hi - lo) * sz);
+}
+
+static unsigned long generic_corank(const void *__src,
+		unsigned long a0, unsigned long na, unsigned long b0, unsigned long nb,
+		unsigned long k, void *arg)
+{
+	const struct sort_ctx *c = arg;
+	const char *src = __src;
+	unsigned long lo, hi, i, j;
+	size_t sz = c->size;
+
+	lo = (k > nb ? k - nb : 0);
+	hi = (k < na ? k : na);
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		j = k - i;
+		/* A[i] goes before B[j - 1], so more than i records come from A */
+		if (!c->less(src + (b0 + j - 1) * sz, src + (a0 + i) * sz, c->arg))
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	return lo;
+}
+
+static const struct st_sort_ops generic_ops = {
+	.sort_chunk	= &generic_sort_chunk,
+	.merge		= &generic_merge,
+	.corank		= &generic_corank,
+};
+
+int st_sort(void *base, unsigned long n, size_t size,
+		int (*less)(const void *a, const void *b, void *arg), void *arg)
+{
+	struct sort_ctx ctx;
+
+	ctx.size = size;
+	ctx.less = less;
+	ctx.arg  = arg;
+	return __st_sort(base, n, size, &generic_ops, &ctx);
+}
+
+struct sort_ptr_arg {
+	int (*is_superior)(void *, void *);
+};
+
+static int sort_ptr_less(const void *a, const void *b, void *arg)
+{
+	const struct sort_ptr_arg *p = arg;
+
+	return p->is_superior(*(void * const *)a, *(void * const *)b);
+}
+
+int st_sort_ptr(void **base, unsigned long n, int (*is_superior)(void *v1, void *v2))
+{
+	struct sort_ptr_arg p;
+
+	p.is_superior = is_superior;
+	return st_sort(base, n, sizeof(void *), &sort_ptr_less, &p);
+}
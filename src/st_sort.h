@@ -0,0 +1,208 @@
+#ifndef ST_SORT_H
+#define ST_SORT_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ST_SORT_MAX_THREADS	64
+/* below that many records per thread, threads cost more than they bring */
+#define ST_SORT_MIN_CHUNK	8192
+/* runs shorter than that are sorted by insertion */
+#define ST_SORT_RUN		16
+
+/* number of threads sort functions may use, set by option '-j' */
+extern int st_sort_threads;
+
+/* st_parallel_run: call fn on 'nr' jobs, each one in its own thread
+ * the last job runs in the calling thread; if a thread can't be created
+ * its job runs in the calling thread too
+ * fn must not call st_malloc/st_free (memory accounting is not thread-safe)
+ * @fn   : the function to run
+ * @jobs : an array of 'nr' jobs of 'size' bytes, passed to fn
+ * @nr   : number of jobs
+ * @size : size of a job
+ */
+void st_parallel_run(void *(*fn)(void *), void *jobs, int nr, size_t size);
+
+/* st_sort: stable merge sort of 'n' records of 'size' bytes
+ * chunks are sorted by up to st_sort_threads threads, then merged in parallel
+ * the result doesn't depend on the number of threads
+ * @base : the records
+ * @n    : number of records
+ * @size : size of a record
+ * @less : returns non-zero if record 'a' must be placed strictly before 'b'
+ * @arg  : passed to less
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int st_sort(void *base, unsigned long n, size_t size,
+		int (*less)(const void *a, const void *b, void *arg), void *arg);
+
+/* st_sort_ptr: stable sort of an array of pointers
+ * @base        : the pointers
+ * @n           : number of pointers
+ * @is_superior : returns non-zero if v1 must be placed strictly before v2
+ *                (same semantic as a heap compare function)
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int st_sort_ptr(void **base, unsigned long n, int (*is_superior)(void *v1, void *v2));
+
+/* the per-record work of a sort; only called once per chunk or merge piece
+ * sort_chunk : sort src[lo, hi), dst[lo, hi) is free to use
+ * merge      : stable merge of src[a0, a1) & src[b0, b1) into dst[k, ...)
+ * corank     : number of records of A = src[a0, a0 + na) in the first 'k'
+ *              records of the merge of A & B = src[b0, b0 + nb)
+ */
+struct st_sort_ops {
+	void (*sort_chunk)(void *src, void *dst, unsigned long lo, unsigned long hi,
+			void *arg);
+	void (*merge)(const void *src, void *dst, unsigned long a0, unsigned long a1,
+			unsigned long b0, unsigned long b1, unsigned long k, void *arg);
+	unsigned long (*corank)(const void *src, unsigned long a0, unsigned long na,
+			unsigned long b0, unsigned long nb, unsigned long k, void *arg);
+};
+
+/* __st_sort: stable parallel merge sort driven by 'ops'
+ * st_sort and ST_SORT_DEFINE sorts are built on it
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int __st_sort(void *base, unsigned long n, size_t size,
+		const struct st_sort_ops *ops, void *arg);
+
+/* ST_SORT_DEFINE: define 'static int name(type *base, unsigned long n)'
+ * a stable sort of an array of 'type', same algorithm as st_sort
+ * but 'less(a, b)' is expanded in the loops instead of being called through
+ * a pointer, so it can be a macro or an inline function
+ * less(a, b) gets two records by value and returns non-zero if 'a' must be
+ * placed strictly before 'b'; sort pointers rather than large structures
+ * sorted chunks are not touched, and merges gallop over the records already
+ * in place: sorted input costs n comparisons, nearly sorted input few more
+ */
+#define ST_SORT_DEFINE(name, type, less)					\
+static void name##_merge(const void *__src, void *__dst,			\
+		unsigned long a0, unsigned long a1,				\
+		unsigned long b0, unsigned long b1, unsigned long k, void *arg)	\
+{										\
+	const typeof(type) *src = __src;					\
+	typeof(type) *dst = __dst;						\
+	unsigned long lo, hi, mid, d, e = b1;					\
+										\
+	if (a0 < a1 && b0 < b1) {						\
+		/* gallop: A records not placed after B[b0] are in place */	\
+		lo = a0;							\
+		for (d = 1; d <= a1 - a0 && !less(src[b0], src[a0 + d - 1]); d *= 2)\
+			lo = a0 + d;						\
+		hi = (d <= a1 - a0 ? a0 + d - 1 : a1);				\
+		while (lo < hi) {						\
+			mid = lo + (hi - lo) / 2;				\
+			if (less(src[b0], src[mid]))				\
+				hi = mid;					\
+			else							\
+				lo = mid + 1;					\
+		}								\
+		memcpy(dst + k, src + a0, (lo - a0) * sizeof(type));		\
+		k += lo - a0;							\
+		a0 = lo;							\
+	}									\
+	if (a0 < a1 && b0 < b1) {						\
+		/* and so are B records not placed before A[a1 - 1] */		\
+		hi = b1;							\
+		for (d = 1; d <= b1 - b0 && !less(src[b1 - d], src[a1 - 1]); d *= 2)\
+			hi = b1 - d;						\
+		lo = (d <= b1 - b0 ? b1 - d + 1 : b0);				\
+		while (lo < hi) {						\
+			mid = lo + (hi - lo) / 2;				\
+			if (less(src[mid], src[a1 - 1]))			\
+				lo = mid + 1;					\
+			else							\
+				hi = mid;					\
+		}								\
+		e = lo;								\
+	}									\
+	memcpy(dst + k + (a1 - a0) + (e - b0), src + e, (b1 - e) * sizeof(type));\
+	while (a0 < a1 && b0 < e) {						\
+		if (less(src[b0], src[a0]))					\
+			dst[k++] = src[b0++];					\
+		else								\
+			dst[k++] = src[a0++];					\
+	}									\
+	while (a0 < a1)								\
+		dst[k++] = src[a0++];						\
+	while (b0 < e)								\
+		dst[k++] = src[b0++];						\
+}										\
+										\
+static void name##_sort_chunk(void *__src, void *__dst,				\
+		unsigned long lo, unsigned long hi, void *arg)			\
+{										\
+	typeof(type) *src = __src, *dst = __dst, *swap, x;			\
+	unsigned long s, m, e, i, k, w;						\
+										\
+	/* already sorted chunk */						\
+	for (i = lo + 1; i < hi && !less(src[i], src[i - 1]); i++)		\
+		;								\
+	if (i >= hi)								\
+		return;								\
+	for (s = lo; s < hi; s += ST_SORT_RUN) {				\
+		e = (s + ST_SORT_RUN < hi ? s + ST_SORT_RUN : hi);		\
+		for (i = s + 1; i < e; i++) {					\
+			if (!less(src[i], src[i - 1]))				\
+				continue;					\
+			x = src[i];						\
+			for (k = i; k > s && less(x, src[k - 1]); k--)		\
+				src[k] = src[k - 1];				\
+			src[k] = x;						\
+		}								\
+	}									\
+	for (w = ST_SORT_RUN; w < hi - lo; w *= 2) {				\
+		for (s = lo; s < hi; s += 2 * w) {				\
+			m = (s + w < hi ? s + w : hi);				\
+			e = (s + 2 * w < hi ? s + 2 * w : hi);			\
+			name##_merge(src, dst, s, m, m, e, s, arg);		\
+		}								\
+		swap = src;							\
+		src  = dst;							\
+		dst  = swap;							\
+	}									\
+	if (src != __src)							\
+		memcpy((typeof(type) *)__src + lo, src + lo,			\
+				(hi - lo) * sizeof(type));			\
+}										\
+										\
+static unsigned long name##_corank(const void *__src,				\
+		unsigned long a0, unsigned long na,				\
+		unsigned long b0, unsigned long nb, unsigned long k, void *arg)	\
+{										\
+	const typeof(type) *src = __src;					\
+	unsigned long lo, hi, i;						\
+										\
+	lo = (k > nb ? k - nb : 0);						\
+	hi = (k < na ? k : na);							\
+	while (lo < hi) {							\
+		i = lo + (hi - lo) / 2;						\
+		if (!less(src[b0 + k - i - 1], src[a0 + i]))			\
+			lo = i + 1;						\
+		else								\
+			hi = i;							\
+	}									\
+	return lo;								\
+}										\
+										\
+static const struct st_sort_ops name##_ops = {					\
+	.sort_chunk	= &name##_sort_chunk,					\
+	.merge		= &name##_merge,					\
+	.corank		= &name##_corank,					\
+};										\
+										\
+static int name(type *base, unsigned long n)					\
+{										\
+	return __st_sort(base, n, sizeof(type), &name##_ops, NULL);		\
+}
+
+#else
+#endif
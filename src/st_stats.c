@@ -20,19 +20,7 @@
 #include "st_printf.h"
 
 
-unsigned int hash_ipaddr(const void *key, int len)
-{
-	const struct ip_addr *a = key;
-
-	if (a->ip_ver == IPV4_A)
-		return djb_hash(&a->ip, 4);
-	if (a->ip_ver == IPV6_A)
-		return djb_hash(&a->ip6, 16);
-	fprintf(stderr, "cannot hash unknown ip version %d\n", a->ip_ver);
-	return 0;
-}
-
-unsigned int hash_subnet(const void *key, int len)
+static unsigned int hash_subnet(const void *key, int len)
 {
 	const struct subnet *a = key;
 
@@ -0,0 +1,100 @@
+/*
+ * string pool, used to share device names and EA values between routes
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "st_memory.h"
+#include "st_hashtab.h"
+#include "st_strpool.h"
+
+#define STRPOOL_CHUNK_SIZE	(64 * 1024)
+
+/* open addressing hash table of the pool strings */
+struct strpool {
+	const char **slots;
+	unsigned int *hash; /* hash of slots[i], to skip most strcmp */
+	unsigned long size; /* power of two */
+	unsigned long nr;
+	struct st_arena strings; /* strings are never freed one by one */
+};
+
+static struct strpool pool;
+
+static int strpool_grow(void)
+{
+	const char **slots;
+	unsigned int *hash;
+	unsigned long i, h, size;
+
+	if (pool.size == 0)
+		st_arena_init(&pool.strings, STRPOOL_CHUNK_SIZE);
+	size  = (pool.size ? pool.size * 2 : 1024);
+	slots = st_malloc(size * sizeof(char *), "string pool");
+	hash  = st_malloc(size * sizeof(unsigned int), "string pool");
+	if (slots == NULL || hash == NULL) {
+		st_free(slots, size * sizeof(char *));
+		st_free(hash, size * sizeof(unsigned int));
+		return -1;
+	}
+	memset(slots, 0, size * sizeof(char *));
+	for (i = 0; i < pool.size; i++) {
+		if (pool.slots[i] == NULL)
+			continue;
+		h = pool.hash[i] & (size - 1);
+		while (slots[h])
+			h = (h + 1) & (size - 1);
+		slots[h] = pool.slots[i];
+		hash[h]  = pool.hash[i];
+	}
+	st_free(pool.slots, pool.size * sizeof(char *));
+	st_free(pool.hash, pool.size * sizeof(unsigned int));
+	pool.slots = slots;
+	pool.hash  = hash;
+	pool.size  = size;
+	return 1;
+}
+
+const char *st_intern(const char *s)
+{
+	unsigned long len, h;
+	unsigned int hv;
+	char *p;
+
+	if (2 * (pool.nr + 1) >= pool.size && strpool_grow() < 0)
+		return NULL;
+	len = strlen(s);
+	hv  = fnv_hash(s, len);
+	h   = hv & (pool.size - 1);
+	while (pool.slots[h]) {
+		if (pool.hash[h] == hv && !strcmp(pool.slots[h], s))
+			return pool.slots[h];
+		h = (h + 1) & (pool.size - 1);
+	}
+	p = st_arena_alloc(&pool.strings, len + 1);
+	if (p == NULL)
+		return NULL;
+	memcpy(p, s, len + 1);
+	pool.slots[h] = p;
+	pool.hash[h]  = hv;
+	pool.nr++;
+	debug(MEMORY, 7, "new pool string '%s'\n", p);
+	return p;
+}
+
+void st_strpool_free(void)
+{
+	if (pool.nr)
+		debug(MEMORY, 4, "string pool: %lu strings\n", pool.nr);
+	st_arena_free(&pool.strings);
+	st_free(pool.slots, pool.size * sizeof(char *));
+	st_free(pool.hash, pool.size * sizeof(unsigned int));
+	memset(&pool, 0, sizeof(pool));
+}
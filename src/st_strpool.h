@@ -0,0 +1,25 @@
+#ifndef ST_STRPOOL_H
+#define ST_STRPOOL_H
+
+/*
+ * string pool; one copy of each distinct string, shared by all its users
+ * route files have few distinct devices and comments, so routes point to
+ * pool strings instead of owning a private copy
+ * pool strings live until st_strpool_free() and MUST NOT be modified
+ */
+
+/* st_intern: get the pool copy of a string, adding it if needed
+ * @s : the string
+ * returns:
+ *	a pointer to the pool copy; two equal strings get the same pointer
+ *	NULL on ENOMEM
+ */
+const char *st_intern(const char *s);
+
+/* st_strpool_free: release all pool strings
+ * must only be called when no object references them anymore
+ */
+void st_strpool_free(void);
+
+#else
+#endif
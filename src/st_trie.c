@@ -0,0 +1,360 @@
+/*
+ * path-compressed binary prefix trie (Patricia) over IPv4 & IPv6 prefixes
+ *
+ * Copyright (C) 2015 Etienne Basset <etienne POINT basset AT ensta POINT org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "iptools.h"
+#include "st_memory.h"
+#include "st_routes_csv.h"
+#include "st_trie.h"
+
+/* value of bit number 'pos' of prefix s; bit 0 is the most significant */
+static inline int trie_bit(const struct subnet *s, int pos)
+{
+	if (s->ip_ver == IPV4_A)
+		return (s->ip >> (31 - pos)) & 1;
+	return (block(s->ip6, pos / 16) >> (15 - pos % 16)) & 1;
+}
+
+/* number of leading bits a & b have in common, at most 'max' */
+static inline int trie_common_bits(const struct subnet *a, const struct subnet *b, int max)
+{
+	int i, n;
+	unsigned int x;
+
+	if (a->ip_ver == IPV4_A) {
+		x = a->ip ^ b->ip;
+		n = (x == 0 ? 32 : __builtin_clz(x));
+		return (n < max ? n : max);
+	}
+	n = 128;
+	for (i = 0; i < 8; i++) {
+		x = block(a->ip6, i) ^ block(b->ip6, i);
+		if (x) {
+			n = i * 16 + __builtin_clz(x) - (8 * sizeof(x) - 16);
+			break;
+		}
+	}
+	return (n < max ? n : max);
+}
+
+int alloc_st_trie(struct st_trie *t, unsigned long n)
+{
+	unsigned long i;
+
+	t->root4 = NULL;
+	t->root6 = NULL;
+	t->nr = 0;
+	t->index_nr = n;
+	/* each insert creates at most 2 nodes */
+	t->max_nr = 2 * n + 2;
+	if (t->max_nr > ST_TRIE_MAX_NODES) {
+		fprintf(stderr, "error: too many prefixes to fit in a trie\n");
+		return -1;
+	}
+	t->nodes = st_malloc(t->max_nr * sizeof(struct st_trie_node), "trie nodes");
+	if (t->nodes == NULL)
+		return -1;
+	t->next = st_malloc((n + 1) * sizeof(long), "trie index chain");
+	if (t->next == NULL) {
+		st_free(t->nodes, t->max_nr * sizeof(struct st_trie_node));
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		t->next[i] = -1;
+	return 1;
+}
+
+void free_st_trie(struct st_trie *t)
+{
+	st_free(t->nodes, t->max_nr * sizeof(struct st_trie_node));
+	st_free(t->next, (t->index_nr + 1) * sizeof(long));
+	t->nodes = NULL;
+	t->next = NULL;
+	t->root4 = t->root6 = NULL;
+	t->nr = t->max_nr = t->index_nr = 0;
+}
+
+static struct st_trie_node *new_trie_node(struct st_trie *t, const struct subnet *s,
+		int mask)
+{
+	struct st_trie_node *n;
+
+	if (t->nr >= t->max_nr)
+		return NULL;
+	n = &t->nodes[t->nr++];
+	copy_subnet(&n->prefix, s);
+	n->prefix.mask = mask;
+	n->child[0] = n->child[1] = NULL;
+	n->first = n->last = -1;
+	n->min = -1;
+	return n;
+}
+
+static inline void trie_node_update_min(struct st_trie_node *n, long index)
+{
+	if (n->min == -1 || index < n->min)
+		n->min = index;
+}
+
+static void trie_node_add_index(struct st_trie *t, struct st_trie_node *n, unsigned long index)
+{
+	trie_node_update_min(n, index);
+	t->next[index] = -1;
+	if (n->first == -1) {
+		n->first = n->last = index;
+		return;
+	}
+	t->next[n->last] = index;
+	n->last = index;
+}
+
+int st_trie_insert(struct st_trie *t, const struct subnet *s, unsigned long index)
+{
+	struct st_trie_node **link, *n, *x, *glue;
+	int cb;
+
+	if (index >= t->index_nr) {
+		debug(TRIE, 1, "BUG, index %lu too large, max %lu\n", index, t->index_nr);
+		return -1;
+	}
+	if (s->ip_ver == IPV4_A)
+		link = &t->root4;
+	else if (s->ip_ver == IPV6_A)
+		link = &t->root6;
+	else
+		return -1;
+
+	while (1) {
+		n = *link;
+		if (n == NULL) {
+			x = new_trie_node(t, s, s->mask);
+			if (x == NULL)
+				return -1;
+			trie_node_add_index(t, x, index);
+			*link = x;
+			return 1;
+		}
+		cb = trie_common_bits(&n->prefix, s,
+				(n->prefix.mask < s->mask ? n->prefix.mask : s->mask));
+		if (cb == n->prefix.mask && cb == s->mask) {
+			/* same prefix */
+			trie_node_add_index(t, n, index);
+			return 1;
+		}
+		if (cb == n->prefix.mask) {
+			/* n includes s, go down */
+			trie_node_update_min(n, index);
+			link = &n->child[trie_bit(s, cb)];
+			continue;
+		}
+		if (cb == s->mask) {
+			/* s includes n, insert s above */
+			x = new_trie_node(t, s, s->mask);
+			if (x == NULL)
+				return -1;
+			trie_node_add_index(t, x, index);
+			trie_node_update_min(x, n->min);
+			x->child[trie_bit(&n->prefix, cb)] = n;
+			*link = x;
+			return 1;
+		}
+		/* s & n diverge at bit 'cb', need a glue node */
+		glue = new_trie_node(t, s, cb);
+		x = new_trie_node(t, s, s->mask);
+		if (glue == NULL || x == NULL)
+			return -1;
+		trie_node_add_index(t, x, index);
+		trie_node_update_min(glue, index);
+		trie_node_update_min(glue, n->min);
+		glue->child[trie_bit(s, cb)] = x;
+		glue->child[trie_bit(&n->prefix, cb)] = n;
+		*link = glue;
+		return 1;
+	}
+}
+
+int st_trie_load_subnet_file(struct st_trie *t, const struct subnet_file *sf)
+{
+	unsigned long i;
+	int res;
+
+	res = alloc_st_trie(t, sf->nr);
+	if (res < 0)
+		return res;
+	for (i = 0; i < sf->nr; i++) {
+		res = st_trie_insert(t, &sf->routes[i].subnet, i);
+		if (res < 0) {
+			debug(TRIE, 3, "route %lu has invalid IP version %d\n", i,
+					sf->routes[i].subnet.ip_ver);
+			continue;
+		}
+	}
+	debug(TRIE, 3, "%lu routes loaded, %lu nodes used\n", sf->nr, t->nr);
+	return 1;
+}
+
+int st_trie_lookup(const struct st_trie *t, const struct subnet *s, struct st_trie_match *m)
+{
+	const struct st_trie_node *n;
+	int mask;
+
+	m->equals = NULL;
+	m->included = NULL;
+	m->below[0] = m->below[1] = NULL;
+	if (s->ip_ver == IPV4_A)
+		n = t->root4;
+	else if (s->ip_ver == IPV6_A)
+		n = t->root6;
+	else
+		return 0;
+
+	while (n) {
+		mask = n->prefix.mask;
+		if (mask > s->mask) {
+			/* n is deeper; s includes the whole subtree, or nothing */
+			if (trie_common_bits(&n->prefix, s, s->mask) == s->mask)
+				m->below[0] = n;
+			break;
+		}
+		if (trie_common_bits(&n->prefix, s, mask) < mask)
+			break;
+		if (mask == s->mask) {
+			if (n->first != -1)
+				m->equals = n;
+			m->below[0] = n->child[0];
+			m->below[1] = n->child[1];
+			break;
+		}
+		if (n->first != -1)
+			m->included = n;
+		n = n->child[trie_bit(s, mask)];
+	}
+	return (m->equals || m->included || m->below[0] || m->below[1]);
+}
+
+unsigned long st_trie_node_index(const struct st_trie *t, const struct st_trie_node *n,
+		unsigned long *idx, unsigned long max)
+{
+	unsigned long k = 0;
+	long j;
+
+	if (n == NULL)
+		return 0;
+	for (j = n->first; j != -1 && k < max; j = t->next[j])
+		idx[k++] = j;
+	return k;
+}
+
+unsigned long st_trie_subtree_index(const struct st_trie *t, const struct st_trie_node *n,
+		unsigned long *idx, unsigned long max)
+{
+	const struct st_trie_node *stack[ST_TRIE_MAX_DEPTH];
+	unsigned long k = 0;
+	int sp = 0;
+
+	while (n && k < max) {
+		k += st_trie_node_index(t, n, idx + k, max - k);
+		if (n->child[0]) {
+			if (n->child[1])
+				stack[sp++] = n->child[1];
+			n = n->child[0];
+		} else if (n->child[1])
+			n = n->child[1];
+		else
+			n = (sp ? stack[--sp] : NULL);
+	}
+	return k;
+}
+
+/*
+ * st_trie_subtree_first helpers; a min-heap of candidates
+ * a candidate is either a whole subtree (key = its min index)
+ * or a position in the index chain of a node (key = that index)
+ */
+struct trie_candidate {
+	long key;
+	const struct st_trie_node *n; /* NULL for a chain position */
+};
+
+static void trie_heap_push(struct trie_candidate *h, int *nr, long key,
+		const struct st_trie_node *n)
+{
+	int i = (*nr)++;
+	struct trie_candidate c;
+
+	h[i].key = key;
+	h[i].n   = n;
+	while (i > 0 && h[(i - 1) / 2].key > h[i].key) {
+		c = h[i];
+		h[i] = h[(i - 1) / 2];
+		h[(i - 1) / 2] = c;
+		i = (i - 1) / 2;
+	}
+}
+
+static struct trie_candidate trie_heap_pop(struct trie_candidate *h, int *nr)
+{
+	struct trie_candidate top = h[0], c;
+	int i = 0, j;
+
+	h[0] = h[--(*nr)];
+	while (1) {
+		j = 2 * i + 1;
+		if (j >= *nr)
+			break;
+		if (j + 1 < *nr && h[j + 1].key < h[j].key)
+			j++;
+		if (h[i].key <= h[j].key)
+			break;
+		c = h[i];
+		h[i] = h[j];
+		h[j] = c;
+		i = j;
+	}
+	return top;
+}
+
+long st_trie_subtree_first(const struct st_trie *t, const struct st_trie_node **n, int nr,
+		unsigned long *idx, unsigned long max)
+{
+	struct trie_candidate *h;
+	struct trie_candidate c;
+	unsigned long k = 0, h_size;
+	int i, h_nr = 0;
+
+	/* each output is reached after at most ST_TRIE_MAX_DEPTH subtree expansions,
+	 * each expansion pops one candidate and pushes at most 3
+	 */
+	h_size = nr + 2 * (max + 1) * ST_TRIE_MAX_DEPTH;
+	h = st_malloc_nodebug(h_size * sizeof(struct trie_candidate), "trie heap");
+	if (h == NULL)
+		return -1;
+	for (i = 0; i < nr; i++)
+		if (n[i])
+			trie_heap_push(h, &h_nr, n[i]->min, n[i]);
+	while (h_nr > 0 && k < max) {
+		c = trie_heap_pop(h, &h_nr);
+		if (c.n == NULL) {
+			idx[k++] = c.key;
+			if (t->next[c.key] != -1)
+				trie_heap_push(h, &h_nr, t->next[c.key], NULL);
+			continue;
+		}
+		if (c.n->first != -1)
+			trie_heap_push(h, &h_nr, c.n->first, NULL);
+		for (i = 0; i < 2; i++)
+			if (c.n->child[i])
+				trie_heap_push(h, &h_nr, c.n->child[i]->min, c.n->child[i]);
+	}
+	st_free(h, h_size * sizeof(struct trie_candidate));
+	return k;
+}
@@ -0,0 +1,123 @@
+#ifndef ST_TRIE_H
+#define ST_TRIE_H
+
+#include "iptools.h"
+#include "st_routes_csv.h"
+
+/* a node can't be deeper than 128 bits, plus the root */
+#define ST_TRIE_MAX_DEPTH 130
+#define ST_TRIE_MAX_NODES (((unsigned long)0 - 1) / (4 * sizeof(struct st_trie_node)))
+
+/*
+ * path-compressed binary prefix trie (Patricia)
+ * a node holds a prefix; prefix.mask is the number of significant bits
+ * nodes with first == -1 are 'glue' nodes created where two branches diverge
+ * they always have two children
+ */
+struct st_trie_node {
+	struct subnet prefix;
+	struct st_trie_node *child[2];
+	long first; /* index of the first object with this exact prefix, -1 if none */
+	long last;  /* index of the last object with this exact prefix */
+	long min;   /* lowest index in the subtree rooted at this node */
+};
+
+struct st_trie {
+	struct st_trie_node *root4;
+	struct st_trie_node *root6;
+	struct st_trie_node *nodes; /* node pool */
+	unsigned long nr; /* number of nodes used */
+	unsigned long max_nr; /* number of nodes malloc'ed */
+	long *next; /* next[i] : next object with the same prefix as object i, -1 if none */
+	unsigned long index_nr; /* size of next[] */
+};
+
+/* result of a lookup; all pointers may be NULL
+ * equals   : node with the exact same prefix
+ * included : longest node strictly including the prefix (and holding objects)
+ * below    : subtrees strictly included in the prefix
+ */
+struct st_trie_match {
+	const struct st_trie_node *equals;
+	const struct st_trie_node *included;
+	const struct st_trie_node *below[2];
+};
+
+/* alloc_st_trie: alloc memory for a trie able to hold n prefixes
+ * @t : the trie to init
+ * @n : the max number of prefixes that will be inserted
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int alloc_st_trie(struct st_trie *t, unsigned long n);
+
+/* free_st_trie: release memory attached to a trie
+ * @t : the trie
+ */
+void free_st_trie(struct st_trie *t);
+
+/* st_trie_insert: insert prefix 's' in the trie
+ * 'index' is the position of the object carrying 's' in the caller's array
+ * objects with the same prefix are chained in insertion order
+ * @t     : the trie
+ * @s     : the prefix to insert
+ * @index : must be < n passed to alloc_st_trie
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on error (bad IP version, or trie full)
+ */
+int st_trie_insert(struct st_trie *t, const struct subnet *s, unsigned long index);
+
+/* st_trie_load_subnet_file: alloc a trie and insert all routes from 'sf'
+ * index of each prefix is its route number in sf
+ * returns:
+ *	1  on SUCCESS
+ *	-1 on ENOMEM
+ */
+int st_trie_load_subnet_file(struct st_trie *t, const struct subnet_file *sf);
+
+/* st_trie_lookup: find all relations of 's' with the prefixes of the trie
+ * O(W) where W is the address width
+ * @t : the trie
+ * @s : the prefix to look for
+ * @m : where to store the result
+ * returns:
+ *	1 if 's' has a relation (EQUALS, INCLUDES, INCLUDED) with a trie prefix
+ *	0 otherwise
+ */
+int st_trie_lookup(const struct st_trie *t, const struct subnet *s, struct st_trie_match *m);
+
+/* st_trie_node_index: store indexes of objects attached to node n (not its children)
+ * @t   : the trie
+ * @n   : the node
+ * @idx : an array where indexes are stored
+ * @max : size of idx
+ * returns:
+ *	number of indexes stored in idx
+ */
+unsigned long st_trie_node_index(const struct st_trie *t, const struct st_trie_node *n,
+		unsigned long *idx, unsigned long max);
+
+/* st_trie_subtree_index: same as above but for all nodes of the subtree rooted at 'n'
+ * indexes are stored in prefix order, NOT in insertion order
+ */
+unsigned long st_trie_subtree_index(const struct st_trie *t, const struct st_trie_node *n,
+		unsigned long *idx, unsigned long max);
+
+/* st_trie_subtree_first: store the 'max' lowest indexes of the subtrees rooted at n[]
+ * indexes are stored in ascending order; cost depends on 'max', not on subtrees size
+ * @t     : the trie
+ * @n     : an array of subtrees roots (NULL entries are ignored)
+ * @nr    : number of entries in n[]
+ * @idx   : an array where indexes are stored
+ * @max   : size of idx
+ * returns:
+ *	number of indexes stored in idx
+ *	-1 on ENOMEM
+ */
+long st_trie_subtree_first(const struct st_trie *t, const struct st_trie_node **n, int nr,
+		unsigned long *idx, unsigned long max);
+
+#else
+#endif
@@ -17,67 +17,92 @@
 #include "st_routes.h"
 #include "utils.h"
 #include "generic_csv.h"
-#include "heap.h"
 #include "st_memory.h"
+#include "st_readline.h"
 #include "st_printf.h"
 #include "generic_expr.h"
 #include "st_scanf.h"
 #include "st_routes_csv.h"
+#include "st_trie.h"
+#include "st_prefix_hash.h"
+#include "st_dir24.h"
+#include "st_mtrie.h"
+#include "st_radix.h"
+#include "st_route_cols.h"
 #include "subnet_tool.h"
 
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
 /*
  * compare 2 CSV files sf1 and sf1
  * prints sf1 subnets, and subnet from sf2 that are equals or included
+ * sf2 is indexed in a prefix trie, so each sf1 subnet costs O(W + number of matches)
+ * output order is the same as a full O(n*m) scan of sf2
  */
-void compare_files(struct subnet_file *sf1, struct subnet_file *sf2,
+int compare_files(struct subnet_file *sf1, struct subnet_file *sf2,
 		struct st_options *nof)
 {
-	unsigned long i, j, found_j;
+	unsigned long i, j, k, n;
+	unsigned long *idx;
 	int res;
-	int find = 0, mask, found_mask;
+	struct st_trie trie;
+	struct st_trie_match m;
+	const struct route *r, *r2;
 
+	res = st_trie_load_subnet_file(&trie, sf2);
+	if (res < 0)
+		return res;
+	idx = st_malloc((sf2->nr + 1) * sizeof(unsigned long), "compare index");
+	if (idx == NULL) {
+		free_st_trie(&trie);
+		return -1;
+	}
 	for (i = 0; i < sf1->nr; i++) {
-		find = 0;
-		found_mask = -1;
-		for (j = 0; j < sf2->nr; j++) {
-			res = subnet_compare(&sf1->routes[i].subnet, &sf2->routes[j].subnet);
-			if (res == INCLUDES) {
-				st_fprintf(nof->output_file, "%I;%m;INCLUDES;%I;%m\n",
-						sf1->routes[i].subnet, sf1->routes[i].subnet,
-						sf2->routes[j].subnet,  sf2->routes[j].subnet);
-				find = 1;
-			} else if (res == EQUALS) {
-				st_fprintf(nof->output_file, "%I;%m;EQUALS;%I;%m\n",
-						sf1->routes[i].subnet, sf1->routes[i].subnet,
-						sf2->routes[j].subnet,  sf2->routes[j].subnet);
-				find = 2;
-			} else if (res == INCLUDED) {
-				find = 1;
-				mask = sf2->routes[j].subnet.mask;
-				if (mask > found_mask) {
-					found_mask = mask;
-					found_j = j;
-				}
-			}
+		r = &sf1->routes[i];
+		st_trie_lookup(&trie, &r->subnet, &m);
+		n = st_trie_node_index(&trie, m.equals, idx, sf2->nr);
+		for (k = 0; k < 2; k++)
+			n += st_trie_subtree_index(&trie, m.below[k], idx + n, sf2->nr - n);
+		/* print EQUALS & INCLUDES in sf2 order */
+		qsort(idx, n, sizeof(unsigned long), &cmp_ulong);
+		for (k = 0; k < n; k++) {
+			r2 = &sf2->routes[idx[k]];
+			st_fprintf(nof->output_file, (r2->subnet.mask == r->subnet.mask ?
+						"%I;%m;EQUALS;%I;%m\n" : "%I;%m;INCLUDES;%I;%m\n"),
+					r->subnet, r->subnet, r2->subnet, r2->subnet);
 		}
-		if (find == 0)
-			st_fprintf(nof->output_file, "%I;%m;;;\n",
-					sf1->routes[i].subnet, sf1->routes[i].subnet);
-		else if (found_mask > 0)
+		if (n == 0 && m.included == NULL) {
+			st_fprintf(nof->output_file, "%I;%m;;;\n", r->subnet, r->subnet);
+		} else if (m.included && m.included->prefix.mask > 0) {
+			/* longest INCLUDED, first in file order */
+			j = m.included->first;
+			r2 = &sf2->routes[j];
 			st_fprintf(nof->output_file, "%I;%m;INCLUDED;%I;%m\n",
-					sf1->routes[i].subnet, sf1->routes[i].subnet,
-					sf2->routes[found_j].subnet, sf2->routes[found_j].subnet);
+					r->subnet, r->subnet, r2->subnet, r2->subnet);
+		}
 	}
+	st_free(idx, (sf2->nr + 1) * sizeof(unsigned long));
+	free_st_trie(&trie);
+	return 1;
 }
 
 int subnet_file_cmp(const struct subnet_file *before, const struct subnet_file *after,
 			struct subnet_file *sf)
 {
 	unsigned long i, j, k;
-	int res, found;
+	long found;
+	int res, same_dev;
 	int ea_nr;
 	char buffer[128];
 	char **new_ea;
+	struct prefix_hash ph;
+	unsigned char *seen;
 
 	k = 0;
 	res = alloc_subnet_file(sf, before->nr + after->nr);
@@ -94,145 +119,402 @@ int subnet_file_cmp(const struct subnet_file *before, const struct subnet_file *
 	if (sf->ea[sf->ea_nr - 1] == NULL || sf->ea[sf->ea_nr - 2] == NULL)
 		return -1;
 
+	/* index 'after' once, used in both directions */
+	res = alloc_prefix_hash(&ph, after->nr);
+	if (res < 0)
+		return res;
+	for (j = 0; j < after->nr; j++)
+		prefix_hash_insert(&ph, &after->routes[j].subnet, j);
+	/* seen[j] : a 'before' route EQUALS after route j (j is first route of its prefix) */
+	seen = st_malloc(after->nr + 1, "subnetcmp seen");
+	if (seen == NULL) {
+		free_prefix_hash(&ph);
+		return -1;
+	}
+	memset(seen, 0, after->nr + 1);
 	for (i = 0; i < before->nr; i++) {
-		found = 0;
-		for (j = 0; j < after->nr; j++) {
-			res = subnet_compare(&after->routes[j].subnet, &before->routes[i].subnet);
-			if (res == EQUALS) {
-				found = 1;
-				break;
-			}
-		}
+		found = prefix_hash_find(&ph, &before->routes[i].subnet);
 		clone_route_nofree(&sf->routes[k], &before->routes[i]);
 		ea_nr = sf->routes[k].ea_nr;
 		res = realloc_route_ea(&sf->routes[k], sf->routes[k].ea_nr + 2);
 		if (res < 0) {
 			sf->nr = k + 1;
+			st_free(seen, after->nr + 1);
+			free_prefix_hash(&ph);
 			return -1;
 		}
 		sf->routes[k].ea[ea_nr].name = "status";
 		sf->routes[k].ea[ea_nr + 1].name = "change";
-		if (found == 0) {
-			ea_strdup(&sf->routes[k].ea[ea_nr], "removed");
-			ea_strdup(&sf->routes[k].ea[ea_nr + 1], "removed");
+		if (found < 0) {
+			ea_intern(&sf->routes[k].ea[ea_nr], "removed");
+			ea_intern(&sf->routes[k].ea[ea_nr + 1], "removed");
 		} else {
-			if (!is_equal_gw(&after->routes[j], &before->routes[i]) &&
-					strcmp(after->routes[j].device, before->routes[i].device)) {
-				ea_strdup(&sf->routes[k].ea[ea_nr], "changed");
+			j = found;
+			seen[j] = 1;
+			/* devices are pool strings, most are equal by pointer */
+			same_dev = (after->routes[j].device == before->routes[i].device ||
+					!strcmp(after->routes[j].device, before->routes[i].device));
+			if (!is_equal_gw(&after->routes[j], &before->routes[i]) && !same_dev) {
+				ea_intern(&sf->routes[k].ea[ea_nr], "changed");
 				st_snprintf(buffer, sizeof(buffer), "new Device/GW: %s/%a",
 						after->routes[j].device, after->routes[j].gw);
 				ea_strdup(&sf->routes[k].ea[ea_nr + 1], buffer);
 			} else if (!is_equal_gw(&after->routes[j], &before->routes[i])) {
-				ea_strdup(&sf->routes[k].ea[ea_nr], "changed");
+				ea_intern(&sf->routes[k].ea[ea_nr], "changed");
 				st_snprintf(buffer, sizeof(buffer), "new GW: %a",
 						after->routes[j].gw);
 				ea_strdup(&sf->routes[k].ea[ea_nr + 1], buffer);
-			} else if (strcmp(after->routes[j].device, before->routes[i].device)) {
-				ea_strdup(&sf->routes[k].ea[ea_nr], "changed");
-				ea_strdup(&sf->routes[k].ea[ea_nr + 1], "new device");
+			} else if (!same_dev) {
+				ea_intern(&sf->routes[k].ea[ea_nr], "changed");
+				ea_intern(&sf->routes[k].ea[ea_nr + 1], "new device");
 			}
 		}
 		k++;
 	}
 	for (j = 0; j < after->nr; j++) {
-		found = 0;
-		for (i = 0; i < before->nr; i++) {
-			res = subnet_compare(&after->routes[j].subnet, &before->routes[i].subnet);
-			if (res == EQUALS) {
-				found = 1;
-				break;
-			}
-		}
-		if (found == 0) {
-			clone_route_nofree(&sf->routes[k], &after->routes[j]);
-			ea_nr = sf->routes[k].ea_nr;
-			res = realloc_route_ea(&sf->routes[k], sf->routes[k].ea_nr + 2);
-			if (res < 0) {
-				sf->nr = k + 1;
-				return -1;
-			}
-			sf->routes[k].ea[ea_nr].name = "status";
-			ea_strdup(&sf->routes[k].ea[ea_nr], "new");
-			k++;
+		found = prefix_hash_find(&ph, &after->routes[j].subnet);
+		if (found >= 0 && seen[found])
+			continue;
+		clone_route_nofree(&sf->routes[k], &after->routes[j]);
+		ea_nr = sf->routes[k].ea_nr;
+		res = realloc_route_ea(&sf->routes[k], sf->routes[k].ea_nr + 2);
+		if (res < 0) {
+			sf->nr = k + 1;
+			st_free(seen, after->nr + 1);
+			free_prefix_hash(&ph);
+			return -1;
 		}
+		sf->routes[k].ea[ea_nr].name = "status";
+		ea_intern(&sf->routes[k].ea[ea_nr], "new");
+		k++;
 	}
 	sf->nr = k;
+	st_free(seen, after->nr + 1);
+	free_prefix_hash(&ph);
 	return 1;
 }
 
-static int __heap_subnet_is_superior(void *v1, void *v2)
+/*
+ * sort routes on 'nr' ROUTE_KEY_* keys, then by prefix, IPv4 first
+ * sort is stable; keys are read from a columnar view of the file, packed
+ * into integer words and radix sorted; routes are moved once
+ * prefix only sorts pack their keys straight from the routes
+ * sorted files are detected in O(n) and not moved at all
+ */
+static int subnet_file_sort_keys(struct subnet_file *sf, const int *keys, int nr)
 {
-	struct subnet *s1 = &((struct route *)v1)->subnet;
-	struct subnet *s2 = &((struct route *)v2)->subnet;
+	unsigned long i, *order;
+	int j, res, cols = ROUTE_COLS_PREFIX;
+	struct route *new_r;
+	struct route_cols c;
 
-	return subnet_is_superior(s1, s2);
+	if (sf->nr < 2)
+		return 1;
+	order = st_malloc(sf->nr * sizeof(unsigned long), "sort order");
+	if (order == NULL)
+		return -1;
+	if (nr == 0) {
+		/* prefix keys are packed straight from the routes */
+		res = radix_prefix_order(sf->routes, sf->nr, sizeof(struct route),
+				offsetof(struct route, subnet), order);
+	} else {
+		for (j = 0; j < nr; j++)
+			if (keys[j] == ROUTE_KEY_GW)
+				cols |= ROUTE_COLS_GW;
+		res = route_cols_load(&c, sf, cols);
+		if (res > 0) {
+			res = route_cols_order(&c, keys, nr, order);
+			free_route_cols(&c);
+		}
+	}
+	/* already sorted, nothing to move */
+	if (res <= 0) {
+		st_free(order, sf->nr * sizeof(unsigned long));
+		return (res < 0 ? res : 1);
+	}
+	new_r = st_malloc(sf->max_nr * sizeof(struct route), "struct route");
+	if (new_r == NULL) {
+		st_free(order, sf->nr * sizeof(unsigned long));
+		return -1;
+	}
+	for (i = 0; i < sf->nr; i++)
+		copy_route(&new_r[i], &sf->routes[order[i]]);
+	st_free(order, sf->nr * sizeof(unsigned long));
+	st_free(sf->routes, sf->max_nr * sizeof(struct route));
+	sf->routes = new_r;
+	return 1;
 }
 
-static void __heap_print_subnet(void *v)
+/* sort routes by prefix; same order as subnet_is_before() but stable */
+static int subnet_file_sort_prefix(struct subnet_file *sf)
 {
-	struct subnet *s = &((struct route *)v)->subnet;
+	return subnet_file_sort_keys(sf, NULL, 0);
+}
+
+/*
+ * sorted-merge sweep of 2 subnet files
+ * both files are sorted by prefix (network address, then mask) and merged;
+ * while walking the merged list, a stack holds all the ancestors of the current prefix
+ * for each route, it stores in rel1[] (sf1 routes) and rel2[] (sf2 routes)
+ * the relations the route has with the OTHER file :
+ *  SWEEP_EQUALS   : other file has the same prefix
+ *  SWEEP_INCLUDED : other file has a prefix strictly including it
+ *  SWEEP_INCLUDES : other file has a prefix strictly included in it
+ * O(n.log(n) + m.log(m))
+ */
+#define SWEEP_EQUALS	1
+#define SWEEP_INCLUDED	2
+#define SWEEP_INCLUDES	4
+/* a stack entry strictly includes the one above it, so depth is bounded */
+#define SWEEP_MAX_DEPTH	130
+
+struct sweep_prefix {
+	struct subnet net; /* host bits cleared */
+	unsigned long index;
+};
 
-	st_printf("%P", *s);
+/* all routes sharing the same prefix */
+struct sweep_group {
+	struct subnet net;
+	unsigned long start[2]; /* position of the group in the sorted arrays */
+	unsigned long has[2];   /* number of routes of sf1/sf2 with this prefix */
+	int anc[2];  /* sf1/sf2 has a prefix strictly including net */
+	int desc[2]; /* sf1/sf2 has a prefix strictly included in net */
+};
+
+static int sweep_net_cmp(const struct subnet *s1, const struct subnet *s2)
+{
+	int i;
+
+	if (s1->ip_ver != s2->ip_ver)
+		return s1->ip_ver - s2->ip_ver;
+	if (s1->ip_ver == IPV4_A) {
+		if (s1->ip != s2->ip)
+			return (s1->ip < s2->ip ? -1 : 1);
+	} else {
+		for (i = 0; i < 8; i++)
+			if (block(s1->ip6, i) != block(s2->ip6, i))
+				return (block(s1->ip6, i) < block(s2->ip6, i) ? -1 : 1);
+	}
+	return s1->mask - s2->mask;
+}
+
+/* does a include or equal b ? a & b are normalized */
+static int sweep_contains(const struct subnet *a, const struct subnet *b)
+{
+	int res;
+
+	if (a->ip_ver != b->ip_ver || a->mask > b->mask)
+		return 0;
+	if (a->mask == 0)
+		return 1;
+	if (a->ip_ver == IPV4_A)
+		return !((a->ip ^ b->ip) >> (32 - a->mask));
+	res = subnet_compare(b, a);
+	return (res == INCLUDED || res == EQUALS);
+}
+
+/* prefixes of sf, host bits cleared, sorted by prefix then by index */
+static struct sweep_prefix *sweep_sort_file(const struct subnet_file *sf)
+{
+	struct sweep_prefix *p, *sorted;
+	struct subnet *s;
+	unsigned long i, *order;
+	int res;
+
+	p = st_malloc((sf->nr + 1) * sizeof(struct sweep_prefix), "sweep prefixes");
+	if (p == NULL)
+		return NULL;
+	for (i = 0; i < sf->nr; i++) {
+		s = &p[i].net;
+		copy_subnet(s, &sf->routes[i].subnet);
+		if (s->mask == 0)
+			memset(&s->ip6, 0, sizeof(s->ip6));
+		else
+			first_ip(s);
+		p[i].index = i;
+	}
+	if (sf->nr < 2)
+		return p;
+	sorted = st_malloc((sf->nr + 1) * sizeof(struct sweep_prefix), "sweep prefixes");
+	order  = st_malloc(sf->nr * sizeof(unsigned long), "sort order");
+	if (sorted == NULL || order == NULL) {
+		st_free(sorted, (sf->nr + 1) * sizeof(struct sweep_prefix));
+		st_free(order, sf->nr * sizeof(unsigned long));
+		st_free(p, (sf->nr + 1) * sizeof(struct sweep_prefix));
+		return NULL;
+	}
+	/* radix order is stable, equal prefixes stay in index order */
+	res = radix_prefix_order(p, sf->nr, sizeof(struct sweep_prefix),
+			offsetof(struct sweep_prefix, net), order);
+	if (res > 0)
+		for (i = 0; i < sf->nr; i++)
+			sorted[i] = p[order[i]];
+	st_free(order, sf->nr * sizeof(unsigned long));
+	if (res <= 0) {
+		st_free(sorted, (sf->nr + 1) * sizeof(struct sweep_prefix));
+		if (res < 0) {
+			st_free(p, (sf->nr + 1) * sizeof(struct sweep_prefix));
+			return NULL;
+		}
+		return p;
+	}
+	st_free(p, (sf->nr + 1) * sizeof(struct sweep_prefix));
+	return sorted;
+}
+
+/* set the relation of all routes of group g, propagate to its parent */
+static void sweep_pop_group(struct sweep_group *g, struct sweep_group *parent,
+		struct sweep_prefix *p[2], unsigned char *rel[2])
+{
+	unsigned long k;
+	int f, o;
+	unsigned char r;
+
+	for (f = 0; f < 2; f++) {
+		o = 1 - f;
+		r = (g->has[o] ? SWEEP_EQUALS : 0) | (g->anc[o] ? SWEEP_INCLUDED : 0) |
+			(g->desc[o] ? SWEEP_INCLUDES : 0);
+		for (k = g->start[f]; k < g->start[f] + g->has[f]; k++)
+			rel[f][p[f][k].index] = r;
+		if (parent && (g->has[f] || g->desc[f]))
+			parent->desc[f] = 1;
+	}
+}
+
+static int subnet_file_sweep(const struct subnet_file *sf1, const struct subnet_file *sf2,
+		unsigned char *rel1, unsigned char *rel2)
+{
+	struct sweep_group stack[SWEEP_MAX_DEPTH];
+	struct sweep_group *g, *top;
+	struct sweep_prefix *p[2];
+	unsigned char *rel[2];
+	unsigned long pos[2], nr[2];
+	const struct subnet *net;
+	int f, sp = 0;
+
+	debug_timing_start(3);
+	p[0] = sweep_sort_file(sf1);
+	if (p[0] == NULL) {
+		debug_timing_end(3);
+		return -1;
+	}
+	p[1] = sweep_sort_file(sf2);
+	if (p[1] == NULL) {
+		st_free(p[0], (sf1->nr + 1) * sizeof(struct sweep_prefix));
+		debug_timing_end(3);
+		return -1;
+	}
+	rel[0] = rel1;
+	rel[1] = rel2;
+	nr[0] = sf1->nr;
+	nr[1] = sf2->nr;
+	pos[0] = pos[1] = 0;
+	while (pos[0] < nr[0] || pos[1] < nr[1]) {
+		if (pos[1] >= nr[1] || (pos[0] < nr[0] &&
+				sweep_net_cmp(&p[0][pos[0]].net, &p[1][pos[1]].net) <= 0))
+			net = &p[0][pos[0]].net;
+		else
+			net = &p[1][pos[1]].net;
+		/* close all prefixes that dont include net */
+		while (sp > 0 && !sweep_contains(&stack[sp - 1].net, net)) {
+			sp--;
+			sweep_pop_group(&stack[sp], (sp ? &stack[sp - 1] : NULL), p, rel);
+		}
+		if (sp == SWEEP_MAX_DEPTH) {
+			debug(ADDRCOMP, 1, "BUG, sweep stack is full\n");
+			sp--;
+			sweep_pop_group(&stack[sp], (sp ? &stack[sp - 1] : NULL), p, rel);
+		}
+		top = (sp ? &stack[sp - 1] : NULL);
+		g = &stack[sp++];
+		copy_subnet(&g->net, net);
+		for (f = 0; f < 2; f++) {
+			g->start[f] = pos[f];
+			while (pos[f] < nr[f] && !sweep_net_cmp(&p[f][pos[f]].net, &g->net))
+				pos[f]++;
+			g->has[f] = pos[f] - g->start[f];
+			g->anc[f] = (top && (top->anc[f] || top->has[f]));
+			g->desc[f] = 0;
+		}
+	}
+	while (sp > 0) {
+		sp--;
+		sweep_pop_group(&stack[sp], (sp ? &stack[sp - 1] : NULL), p, rel);
+	}
+	st_free(p[0], (sf1->nr + 1) * sizeof(struct sweep_prefix));
+	st_free(p[1], (sf2->nr + 1) * sizeof(struct sweep_prefix));
+	debug_timing_end(3);
+	return 1;
+}
+
+/* alloc rel arrays and run the sweep */
+static int subnet_file_relations(const struct subnet_file *sf1, const struct subnet_file *sf2,
+		unsigned char **rel1, unsigned char **rel2)
+{
+	int res;
+
+	*rel1 = st_malloc(sf1->nr + 1, "sweep relations");
+	if (*rel1 == NULL)
+		return -1;
+	*rel2 = st_malloc(sf2->nr + 1, "sweep relations");
+	if (*rel2 == NULL) {
+		st_free(*rel1, sf1->nr + 1);
+		return -1;
+	}
+	res = subnet_file_sweep(sf1, sf2, *rel1, *rel2);
+	if (res < 0) {
+		st_free(*rel1, sf1->nr + 1);
+		st_free(*rel2, sf2->nr + 1);
+		return res;
+	}
+	return 1;
 }
+
 /*
  * get uniques routes from sf1 and sf2 INTO sf3
  **/
 int uniq_routes(const struct subnet_file *sf1, const struct subnet_file *sf2,
 		struct subnet_file *sf3)
 {
-	unsigned long i, j;
-	int res, find;
-	TAS tas;
-	struct route *r;
+	unsigned long i, j, k;
+	int res;
+	unsigned char *rel1, *rel2;
 
 	res = alloc_subnet_file(sf3, sf2->nr + sf1->nr);
 	if (res < 0)
 		return res;
-	res = alloc_tas(&tas, sf3->max_nr, __heap_subnet_is_superior);
-	if (res < 0) { /* out of mem */
+	res = subnet_file_relations(sf1, sf2, &rel1, &rel2);
+	if (res < 0) {
 		free_subnet_file(sf3);
 		return res;
 	}
-
+	k = 0;
+	/* sf3 had not EA alloced, so dont use clone_route */
 	for (i = 0; i < sf1->nr; i++) {
-		find = 0;
-		for (j = 0; j < sf2->nr; j++) {
-			res = subnet_compare(&sf1->routes[i].subnet, &sf2->routes[j].subnet);
-			if (res != NOMATCH) {
-				st_debug(ADDRCOMP, 4, "skipping %P, related with %P\n",
-						sf1->routes[i].subnet,
-						sf2->routes[j].subnet);
-				find = 1;
-				break;
-			}
+		if (rel1[i]) {
+			st_debug(ADDRCOMP, 4, "skipping %P, related with sf2\n",
+					sf1->routes[i].subnet);
+			continue;
 		}
-		if (find == 0)
-			addTAS(&tas, &sf1->routes[i]);
+		clone_route_nofree(&sf3->routes[k++], &sf1->routes[i]);
 	}
 	for (j = 0; j < sf2->nr; j++) {
-		find = 0;
-		for (i = 0; i < sf1->nr; i++) {
-			res = subnet_compare(&sf2->routes[j].subnet, &sf1->routes[i].subnet);
-			if (res != NOMATCH) {
-				st_debug(ADDRCOMP, 4, "skipping %P related with %P\n",
-						sf2->routes[j].subnet,
-						sf1->routes[i].subnet);
-				find = 1;
-				break;
-			}
+		if (rel2[j]) {
+			st_debug(ADDRCOMP, 4, "skipping %P, related with sf1\n",
+					sf2->routes[j].subnet);
+			continue;
 		}
-		if (find == 0)
-			addTAS(&tas, &sf2->routes[j]);
+		clone_route_nofree(&sf3->routes[k++], &sf2->routes[j]);
 	}
-	for (i = 0; ; i++) {
-		r = popTAS(&tas);
-		if (r == NULL)
-			break;
-		/* sf3 had not EA alloced, so dont use clone_route */
-		clone_route_nofree(&sf3->routes[i], r);
+	sf3->nr = k;
+	st_free(rel1, sf1->nr + 1);
+	st_free(rel2, sf2->nr + 1);
+	res = subnet_file_sort_prefix(sf3);
+	if (res < 0) {
+		free_subnet_file(sf3);
+		return res;
 	}
-	sf3->nr = i;
-	free_tas(&tas);
 	return 1;
 }
 
@@ -242,130 +524,148 @@ int uniq_routes(const struct subnet_file *sf1, const struct subnet_file *sf2,
 int missing_routes(const struct subnet_file *sf1, const struct subnet_file *sf2,
 		struct subnet_file *sf3)
 {
-	unsigned long i, j, k;
-	int res, find;
+	unsigned long i, k;
+	int res;
+	unsigned char *rel1, *rel2;
 
 	res = alloc_subnet_file(sf3, sf1->max_nr);
 	if (res < 0)
 		return res;
+	res = subnet_file_relations(sf1, sf2, &rel1, &rel2);
+	if (res < 0) {
+		free_subnet_file(sf3);
+		return res;
+	}
 	k = 0;
 	for (i = 0; i < sf1->nr; i++) {
-		find = 0;
-		for (j = 0; j < sf2->nr; j++) {
-			res = subnet_compare(&sf1->routes[i].subnet, &sf2->routes[j].subnet);
-			if (res == INCLUDED || res == EQUALS) {
-				st_debug(ADDRCOMP, 2, "skipping %P, included in %P\n",
-						sf1->routes[i].subnet,
-						sf2->routes[j].subnet);
-				find = 1;
-				break;
-			}
-		}
-		if (find == 0) {
-			clone_route_nofree(&sf3->routes[k], &sf1->routes[i]);
-			k++;
+		if (rel1[i] & (SWEEP_INCLUDED | SWEEP_EQUALS)) {
+			st_debug(ADDRCOMP, 2, "skipping %P, included in sf2\n",
+					sf1->routes[i].subnet);
+			continue;
 		}
+		clone_route_nofree(&sf3->routes[k], &sf1->routes[i]);
+		k++;
 	}
 	sf3->nr = k;
+	st_free(rel1, sf1->nr + 1);
+	st_free(rel2, sf2->nr + 1);
 	return 1;
 }
 
 /*
  *  loop through sf1 and match against PAIP/ IPAM
+ *  PAIP is indexed once in a prefix trie, each route needs one lookup
  */
-void print_file_against_paip(struct subnet_file *sf1, const struct subnet_file *paip,
+int print_file_against_paip(struct subnet_file *sf1, const struct subnet_file *paip,
 		struct st_options *nof)
 {
-	int mask, find_mask;
-	int res;
 	unsigned long i, j;
-	int find_included, find_equals, find_j;
-	int includes;
+	unsigned long includes[6];
+	long k, n;
+	int res;
+	struct st_trie trie;
+	struct st_trie_match m;
+	const struct route *r;
 
 	debug_timing_start(2);
+	res = st_trie_load_subnet_file(&trie, paip);
+	if (res < 0) {
+		debug_timing_end(2);
+		return res;
+	}
 	for (i = 0; i < sf1->nr; i++) {
-		find_equals = 0;
+		st_trie_lookup(&trie, &sf1->routes[i].subnet, &m);
 		/** first try an exact match **/
-		for (j = 0;  j < paip->nr; j++) {
-			res = subnet_compare(&sf1->routes[i].subnet, &paip->routes[j].subnet);
-			if (res == EQUALS) {
-				free_ea(&sf1->routes[i].ea[0]); /* ea[0] == comment */
-				ea_strdup(&sf1->routes[i].ea[0], paip->routes[j].ea[0].value);
-				fprint_route_fmt(nof->output_file, &sf1->routes[i],
-						nof->output_fmt);
-				find_equals = 1;
-				break;
-			}
-		}
-		if (find_equals)
+		if (m.equals) {
+			j = m.equals->first;
+			free_ea(&sf1->routes[i].ea[0]); /* ea[0] == comment */
+			ea_clone(&sf1->routes[i].ea[0], &paip->routes[j].ea[0]);
+			fprint_route_fmt(nof->output_file, &sf1->routes[i],
+					nof->output_fmt);
 			continue;
+		}
 
-		find_included = 0;
-		includes = 0;
-		find_mask = 0;
 		free_ea(&sf1->routes[i].ea[0]);
-		ea_strdup(&sf1->routes[i].ea[0], "NOT FOUND");
+		ea_intern(&sf1->routes[i].ea[0], "NOT FOUND");
 		fprint_route_fmt(nof->output_file, &sf1->routes[i], nof->output_fmt);
 
-		/* we look a second time for a non-equal match */
-		for (j = 0; j < paip->nr; j++) {
-			mask = paip->routes[j].subnet.mask;
-			res  = subnet_compare(&sf1->routes[i].subnet, &paip->routes[j].subnet);
-			if (res == INCLUDED) {
-				find_included = 1;
-				/* we  get the largest including mask only */
-				if (mask <  find_mask)
-					continue;
-				find_j = j;
-				find_mask = mask;
-			} else if (includes > 5) {
-				/* rate limite */
-				continue;
-			} else if (res == INCLUDES) {
-				includes++;
-				st_fprintf(nof->output_file, "###%I;%d includes %I;%d;%s\n",
-						sf1->routes[i].subnet, sf1->routes[i].subnet.mask,
-						paip->routes[j].subnet, mask,
-						paip->routes[j].ea[0].value);
-			}
+		/* rate limited; print the first 6 included subnets, in PAIP order */
+		n = st_trie_subtree_first(&trie, m.below, 2, includes, 6);
+		if (n < 0) {
+			free_st_trie(&trie);
+			debug_timing_end(2);
+			return -1;
 		}
-		if (find_included) {
+		for (k = 0; k < n; k++) {
+			r = &paip->routes[includes[k]];
+			st_fprintf(nof->output_file, "###%I;%d includes %I;%d;%s\n",
+					sf1->routes[i].subnet, sf1->routes[i].subnet.mask,
+					r->subnet, r->subnet.mask, r->ea[0].value);
+		}
+		/* we get the largest including mask only; last one in PAIP order */
+		if (m.included) {
+			r = &paip->routes[m.included->last];
 			st_fprintf(nof->output_file, "###%I;%d is included in  %I;%d;%s\n",
 					sf1->routes[i].subnet, sf1->routes[i].subnet.mask,
-					paip->routes[find_j].subnet, find_mask,
-					paip->routes[find_j].ea[0].value);
+					r->subnet, r->subnet.mask, r->ea[0].value);
 		}
 	}
+	free_st_trie(&trie);
 	debug_timing_end(2);
+	return 1;
 }
 
-int network_grep_file(const char *name, struct st_options *nof, const char *ip)
+/*
+ * find a query prefix having a relation (EQUALS, INCLUDES, INCLUDED) with 's'
+ * returns the index of the query, -1 if none
+ * the equal query first, then the longest including query, then the first
+ * included query in pattern order
+ */
+static long grep_trie_match(const struct st_trie *t, const struct subnet *s)
+{
+	struct st_trie_match m;
+	long k = -1;
+	int i;
+
+	if (st_trie_lookup(t, s, &m) == 0)
+		return -1;
+	if (m.equals)
+		return m.equals->first;
+	if (m.included)
+		return m.included->first;
+	for (i = 0; i < 2; i++)
+		if (m.below[i] && (k == -1 || m.below[i]->min < k))
+			k = m.below[i]->min;
+	return k;
+}
+
+/*
+ * scan file 'name' once, print each line having a prefix related to one of
+ * the queries stored in trie 't'
+ */
+static int grep_file_trie(const char *name, struct st_options *nof,
+		const struct st_trie *t, const struct subnet *queries)
 {
 	char *s;
+	const char *l;
 	char buffer[CSV_MAX_LINE_LEN];
-	char save_buffer[CSV_MAX_LINE_LEN];
-	FILE *f;
-	struct subnet subnet, subnet1;
-	int i, res, find_ip, do_compare, reevaluate;
+	struct st_file *f;
+	struct subnet subnet;
+	int i, len, res, find_ip, do_compare, reevaluate;
 	unsigned long line = 0;
+	long k;
 
 	if (name == NULL)
 		return -1;
-	f = fopen(name, "r");
+	/* regular files are mapped, lines are printed straight from the mapping */
+	f = st_open_mmap(name, 128000);
 	if (f == NULL) {
 		fprintf(stderr, "error: cannot open %s for reading\n", name);
 		return -2;
 	}
-	res = get_subnet_or_ip(ip, &subnet1);
-	if (res < 0) {
-		fprintf(stderr, "'%s' is not a prefix/mask\n", ip);
-		fclose(f);
-		return -3;
-	}
 	debug_timing_start(2);
-	while ((s = fgets_truncate_buffer(buffer, sizeof(buffer), f, &i))) {
+	while ((l = st_getline_slice(f, sizeof(buffer), &len, &i))) {
 		line++;
-		debug(GREP, 9, "grepping line %lu : %s\n", line, s);
 		if (i) {
 			debug(GREP, 1, "%s line %lu is longer than max size %d\n",
 					name, line, (int)sizeof(buffer));
@@ -373,11 +673,15 @@ int network_grep_file(const char *name, struct st_options *nof, const char *ip)
 		if (line >= CSV_MAX_LINE_NUMBER) {
 			debug(GREP, 1, "File %s has too many lines, MAX=%lu\n",
 					name, CSV_MAX_LINE_NUMBER);
-			fclose(f);
+			st_close(f);
 			debug_timing_end(2);
 			return -1;
 		}
-		strcpy(save_buffer, buffer);
+		/* strtok needs a copy; l is kept intact for printing */
+		memcpy(buffer, l, len);
+		buffer[len] = '\0';
+		s = buffer;
+		debug(GREP, 9, "grepping line %lu : %s\n", line, s);
 		s = strtok(s, nof->delim);
 		if (s == NULL)
 			continue;
@@ -451,158 +755,414 @@ int network_grep_file(const char *name, struct st_options *nof, const char *ip)
 			}
 
 			if (do_compare == 1) {
-				switch (subnet_compare(&subnet,  &subnet1)) {
-				case EQUALS:
-					fprintf(nof->output_file, "%s\n", save_buffer);
-					debug(GREP, 5, "field %s line %lu equals\n",  s, line);
+				k = grep_trie_match(t, &subnet);
+				if (k >= 0) {
+					if (nof->grep_tag)
+						st_fprintf(nof->output_file, "%P%c",
+								queries[k], nof->delim[0]);
+					fwrite(l, 1, len, nof->output_file);
+					fputc('\n', nof->output_file);
+					st_debug(GREP, 5, "field %s line %lu matches %P\n",
+							s, line, queries[k]);
 					do_compare = 2;
-					break;
-				case INCLUDES:
-					fprintf(nof->output_file, "%s\n", save_buffer);
-					debug(GREP, 5, "field %s line %lu includes\n",  s, line);
-					do_compare = 2;
-					break;
-				case INCLUDED:
-					fprintf(nof->output_file, "%s\n", save_buffer);
-					debug(GREP, 5, "field %s line %lu included\n",  s, line);
-					do_compare = 2;
-					break;
-				default:
+				} else
 					do_compare = 0;
-					break;
-				}
 			}
 			if (do_compare == 2) /*  one match found, next line please */
 				break;
 			if (nof->grep_field && find_ip == 0)
 				break; /* no match found but we wanted only THIS field */
 		} while (1);
-	} /* for fgets */
-	fclose(f);
+	} /* for st_getline_slice */
+	st_close(f);
 	debug_timing_end(2);
 	return 1;
 }
 
+int network_grep_file(const char *name, struct st_options *nof, const char *ip)
+{
+	struct subnet subnet1;
+	struct st_trie t;
+	int res;
+
+	res = get_subnet_or_ip(ip, &subnet1);
+	if (res < 0) {
+		fprintf(stderr, "'%s' is not a prefix/mask\n", ip);
+		return -3;
+	}
+	res = alloc_st_trie(&t, 1);
+	if (res < 0)
+		return res;
+	st_trie_insert(&t, &subnet1, 0);
+	res = grep_file_trie(name, nof, &t, &subnet1);
+	free_st_trie(&t);
+	return res;
+}
+
+/*
+ * load prefixes from 'name', one per line; empty lines & lines starting
+ * with '#' are ignored
+ * returns:
+ *	number of prefixes loaded (*queries must be freed by caller)
+ *	<0 on error
+ */
+static long load_grep_patterns(const char *name, struct subnet **queries,
+		unsigned long *max_nr)
+{
+	char buffer[CSV_MAX_LINE_LEN];
+	char *s;
+	FILE *f;
+	struct subnet *q, *new_q;
+	unsigned long nr = 0, max = 1024, line = 0;
+	int res;
+
+	f = fopen(name, "r");
+	if (f == NULL) {
+		fprintf(stderr, "error: cannot open %s for reading\n", name);
+		return -2;
+	}
+	q = st_malloc(max * sizeof(struct subnet), "grep patterns");
+	if (q == NULL) {
+		fclose(f);
+		return -1;
+	}
+	while ((s = fgets_truncate_buffer(buffer, sizeof(buffer), f, &res))) {
+		line++;
+		s = strtok(s, " \t\r\n");
+		if (s == NULL || s[0] == '#')
+			continue;
+		if (nr == max) {
+			new_q = st_realloc(q, 2 * max * sizeof(struct subnet),
+					max * sizeof(struct subnet), "grep patterns");
+			if (new_q == NULL) {
+				res = -1;
+				goto error;
+			}
+			q = new_q;
+			max *= 2;
+		}
+		res = get_subnet_or_ip(s, &q[nr]);
+		if (res < 0) {
+			fprintf(stderr, "%s line %lu: '%s' is not a prefix/mask\n",
+					name, line, s);
+			res = -3;
+			goto error;
+		}
+		nr++;
+	}
+	fclose(f);
+	debug(GREP, 3, "%lu patterns loaded from %s\n", nr, name);
+	*queries = q;
+	*max_nr  = max;
+	return nr;
+error:
+	fclose(f);
+	st_free(q, max * sizeof(struct subnet));
+	return res;
+}
+
+int network_grep_file_patterns(const char *name, struct st_options *nof,
+		const char *pattern_file)
+{
+	struct subnet *queries;
+	struct st_trie t;
+	unsigned long i, max_nr;
+	long nr;
+	int res;
+
+	nr = load_grep_patterns(pattern_file, &queries, &max_nr);
+	if (nr < 0)
+		return nr;
+	res = alloc_st_trie(&t, nr);
+	if (res < 0) {
+		st_free(queries, max_nr * sizeof(struct subnet));
+		return res;
+	}
+	for (i = 0; i < nr; i++)
+		st_trie_insert(&t, &queries[i], i);
+	res = grep_file_trie(name, nof, &t, queries);
+	free_st_trie(&t);
+	st_free(queries, max_nr * sizeof(struct subnet));
+	return res;
+}
+
+/* lookup output is buffered here, not line by line through stdio */
+#define LOOKUP_OUT_SIZE 65536
+
+struct lookup_out {
+	FILE *file;
+	int len;
+	char buffer[LOOKUP_OUT_SIZE];
+};
+
+static int lookup_out_flush(struct lookup_out *o)
+{
+	int res = 1;
+
+	if (o->len && fwrite(o->buffer, o->len, 1, o->file) != 1)
+		res = -1;
+	o->len = 0;
+	return res;
+}
+
+/* print one output line: 'ip', a delim char and 's' */
+static int lookup_out_line(struct lookup_out *o, const char *ip, int ip_len,
+		char delim, const char *s, int len)
+{
+	char *p;
+
+	if (o->len + ip_len + len + 1 > LOOKUP_OUT_SIZE) {
+		if (lookup_out_flush(o) < 0)
+			return -1;
+		/* can't happen with CSV_MAX_LINE_LEN input lines */
+		if (ip_len + len + 1 > LOOKUP_OUT_SIZE)
+			return -1;
+	}
+	p = o->buffer + o->len;
+	memcpy(p, ip, ip_len);
+	p[ip_len] = delim;
+	memcpy(p + ip_len + 1, s, len);
+	o->len += ip_len + len + 1;
+	return 1;
+}
+
+/* route i of sf, formatted only once */
+static const char *lookup_route_string(struct st_options *nof, const struct subnet_file *sf,
+		char **cache, long i)
+{
+	char buffer[1024];
+
+	if (cache[i] == NULL) {
+		sprint_route_fmt(buffer, sizeof(buffer), &sf->routes[i], nof->output_fmt);
+		cache[i] = st_strdup(buffer);
+	}
+	return cache[i];
+}
+
+int lookup_ip_file(const struct subnet_file *sf, const char *name, struct st_options *nof)
+{
+	char *s;
+	const char *r;
+	struct st_file *f;
+	struct st_dir24 d;
+	struct st_mtrie t;
+	const struct st_mtrie_result *m;
+	struct subnet addr;
+	struct lookup_out *o;
+	char delim[MAX_DELIM + 4];
+	char **cache;
+	unsigned long i, line = 0;
+	long k;
+	int res, len, ip_len;
+
+	/* name == NULL means stdin */
+	f = st_open_mmap(name, 128000);
+	if (f == NULL) {
+		fprintf(stderr, "error: cannot open %s for reading\n", name);
+		return -2;
+	}
+	debug_timing_start(2);
+	res = -1;
+	o = st_malloc(sizeof(struct lookup_out), "lookup output");
+	if (o == NULL)
+		goto out_close;
+	o->file = nof->output_file;
+	o->len  = 0;
+	cache = st_malloc((sf->nr + 1) * sizeof(char *), "lookup output cache");
+	if (cache == NULL)
+		goto out_free;
+	for (i = 0; i < sf->nr; i++)
+		cache[i] = NULL;
+	res = dir24_load_subnet_file(&d, sf);
+	if (res < 0)
+		goto out_cache;
+	/* IPv6 routes; IPv4 routes are in the DIR-24-8 table */
+	res = st_mtrie_load_subnet_file(&t, sf);
+	if (res < 0)
+		goto out_dir24;
+
+	/* the IP is the first field, delimited by a delim char or a space */
+	snprintf(delim, sizeof(delim), "%s \t\r", nof->delim);
+	while ((s = st_getline_truncate(f, CSV_MAX_LINE_LEN, &len, &res))) {
+		line++;
+		s = strtok(s, delim);
+		if (s == NULL)
+			continue;
+		ip_len = strlen(s);
+		res = string2addr(s, &addr.ip_addr, ip_len);
+		if (res == IPV4_A) {
+			k = dir24_lookup(&d, addr.ip);
+		} else if (res == IPV6_A) {
+			addr.mask = 128;
+			m = st_mtrie_lookup(&t, &addr);
+			k = (m ? m->first : -1);
+		} else {
+			debug(LOOKUP, 2, "line %lu: '%s' is not an IP\n", line, s);
+			k = -2;
+		}
+		/* query IP first, so each output line says what was looked up */
+		if (k >= 0) {
+			r = lookup_route_string(nof, sf, cache, k);
+			if (r == NULL) {
+				res = -1;
+				break;
+			}
+			res = lookup_out_line(o, s, ip_len, nof->delim[0], r, strlen(r));
+		} else if (k == -1)
+			res = lookup_out_line(o, s, ip_len, nof->delim[0], "NOT FOUND\n", 10);
+		else
+			res = lookup_out_line(o, s, ip_len, nof->delim[0], "INVALID\n", 8);
+		if (res < 0)
+			break;
+	}
+	if (res >= 0)
+		res = lookup_out_flush(o);
+	res = (res < 0 ? res : 1);
+	free_st_mtrie(&t);
+out_dir24:
+	free_dir24(&d);
+out_cache:
+	for (i = 0; i < sf->nr; i++)
+		if (cache[i])
+			st_free_string(cache[i]);
+	st_free(cache, (sf->nr + 1) * sizeof(char *));
+out_free:
+	st_free(o, sizeof(struct lookup_out));
+out_close:
+	st_close(f);
+	debug_timing_end(2);
+	return res;
+}
+
 /*
  * simplify subnet file (removes redundant entries)
  * GW is not taken into account
  */
 int subnet_file_simplify(struct subnet_file *sf)
 {
-	unsigned long i;
+	unsigned long i, j;
 	int  res;
-	TAS tas;
-	struct route *new_r, *r;
+	struct route *r;
 
 	if (sf->nr == 0)
 		return 0;
 	debug_timing_start(2);
-	res = alloc_tas(&tas, sf->nr, __heap_subnet_is_superior);
-	if (res < 0)
-		return -1;
-	new_r = st_malloc(sf->nr * sizeof(struct route), "struct route");
-	if (new_r == NULL) {
-		free_tas(&tas);
+	res = subnet_file_sort_prefix(sf);
+	if (res < 0) {
+		debug_timing_end(2);
 		return -1;
 	}
-	for (i = 0; i < sf->nr; i++)
-		addTAS(&tas, &sf->routes[i]);
-
-	r = popTAS(&tas);
-	copy_route(&new_r[0], r);
 	i = 1;
-	while (1) {
-		r = popTAS(&tas);
-		if (r == NULL)
-			break;
-		/* because the 'new_r' list is sorted,
+	for (j = 1; j < sf->nr; j++) {
+		r = &sf->routes[j];
+		/* because the list is sorted,
 		 * we know the only network to consider is i - 1
 		 */
-		res = subnet_compare(&r->subnet, &new_r[i - 1].subnet);
+		res = subnet_compare(&r->subnet, &sf->routes[i - 1].subnet);
 		if (res == INCLUDED || res == EQUALS) {
 			st_debug(ADDRCOMP, 3, "%P is included in %P, skipping\n",
-					r->subnet, new_r[i - 1].subnet);
+					r->subnet, sf->routes[i - 1].subnet);
 			free_route(r);
 			continue;
 		}
-		copy_route(&new_r[i], r);
+		if (i != j)
+			copy_route(&sf->routes[i], r);
 		i++;
 	}
-	st_free(sf->routes, sf->max_nr * sizeof(struct route));
-	sf->max_nr = sf->nr;
 	sf->nr = i;
-	free_tas(&tas);
-	sf->routes = new_r;
 	debug_timing_end(2);
 	return 1;
 }
 
+/* is s->ip different from the network address ? */
+static int subnet_has_host_bits(const struct subnet *s)
+{
+	struct subnet net;
+
+	copy_subnet(&net, s);
+	if (net.mask == 0)
+		memset(&net.ip6, 0, sizeof(net.ip6));
+	else
+		first_ip(&net);
+	if (s->ip_ver == IPV4_A)
+		return (net.ip != s->ip);
+	return !is_equal_ipv6(net.ip6, s->ip6);
+}
+
 /*
  * simply_route_file takes GW into account, must be equal
+ * routes are walked in prefix order; a stack (one per IP version) holds the
+ * 'open' kept routes, each one including the one above it
+ * the top of the stack is the longest kept route including the current one,
+ * so each route is compared once; O(n) after the sort
  */
 int route_file_simplify(struct subnet_file *sf,  int mode)
 {
-	unsigned long i, j, k, a;
-	int res, skip;
-	TAS tas;
+	unsigned long i, j, k, a, n;
+	unsigned long *stack[2];
+	unsigned long sp[2];
+	int res, skip, v, host_bits;
 	struct route *new_r, *r, *discard;
 
-	res = alloc_tas(&tas, sf->nr, __heap_subnet_is_superior);
+	res = subnet_file_sort_prefix(sf);
 	if (res < 0)
 		return res;
 	new_r = st_malloc(sf->nr * sizeof(struct route), "struct route"); /* common routes */
-	if (new_r == NULL) {
-		free_tas(&tas);
+	if (new_r == NULL)
 		return -1;
-	}
 	discard = st_malloc(sf->nr * sizeof(struct route), "struct route"); /* excluded routes */
 	if (discard == NULL) {
-		free_tas(&tas);
 		st_free(new_r, sf->nr * sizeof(struct route));
 		return -1;
 	}
+	/* routes with host bits may break nesting, so the stack is bound by nr, not 129 */
+	stack[0] = st_malloc(2 * (sf->nr + 1) * sizeof(unsigned long), "simplify stack");
+	if (stack[0] == NULL) {
+		st_free(new_r, sf->nr * sizeof(struct route));
+		st_free(discard, sf->nr * sizeof(struct route));
+		return -1;
+	}
+	stack[1] = stack[0] + sf->nr + 1;
+	sp[0] = sp[1] = 0;
 
-	for (i = 0; i < sf->nr; i++)
-		addTAS(&tas, &sf->routes[i]);
-
-	r = popTAS(&tas);
-	copy_route(&new_r[0], r);
-	i = 1; /* index in the 'new_r' struct */
+	i = 0; /* index in the 'new_r' struct */
 	j = 0; /* index in the 'discard' struct */
-	while (1) {
-		r = popTAS(&tas);
-		if (r == NULL)
-			break;
-		a = i - 1;
+	for (n = 0; n < sf->nr; n++) {
+		r = &sf->routes[n];
+		v = (r->subnet.ip_ver == IPV6_A);
 		skip = 0;
-		while (1) {
-			res = subnet_compare(&r->subnet, &new_r[a].subnet);
-			if (res == INCLUDED || res == EQUALS) {
-				/* because the 'new_r' list is sorted,
-				 * we know the first 'backward'
-				 * match is the longest one and the longest match
-				 * is the one that matters
-				 */
-				if (is_equal_gw(r, &new_r[a])) {
-					st_debug(ADDRCOMP, 3, "%P is included in %P, discarding it\n",
-							r->subnet, new_r[a].subnet);
-					skip = 1;
-				} else {
-					st_debug(ADDRCOMP, 3, "%P is included in %P but GW is different\n",
-							r->subnet, new_r[a].subnet);
-				}
+		/* close kept routes that dont include r; they wont include next ones
+		 * a route with host bits is out of prefix order, so it can't close
+		 * anything; just look for the latest kept route including it
+		 */
+		host_bits = subnet_has_host_bits(&r->subnet);
+		for (a = sp[v]; a > 0; a--) {
+			k = stack[v][a - 1];
+			res = subnet_compare(&r->subnet, &new_r[k].subnet);
+			if (res == INCLUDED || res == EQUALS)
 				break;
+			if (host_bits == 0)
+				sp[v]--;
+		}
+		if (a > 0) {
+			/* the longest match is the one that matters */
+			k = stack[v][a - 1];
+			if (is_equal_gw(r, &new_r[k])) {
+				st_debug(ADDRCOMP, 3, "%P is included in %P, discarding it\n",
+						r->subnet, new_r[k].subnet);
+				skip = 1;
+			} else {
+				st_debug(ADDRCOMP, 3, "%P is included in %P but GW is different\n",
+						r->subnet, new_r[k].subnet);
 			}
-			if (a == 0)
-				break;
-			a--;
 		}
-		if (skip == 0)
+		if (skip == 0) {
+			stack[v][sp[v]++] = i;
 			copy_route(&new_r[i++], r);
-		else
+		} else
 			copy_route(&discard[j++], r);
 	}
-	free_tas(&tas);
+	st_free(stack[0], 2 * (sf->nr + 1) * sizeof(unsigned long));
 	st_free(sf->routes, sf->max_nr * sizeof(struct route));
 	sf->max_nr = sf->nr;
 	if (mode == 0) {
@@ -675,8 +1235,8 @@ int aggregate_route_file(struct subnet_file *sf, int mode)
 		else
 			zero_ipaddr(&new_r[j].gw); /* the aggregate route has null gateway */
 		free_route(&sf->routes[i]);
-		st_free_string(new_r[j].ea[0].value);
-		ea_strdup(&new_r[j].ea[0], "AGGREGATE");
+		free_ea(&new_r[j].ea[0]);
+		ea_intern(&new_r[j].ea[0], "AGGREGATE");
 		if (new_r[j].ea[0].value == NULL) {
 			st_free(new_r, sizeof(struct route) * sf->nr);
 			debug_timing_end(2);
@@ -700,8 +1260,8 @@ int aggregate_route_file(struct subnet_file *sf, int mode)
 					copy_ipaddr(&new_r[j].gw, &sf->routes[i].gw);
 				else
 					zero_ipaddr(&new_r[j].gw);
-				st_free_string(new_r[j].ea[0].value);
-				ea_strdup(&new_r[j].ea[0], "AGGREGATE");
+				free_ea(&new_r[j].ea[0]);
+				ea_intern(&new_r[j].ea[0], "AGGREGATE");
 				if (new_r[j].ea[0].value == NULL) {
 					st_free(new_r, sizeof(struct route) * sf->nr);
 					debug_timing_end(2);
@@ -722,69 +1282,45 @@ int aggregate_route_file(struct subnet_file *sf, int mode)
 int subnet_file_merge_common_routes(const struct subnet_file *sf1,  const struct subnet_file *sf2,
 		struct subnet_file *sf3)
 {
-	unsigned long  i, j, can_add;
+	unsigned long  i, j, k;
 	int res;
-	struct route *r;
-	TAS tas;
+	unsigned char *rel1, *rel2;
 
 	debug_timing_start(2);
-	res = alloc_tas(&tas, sf1->nr + sf2->nr, &__heap_subnet_is_superior);
+	res = alloc_subnet_file(sf3, sf1->nr + sf2->nr);
 	if (res < 0) {
 		debug_timing_end(2);
 		return res;
 	}
-	res = alloc_subnet_file(sf3, sf1->nr + sf2->nr);
+	res = subnet_file_relations(sf1, sf2, &rel1, &rel2);
 	if (res < 0) {
-		free_tas(&tas);
+		free_subnet_file(sf3);
 		debug_timing_end(2);
 		return res;
 	}
-	/* going through subnet_file1 ; adding to stack only if equals or included */
+	k = 0;
+	/* subnet_file1 routes equals or included in subnet_file2 */
 	for (i = 0; i < sf1->nr; i++) {
-		for (j = 0; j < sf2->nr; j++) {
-			res = subnet_compare(&sf1->routes[i].subnet, &sf2->routes[j].subnet);
-			if (res == INCLUDED || res == EQUALS) {
-				st_debug(ADDRCOMP, 3, "Loop #1 adding %P (included in : %P)\n",
-						sf1->routes[i].subnet,
-						sf2->routes[j].subnet);
-				addTAS(&tas, &sf1->routes[i]);
-				break;
-			}
+		if (rel1[i] & (SWEEP_INCLUDED | SWEEP_EQUALS)) {
+			st_debug(ADDRCOMP, 3, "Loop #1 adding %P\n", sf1->routes[i].subnet);
+			clone_route_nofree(&sf3->routes[k++], &sf1->routes[i]);
 		}
 	}
-	/* going through subnet_file2 ; adding to stack only if INCLUDED */
+	/* subnet_file2 routes INCLUDED in subnet_file1; EQUALS were already added */
 	for (j = 0; j < sf2->nr; j++) {
-		can_add = 0;
-		for (i = 0; i < sf1->nr; i++) {
-			res = subnet_compare(&sf2->routes[j].subnet, &sf1->routes[i].subnet);
-			if (res == INCLUDED) {
-				st_debug(ADDRCOMP, 3, "Loop #2 may add %P (included in : %P)\n",
-						sf2->routes[j].subnet,
-						sf1->routes[i].subnet);
-				can_add = 1;
-			} else if (res == EQUALS) {/* already added, skipping */
-				can_add = 0;
-				 /* maybe the route we are matching is included in something;
-				  * in that case we wont add it again
-				  */
-				break;
-			}
-		}
-		if (can_add) {
+		if ((rel2[j] & SWEEP_INCLUDED) && !(rel2[j] & SWEEP_EQUALS)) {
 			st_debug(ADDRCOMP, 3, "Loop #2 add %P\n", sf2->routes[j].subnet);
-			addTAS(&tas, &sf2->routes[j]);
+			clone_route_nofree(&sf3->routes[k++], &sf2->routes[j]);
 		}
 	}
-	for (i = 0; ; i++) {
-		r = popTAS(&tas);
-		if (r == NULL)
-			break;
-		clone_route_nofree(&sf3->routes[i], r);
-	}
-	sf3->nr = i;
-	free_tas(&tas);
+	sf3->nr = k;
+	st_free(rel1, sf1->nr + 1);
+	st_free(rel2, sf2->nr + 1);
+	res = subnet_file_sort_prefix(sf3);
+	if (res < 0)
+		free_subnet_file(sf3);
 	debug_timing_end(2);
-	return 1;
+	return (res < 0 ? res : 1);
 }
 
 unsigned long long sum_subnet_file(struct subnet_file *sf)
@@ -844,12 +1380,16 @@ int subnet_file_remove_subnet(const struct subnet_file *sf1, struct subnet_file
 			fprintf(stderr, "%s : no memory\n", __func__);
 			return n;
 		}
-		/* realloc memory if necessary */
-		if (n + sf2->nr >= sf2->max_nr) {
+		/* realloc memory if necessary; keep room for the n fragments
+		 * and the routes of sf1 not processed yet
+		 */
+		while (j + n + (sf1->nr - i - 1) >= sf2->max_nr) {
 			new_r = st_realloc(sf2->routes, sizeof(struct route) * sf2->max_nr * 2,
 					sizeof(struct route) * sf2->max_nr, "struct route");
-			if (new_r == NULL)
+			if (new_r == NULL) {
+				st_free(r, sizeof(struct subnet) * n);
 				return -3;
+			}
 			sf2->routes = new_r;
 			sf2->max_nr *= 2;
 		}
@@ -865,31 +1405,136 @@ int subnet_file_remove_subnet(const struct subnet_file *sf1, struct subnet_file
 	return 1;
 }
 
+/* append a copy of route 'r' with subnet 's' to sf, growing it if needed */
+static int remove_add_fragment(struct subnet_file *sf, const struct route *r,
+		const struct subnet *s)
+{
+	struct route *new_r;
+	int res;
+
+	if (sf->nr == sf->max_nr) {
+		if (2 * sf->max_nr > SF_MAX_ROUTES_NUMBER) {
+			fprintf(stderr, "Error, subnet file max routes number is %lu\n",
+					SF_MAX_ROUTES_NUMBER);
+			return -1;
+		}
+		new_r = st_realloc(sf->routes, sizeof(struct route) * sf->max_nr * 2,
+				sizeof(struct route) * sf->max_nr, "struct route");
+		if (new_r == NULL)
+			return -1;
+		sf->routes = new_r;
+		sf->max_nr *= 2;
+	}
+	res = clone_route_nofree(&sf->routes[sf->nr], r);
+	if (res < 0)
+		return res;
+	if (s)
+		copy_subnet(&sf->routes[sf->nr].subnet, s);
+	sf->nr++;
+	return 1;
+}
+
+/*
+ * remove exclusions ex[lo] .. ex[hi - 1] from 'block'
+ * exclusions are sorted, disjoint, and strictly included in 'block'
+ * 'block' is halved until each half is either free or fully excluded;
+ * the free halves are the same CIDR blocks subnet_remove() would return
+ */
+static int remove_split_block(struct subnet_file *sf, const struct route *r,
+		const struct subnet *block, const struct sweep_prefix *ex,
+		unsigned long lo, unsigned long hi)
+{
+	struct subnet half[2];
+	unsigned long mid;
+	int res;
+
+	if (lo == hi)
+		return remove_add_fragment(sf, r, block);
+	if (hi - lo == 1 && !sweep_net_cmp(&ex[lo].net, block))
+		return 1;
+	copy_subnet(&half[0], block);
+	half[0].mask++;
+	copy_subnet(&half[1], &half[0]);
+	next_subnet(&half[1]);
+	for (mid = lo; mid < hi; mid++)
+		if (sweep_contains(&half[1], &ex[mid].net))
+			break;
+	res = remove_split_block(sf, r, &half[0], ex, lo, mid);
+	if (res < 0)
+		return res;
+	return remove_split_block(sf, r, &half[1], ex, mid, hi);
+}
+
 /*
  * subnets from sf3 are removed from sf1
- * result is stored in *sf2 BUGGED
+ * result is stored in *sf2, which is released on error
+ * sf1 & sf3 are sorted, sf3 is reduced to disjoint prefixes; then a single
+ * sweep finds, for each route of sf1, the exclusions overlapping it
+ * remaining parts of a route keep its GW, device & EA
  */
 int subnet_file_remove_file(struct subnet_file *sf1, struct subnet_file *sf2,
 		const struct subnet_file *sf3)
 {
-	unsigned long i;
+	unsigned long i, p, lo, hi, ex_nr;
+	struct sweep_prefix *p1, *ex;
+	const struct route *r;
 	int res;
-	struct subnet_file sf;
 
 	debug_timing_start(2);
-	memcpy(&sf, sf1, sizeof(struct subnet_file));
-
+	res = alloc_subnet_file(sf2, (sf1->nr > 16 ? sf1->nr : 16));
+	if (res < 0) {
+		debug_timing_end(2);
+		return res;
+	}
+	p1 = sweep_sort_file(sf1);
+	ex = sweep_sort_file(sf3);
+	if (p1 == NULL || ex == NULL) {
+		res = -1;
+		goto out;
+	}
+	/* drop exclusions included in another one; sorted order puts the larger first */
+	ex_nr = 0;
 	for (i = 0; i < sf3->nr; i++) {
-		st_debug(ADDRREMOVE, 4, "Loop %d, Removing %P\n", i, sf3->routes[i].subnet);
-		res = subnet_file_remove_subnet(&sf, sf2, &sf3->routes[i].subnet);
-		if (res < 0) {
-			debug_timing_end(2);
-			return res;
+		if (ex_nr && sweep_contains(&ex[ex_nr - 1].net, &ex[i].net))
+			continue;
+		ex[ex_nr++] = ex[i];
+	}
+	debug(ADDRREMOVE, 3, "%lu disjoint exclusions out of %lu\n", ex_nr, sf3->nr);
+
+	p = 0;
+	for (i = 0; i < sf1->nr; i++) {
+		r = &sf1->routes[p1[i].index];
+		/* routes are sorted, so the first exclusion not lower than r only moves forward */
+		while (p < ex_nr && sweep_net_cmp(&ex[p].net, &p1[i].net) < 0)
+			p++;
+		/* disjoint exclusions : only ex[p - 1] or ex[p] can include r */
+		if ((p > 0 && sweep_contains(&ex[p - 1].net, &p1[i].net)) ||
+				(p < ex_nr && !sweep_net_cmp(&ex[p].net, &p1[i].net))) {
+			st_debug(ADDRREMOVE, 4, "removing entire subnet %P\n", r->subnet);
+			continue;
 		}
-		st_free(sf.routes, sf.max_nr * sizeof(struct route));
-		memcpy(&sf, sf2, sizeof(struct subnet_file));
+		lo = hi = p;
+		while (hi < ex_nr && sweep_contains(&p1[i].net, &ex[hi].net))
+			hi++;
+		if (lo == hi) {
+			st_debug(ADDRREMOVE, 4, "%P doesnt overlap any exclusion\n", r->subnet);
+			res = remove_add_fragment(sf2, r, NULL);
+		} else {
+			st_debug(ADDRREMOVE, 4, "removing %lu exclusions from %P\n", hi - lo,
+					r->subnet);
+			res = remove_split_block(sf2, r, &p1[i].net, ex, lo, hi);
+		}
+		if (res < 0)
+			goto out;
 	}
 	res = subnet_file_simplify(sf2);
+out:
+	if (p1)
+		st_free(p1, (sf1->nr + 1) * sizeof(struct sweep_prefix));
+	if (ex)
+		st_free(ex, (sf3->nr + 1) * sizeof(struct sweep_prefix));
+	if (res < 0)
+		free_subnet_file(sf2);
 	debug_timing_end(2);
 	if (res < 0)
 		return res;
@@ -1109,81 +1754,37 @@ int subnet_split_2(FILE *out, const struct subnet *s, char *string_levels)
 	return 1;
 }
 
-static int __heap_gw_is_superior(void *v1, void *v2)
-{
-	struct subnet *s1 = &((struct route *)v1)->subnet;
-	struct subnet *s2 = &((struct route *)v2)->subnet;
-	struct ip_addr *gw1 = &((struct route *)v1)->gw;
-	struct ip_addr *gw2 = &((struct route *)v2)->gw;
-
-	if (is_equal_ip(gw1, gw2))
-		return subnet_is_superior(s1, s2);
-	else
-		return addr_is_superior(gw1, gw2);
-}
+struct subnetsort {
+	char *name;
+	int key; /* ROUTE_KEY_* */
+};
 
-static int __heap_mask_is_superior(void *v1, void *v2)
-{
-	struct subnet *s1 = &((struct route *)v1)->subnet;
-	struct subnet *s2 = &((struct route *)v2)->subnet;
+static const struct subnetsort subnetsort[] = {
+	{ "prefix",	ROUTE_KEY_PREFIX },
+	{ "gw",		ROUTE_KEY_GW },
+	{ "mask",	ROUTE_KEY_MASK },
+	{NULL,		0}
+};
 
-	if (s1->mask == s2->mask)
-		return subnet_is_superior(s1, s2);
-	else
-		return (s1->mask < s2->mask);
-}
+#define ROUTE_SORT_MAX_KEYS 8
 
-/* sort a subnet file 'sf' with a custom cmp function
- *
- */
-static int __subnet_sort_by(struct subnet_file *sf, int cmpfunc(void *v1, void *v2))
+/* sort a subnet file 'sf' on 'nr' keys */
+static int __subnet_sort_by(struct subnet_file *sf, const struct subnetsort **keys, int nr)
 {
-	unsigned long i;
-	int res;
-	TAS tas;
-	struct route *new_r, *r;
-
-	if (sf->nr == 0)
-		return 0;
+	int k[ROUTE_SORT_MAX_KEYS];
+	int i, res;
+
+	for (i = 0; i < nr; i++)
+		k[i] = keys[i]->key;
+	/* sorting by prefix then by prefix is sorting by prefix */
+	if (nr == 1 && k[0] == ROUTE_KEY_PREFIX)
+		nr = 0;
 	debug_timing_start(2);
-	res = alloc_tas(&tas, sf->nr, cmpfunc);
-	if (res < 0) {
-		debug_timing_end(2);
-		return res;
-	}
-	new_r = st_malloc(sf->max_nr * sizeof(struct route), "struct route");
-	if (new_r == NULL) {
-		free_tas(&tas);
-		debug_timing_end(2);
-		return -1;
-	}
-	tas.print = __heap_print_subnet;
-	/* basic heapsort */
-	for (i = 0 ; i < sf->nr; i++)
-		addTAS(&tas, &(sf->routes[i]));
-	for (i = 0 ; i < sf->nr; i++) {
-		r = popTAS(&tas);
-		copy_route(&new_r[i], r);
-	}
-	free_tas(&tas);
-	st_free(sf->routes, sizeof(struct route) * sf->max_nr);
-	sf->routes = new_r;
+	res = subnet_file_sort_keys(sf, k, nr);
 	debug_timing_end(2);
-	return 0;
+	return (res < 0 ? res : 0);
 }
 
-struct subnetsort {
-	char *name;
-	int (*cmpfunc)(void *v1, void *v2);
-};
-
-static const struct subnetsort subnetsort[] = {
-	{ "prefix",	&__heap_subnet_is_superior },
-	{ "gw",		&__heap_gw_is_superior },
-	{ "mask",	&__heap_mask_is_superior },
-	{NULL,		NULL}
-};
-
 void subnet_available_cmpfunc(FILE *out)
 {
 	int i = 0;
@@ -1194,20 +1795,32 @@ void subnet_available_cmpfunc(FILE *out)
 		fprintf(out, " %s\n", subnetsort[i].name);
 		i++;
 	}
+	fprintf(out, "keys can be combined, like 'gw,mask'\n");
 }
 
 int subnet_sort_by(struct subnet_file *sf, char *name)
 {
-	int i = 0;
+	const struct subnetsort *keys[ROUTE_SORT_MAX_KEYS];
+	const char *s = name, *comma;
+	int i, len, nr = 0;
 
+	/* name is a comma-separated list of keys */
 	while (1) {
+		comma = strchr(s, ',');
+		len = (comma ? comma - s : strlen(s));
+		if (len == 0 || nr == ROUTE_SORT_MAX_KEYS)
+			return -1664;
+		for (i = 0; subnetsort[i].name != NULL; i++)
+			if (!strncasecmp(s, subnetsort[i].name, len))
+				break;
 		if (subnetsort[i].name == NULL)
+			return -1664;
+		keys[nr++] = &subnetsort[i];
+		if (comma == NULL)
 			break;
-		if (!strncasecmp(name, subnetsort[i].name, strlen(name)))
-			return __subnet_sort_by(sf, subnetsort[i].cmpfunc);
-		i++;
+		s = comma + 1;
 	}
-	return -1664;
+	return __subnet_sort_by(sf, keys, nr);
 }
 
 int fprint_routefilter_help(FILE *out)
@@ -4,16 +4,31 @@
 
 #include "st_options.h"
 #include "st_routes_csv.h"
-void compare_files(struct subnet_file *sf1, struct subnet_file *sf2, struct st_options *nof);
+int compare_files(struct subnet_file *sf1, struct subnet_file *sf2, struct st_options *nof);
 int subnet_file_cmp(const struct subnet_file *before, const struct subnet_file *after,
 		struct subnet_file *sf);
 int missing_routes(const struct subnet_file *sf1, const struct subnet_file *sf2,
 		struct subnet_file *sf3);
 int uniq_routes(const struct subnet_file *sf1, const struct subnet_file *sf2,
 		struct subnet_file *sf3);
-void print_file_against_paip(struct subnet_file *sf1, const struct subnet_file *paip,
+int print_file_against_paip(struct subnet_file *sf1, const struct subnet_file *paip,
 		struct st_options *nof);
 int network_grep_file(const char *name, struct st_options *nof, const char *ip);
+/* same as network_grep_file, for all prefixes found in 'pattern_file'
+ * the file is scanned once, each matching line is printed once
+ */
+int network_grep_file_patterns(const char *name, struct st_options *nof,
+		const char *pattern_file);
+/* lookup_ip_file: print the route of 'sf' forwarding each IP read from file 'name'
+ * one IP per line, IP on the first field
+ * longest prefix match; on equal prefixes, the first route of sf wins
+ * each output line is the IP, a delim char and the route, 'NOT FOUND' if no
+ * route matches, or 'INVALID' if the first field is not an IP
+ * @sf   : the routes
+ * @name : file to read IPs from, NULL means stdin
+ * @nof  : output format & file
+ */
+int lookup_ip_file(const struct subnet_file *sf, const char *name, struct st_options *nof);
 
 int subnet_sort_ascending(struct subnet_file *sf);
 int subnet_sort_by(struct subnet_file *sf, char *name);
@@ -39,6 +54,9 @@ unsigned long long sum_subnet_file(struct subnet_file *sf);
 
 int subnet_file_remove_subnet(const struct subnet_file *sf1, struct subnet_file *sf2,
 		const struct subnet *s2);
+/* remove all subnets of s3 from sf1, result (simplified) is stored in sf2
+ * sf2 is released on error
+ */
 int subnet_file_remove_file(struct subnet_file *sf1, struct subnet_file *sf2,
 		const struct subnet_file *s3);
 
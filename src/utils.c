@@ -29,11 +29,9 @@ int isUnsignedInt(const char *s)
 
 	if (*s == '\0')
 		return 0;
-	for (i = 1; ; i++) {
+	for (i = 0; s[i] != '\0'; i++) {
 		if (!isdigit(s[i]))
 			return 0;
-		if (s[i] == '\0')
-			break;
 	}
 	return 1;
 }
@@ -48,11 +46,9 @@ int isInt(const char *s)
 		return 0;
 	if (s[0] == '-' && s[1] == '\0')
 		return 0;
-	for (i = 1; ; i++) {
+	for (i = 1; s[i] != '\0'; i++) {
 		if (!isdigit(s[i]))
 			return 0;
-		if (s[i] == '\0')
-			break;
 	}
 	return 1;
 }